@@ -299,11 +299,81 @@ class FileLoader {
             }
             rotation = (rotation / 180.0) * M_PI;
             
-            std::shared_ptr<TriangleMesh> tmesh_ptr = std::make_shared<TriangleMesh>(tmesh_filepath, LoadVector(tmesh, "Position"), LoadMaterial(tmesh), rotation, scale);
+            std::shared_ptr<TriangleMesh> tmesh_ptr = std::make_shared<TriangleMesh>(tmesh_filepath, LoadVector(tmesh, "Position"), LoadMaterial(tmesh), rotation, scale, LoadBVHSettings(tmesh));
             
             return tmesh_ptr;
         }
 
+        /**
+         * @brief Creates the BVH build settings of a trianglemesh from yaml node.
+         * 
+         * The optional "BVH" key selects between a fast midpoint build ("Fast"), a surface area
+         * heuristic build ("Quality"), a SAH build that may also split long triangles with
+         * planes ("Spatial") and a build from triangles sorted by Morton codes ("Linear"), which
+         * is the fastest to build. The optional "SplitBudget" key limits the extra triangle references
+         * made by the spatial splits as a fraction of the triangle count. The SAH cost constants can be given with
+         * the optional "TraversalCost" and "IntersectionCost" keys. The optional "BVHLayout"
+         * key selects whether the mesh is traversed as a binary ("BVH2"), 4-wide ("BVH4") or
+         * 4-wide tree with quantized child boxes ("CompressedBVH4").
+         * The built tree is cached next to the .obj file unless the optional "BVHCache" key is false.
+         * 
+         * @param tmesh Yaml node that contains properties of TriangleMesh object
+         * @return BVHSettings for the mesh
+         */
+        BVHSettings LoadBVHSettings(YAML::Node tmesh) {
+            BVHSettings settings;
+            settings.cache = true;
+
+            YAML::Node type_node = tmesh["BVH"];
+            if (type_node.IsDefined()) {
+                std::string type = type_node.as<std::string>();
+                if (type == "Fast") {
+                    settings.mode = BVHBuildMode::Fast;
+                }
+                else if (type == "Quality") {
+                    settings.mode = BVHBuildMode::Quality;
+                }
+                else if (type == "Spatial") {
+                    settings.mode = BVHBuildMode::Spatial;
+                }
+                else if (type == "Linear") {
+                    settings.mode = BVHBuildMode::Linear;
+                }
+                else {
+                    throw InvalidBVHTypeException(filepath_, type_node.Mark().line);
+                }
+            }
+            YAML::Node layout_node = tmesh["BVHLayout"];
+            if (layout_node.IsDefined()) {
+                std::string layout = layout_node.as<std::string>();
+                if (layout == "BVH2") {
+                    settings.layout = BVHLayout::BVH2;
+                }
+                else if (layout == "BVH4") {
+                    settings.layout = BVHLayout::BVH4;
+                }
+                else if (layout == "CompressedBVH4") {
+                    settings.layout = BVHLayout::CompressedBVH4;
+                }
+                else {
+                    throw InvalidBVHTypeException(filepath_, layout_node.Mark().line);
+                }
+            }
+            if (tmesh["TraversalCost"]) {
+                settings.traversalCost = tmesh["TraversalCost"].as<float>();
+            }
+            if (tmesh["IntersectionCost"]) {
+                settings.intersectionCost = tmesh["IntersectionCost"].as<float>();
+            }
+            if (tmesh["SplitBudget"]) {
+                settings.splitBudget = tmesh["SplitBudget"].as<float>();
+            }
+            if (tmesh["BVHCache"]) {
+                settings.cache = tmesh["BVHCache"].as<bool>();
+            }
+            return settings;
+        }
+
         /**
          * @brief Creates a pointer to a rectangle object from yaml node.
          * 
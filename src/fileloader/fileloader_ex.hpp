@@ -366,4 +366,35 @@ class InvalidMaterialTypeException : public FileLoaderException {
 };
 
 
+/**
+ * @brief Representation of invalid BVH type exception. 
+ * 
+ */
+class InvalidBVHTypeException : public FileLoaderException {
+    public:
+        /**
+        * @brief Constructor for InvalidBVHTypeException.
+        * 
+        * @param filepath Filepath of the YAML file
+        * @param line Line number where the BVH type is defined
+        */
+        InvalidBVHTypeException(std::string filepath, int line) : FileLoaderException() {
+            msg_ = "FileLoader exception caught:\nInvalid BVH type in file: " +
+                    filepath + ", on line: " + std::to_string(line) + ".";
+        }
+
+        /**
+        * @brief Function that creates an exception message for invalid BVH type in the YAML file
+        * 
+        * @return Pointer to the first char of the exception message
+        */
+        virtual const char* what() const noexcept {
+            return msg_.c_str();
+        }
+
+    private:
+        std::string msg_;
+};
+
+
 #endif
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include <SFML/Graphics.hpp>
 #include "renderer.hpp"
+#include "tonemap.hpp"
 #include "button.hpp"
 #include "textbox.hpp"
 #include "fileloader.hpp"
@@ -209,7 +210,7 @@ public:
                             if(checkIfPosFloat(dofBox.getInput()) && dofBox.getInput() != ""){
                                 previewCreator.setDof(std::stof(dofBox.getInput()));
                             }
-                            createImg(previewCreator.parallelRender(1));
+                            createImg(Tonemap().apply(previewCreator.parallelRender(1)));
                             saveImage("preview.png");
                             image.loadFromFile("preview.png");
                             texture.loadFromImage(image);  
@@ -322,7 +323,6 @@ public:
         Renderer sceneRenderer(resX, resY, loadedScene);
         sceneRenderer.setMaxBounces(bounces);
         sceneRenderer.setDof(dof);
-        std::vector<std::vector<Color>> combinedSamples;
 
         int i = 0;
         
@@ -340,21 +340,8 @@ public:
                     }
                 }
                 while(i < sampleSize) {
-                    auto result = sceneRenderer.parallelRender(1);
-                    float weight = 1.0 / (1 + i);
-                    if(i == 0) {
-                        combinedSamples = result;
-                    } else {
-                        for (int pixel = 0; pixel < resX * resY; ++pixel)
-                        {
-                            int x = pixel % resX;
-                            int y = pixel / resX;
-                            
-                            combinedSamples[x][y] = clamp(combinedSamples[x][y] * (1 - weight) + weight * result[x][y]);
-                            
-                        }
-                    }
-                    createImg(combinedSamples);
+                    //Each pass adds one sample per pixel to the image kept by the renderer
+                    createImg(Tonemap().apply(sceneRenderer.parallelRender(1, i > 0)));
                     saveImage("image.png");
                     image.loadFromFile("image.png");
                     texture.loadFromImage(image);  
@@ -429,17 +416,4 @@ private:
                 selectedBox = &box;    
                 }
     }
-
-    /**
-     * @brief Clamps the given color values, i.e., ensures that the maximum value for each R, G, B is 1.
-     * 
-     * @param input the color vector to be clamped
-     * @return Color with the values clamped
-     */
-    Color clamp(Color input) {
-        float R = input(0) > 1 ? 1 : input(0);
-        float G = input(1) > 1 ? 1 : input(1);
-        float B = input(2) > 1 ? 1 : input(2);
-        return Color(R, G, B);
-    }
 };
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include <vector>
 
 #include "types.hpp"
+#include "framebuffer.hpp"
 
 /**
  * @brief Class that creates an image from a raw RGB matrix and saves the image
@@ -25,20 +26,18 @@ private:
 public:
 
     /**
-     * @brief Create a sf::Image from the matrix of RGB values
+     * @brief Create a sf::Image from a rendered image
      * 
-     * @param pixels matrix of RGB values
+     * @param pixels image with RGB values between 0 and 1
      */
-    void createImg(std::vector<std::vector<Color>> pixels) {
-        int width = pixels.size(); 
-        int height = pixels[0].size();
+    void createImg(const Framebuffer& pixels) {
+        int width = pixels.getWidth();
+        int height = pixels.getHeight();
         img.create(width, height);
-        for (int i = 0; i < width; ++i) {
-            for (int j = 0; j < height; ++j) {
-                const sf::Uint8 R = scale(pixels[i][j](0));
-                const sf::Uint8 G = scale(pixels[i][j](1));
-                const sf::Uint8 B = scale(pixels[i][j](2));
-                img.setPixel(i, j, sf::Color(R, G, B));
+        for (int j = 0; j < height; ++j) {
+            for (int i = 0; i < width; ++i) {
+                const float* rgb = pixels.pixel(i, j);
+                img.setPixel(i, j, sf::Color(scale(rgb[0]), scale(rgb[1]), scale(rgb[2])));
             }
         }
     }
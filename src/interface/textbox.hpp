@@ -138,7 +138,7 @@ public:
         if(isSelected_ && input.key.code != sf::Keyboard::Enter) {
             int inputChar = input.text.unicode;
             if(inputChar < 128 && inputChar != 0 && inputChar != TAB_KEY && inputChar != ENTER_KEY) {
-                if(text_.str().length() <= limit_) {
+                if((int)text_.str().length() <= limit_) {
                     checkInput(inputChar);
                 }else if(inputChar == BACKSPACE_KEY) {
                     deleteLastChar();
@@ -182,7 +182,7 @@ private:
      * 
      */
     void deleteLastChar() {
-        if(text_.str().length() > preTextLength){
+        if((int)text_.str().length() > preTextLength){
             std::string newTxt = text_.str();
             newTxt.pop_back();
             text_.str(std::string());
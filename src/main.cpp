@@ -2,6 +2,7 @@
 #include "scene.hpp"
 #include "renderer.hpp"
 #include "interface.hpp"
+#include "tonemap.hpp"
 #include "fileloader.hpp"
 #include "fileloader_ex.hpp"
 #include "gui.hpp"
@@ -11,9 +12,63 @@
 #include "types.hpp"
 
 #include <iostream>
+#include <fstream>
 #include <exception>
 #include <string>
 #include <cstdlib>
+#include <set>
+#include <vector>
+#include <sstream>
+
+/**
+ * @brief Write the quality statistics of the top-level BVH and of the BVH of every mesh in
+ * the scene into a JSON file. Instances sharing a BVH are reported once.
+ * 
+ * @param filename name of the JSON file
+ * @param scene the scene
+ * @param renderer renderer holding the top-level BVH of the scene
+ * @return true if the file was written
+ */
+bool writeBVHReport(const std::string& filename, const Scene& scene, const Renderer& renderer) {
+  std::ofstream file(filename);
+  file << "{\"tlas\": ";
+  renderer.getTLAS().getStats().WriteJSON(file, "tlas");
+  file << ", \"meshes\": [";
+  std::set<const BVH*> reported;
+  for (auto object : scene.getObjects())
+  {
+    auto mesh = std::dynamic_pointer_cast<TriangleMesh>(object);
+    if (!mesh || !reported.insert(&mesh->getBVH()).second) continue;
+    file << (reported.size() > 1 ? ", " : "");
+    BVHStats stats = mesh->getBVH().getStats();
+    if (mesh->getBVH().getSettings().mode == BVHBuildMode::Spatial)
+    {
+      stats.objectSplitSAHCost = mesh->getBVH().ObjectSplitSAHCost();
+    }
+    stats.WriteJSON(file, mesh->getName());
+  }
+  file << "]}" << std::endl;
+  return file.good();
+}
+
+/**
+ * @brief Save a render with the given display transform. Files ending with .pfm get the linear
+ * light scaled by the exposure, other files the tonemapped image.
+ * 
+ * @param filename name of the image file
+ * @param sums the sums of the samples of each pixel returned by the renderer
+ * @param tonemap the display transform
+ * @return true if the image was saved
+ */
+bool saveRender(const std::string& filename, const Framebuffer& sums, const Tonemap& tonemap) {
+  if (filename.size() >= 4 && filename.compare(filename.size() - 4, 4, ".pfm") == 0)
+  {
+    return Tonemap::SavePFM(tonemap.linear(sums), filename);
+  }
+  Interface interface;
+  interface.createImg(tonemap.apply(sums));
+  return interface.saveImage(filename);
+}
 
 int main(int argc, char *argv[]) {
 
@@ -24,7 +79,7 @@ int main(int argc, char *argv[]) {
       Gui gui;
       gui.openSettings(gui.titleScreen());
     }
-    else if (argc == 7)
+    else if (argc >= 7)
     {
       std::string filePath = argv[1];
 
@@ -34,25 +89,144 @@ int main(int argc, char *argv[]) {
       int bounces = std::stoi(argv[5], nullptr);
       std::string filename = argv[6];
 
+      // Optional arguments of the form --name=value
+      std::string heatmap;
+      std::string bvhReport;
+      std::string sortRays = "off";
+      int tileSize = 0;
+      std::string tileOrder;
+      uint32_t seed = 0;
+      std::vector<float> exposures = { 0 };
+      Tonemap tonemap;
+      std::string tonemapOperator = "clamp";
+      float adaptiveThreshold = 0;
+      int minSamples = 16;
+      float sampleBudget = 0;
+      std::string sampleHeatmap;
+      for (int i = 7; i < argc; ++i)
+      {
+        std::string option = argv[i];
+        if (option.rfind("--heatmap=", 0) == 0) heatmap = option.substr(10);
+        else if (option.rfind("--bvh-report=", 0) == 0) bvhReport = option.substr(13);
+        else if (option.rfind("--sort-rays=", 0) == 0) sortRays = option.substr(12);
+        else if (option.rfind("--tile-size=", 0) == 0) tileSize = std::stoi(option.substr(12), nullptr);
+        else if (option.rfind("--tile-order=", 0) == 0) tileOrder = option.substr(13);
+        else if (option.rfind("--seed=", 0) == 0) seed = std::stoul(option.substr(7), nullptr);
+        else if (option.rfind("--exposure=", 0) == 0)
+        {
+          exposures.clear();
+          std::stringstream list(option.substr(11));
+          std::string stops;
+          while (std::getline(list, stops, ',')) exposures.push_back(std::stof(stops));
+        }
+        else if (option.rfind("--tonemap=", 0) == 0) tonemapOperator = option.substr(10);
+        else if (option.rfind("--gamma=", 0) == 0) tonemap.gamma = std::stof(option.substr(8));
+        else if (option.rfind("--adaptive=", 0) == 0) adaptiveThreshold = std::stof(option.substr(11));
+        else if (option.rfind("--min-samples=", 0) == 0) minSamples = std::stoi(option.substr(14), nullptr);
+        else if (option.rfind("--sample-budget=", 0) == 0) sampleBudget = std::stof(option.substr(16));
+        else if (option.rfind("--sample-heatmap=", 0) == 0) sampleHeatmap = option.substr(17);
+        else throw std::invalid_argument("Unknown option " + option);
+      }
+      if (!heatmap.empty() && heatmap != "nodes" && heatmap != "tests")
+      {
+        throw std::invalid_argument("The heatmap shows either nodes or tests.");
+      }
+      if (sortRays != "on" && sortRays != "off")
+      {
+        throw std::invalid_argument("Ray sorting is either on or off.");
+      }
+      if (!tileOrder.empty() && tileOrder != "rows" && tileOrder != "morton" && tileOrder != "center")
+      {
+        throw std::invalid_argument("The tile order is rows, morton or center.");
+      }
+      if (tonemapOperator != "clamp" && tonemapOperator != "reinhard")
+      {
+        throw std::invalid_argument("The tonemap operator is clamp or reinhard.");
+      }
+      if (exposures.empty() || tonemap.gamma <= 0)
+      {
+        throw std::invalid_argument("Give at least one exposure and a positive gamma.");
+      }
+      tonemap.op = tonemapOperator == "reinhard" ? TonemapOperator::Reinhard : TonemapOperator::Clamp;
+
       FileLoader test(filePath);
       std::shared_ptr<Scene> testScene = test.loadSceneFile();
       std::cout << (*testScene);
 
       Renderer testRenderer(resX, resY, testScene);
       testRenderer.setMaxBounces(bounces);
+      testRenderer.setRaySorting(sortRays == "on");
+      testRenderer.setSeed(seed);
+      if (tileSize > 0) testRenderer.setTileSize(tileSize);
+      if (tileOrder == "rows") testRenderer.setTileOrder(TileOrder::Rows);
+      else if (tileOrder == "center") testRenderer.setTileOrder(TileOrder::CenterOut);
 
-      auto result = testRenderer.parallelRender(samples);
+      if (!bvhReport.empty())
+      {
+        if (writeBVHReport(bvhReport, *testScene, testRenderer))
+        {
+          std::cout << "BVH report saved to " << bvhReport << std::endl;
+        }
+        else
+        {
+          std::cout << "Saving BVH report failed" << std::endl;
+        }
+      }
 
-      Interface interface;
-      interface.createImg(result);
-      bool imgSaved = interface.saveImage(filename);
-      if (imgSaved)
+      if (heatmap.empty())
       {
-        std::cout << "Image saved succesfully" << std::endl;
+        // Every exposure is made from the same render, with the exposure added to the file
+        // name when there are several
+        const Framebuffer& sums = adaptiveThreshold > 0
+                                  ? testRenderer.adaptiveRender(minSamples, samples, adaptiveThreshold, sampleBudget)
+                                  : testRenderer.parallelRender(samples);
+        for (float exposure : exposures)
+        {
+          tonemap.exposure = exposure;
+          std::string imageName = filename;
+          if (exposures.size() > 1)
+          {
+            std::ostringstream suffix;
+            suffix << "_ev" << exposure;
+            size_t dot = filename.find_last_of('.');
+            imageName = dot == std::string::npos ? filename + suffix.str() : filename.substr(0, dot) + suffix.str() + filename.substr(dot);
+          }
+          if (saveRender(imageName, sums, tonemap))
+          {
+            std::cout << "Image " << imageName << " saved succesfully" << std::endl;
+          }
+          else
+          {
+            std::cout << "Saving image " << imageName << " failed" << std::endl;
+          }
+        }
+
+        if (!sampleHeatmap.empty())
+        {
+          Interface interface;
+          interface.createImg(testRenderer.sampleHeatmap());
+          if (interface.saveImage(sampleHeatmap))
+          {
+            std::cout << "Sample heatmap saved to " << sampleHeatmap << std::endl;
+          }
+          else
+          {
+            std::cout << "Saving sample heatmap failed" << std::endl;
+          }
+        }
       }
       else
       {
-        std::cout << "Saving image failed" << std::endl;
+        Interface interface;
+        interface.createImg(testRenderer.heatmapRender(heatmap == "nodes" ? HeatmapCounter::NodeVisits : HeatmapCounter::PrimitiveTests));
+        if (interface.saveImage(filename))
+        {
+          std::cout << "Image saved succesfully" << std::endl;
+        }
+        else
+        {
+          std::cout << "Saving image failed" << std::endl;
+        }
       }
     }
     else
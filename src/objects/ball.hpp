@@ -15,6 +15,16 @@ class Ball : public Object
 private:
     float radius_;
 
+    /**
+     * @brief Distance at which the ray enters the ball.
+     * 
+     * @param ray ray whose collision will be checked
+     * @return float the distance along the ray, zero if the ray misses the ball
+     */
+    float intersect(const Ray& ray) const {
+        return Primitive::IntersectBall(ray, this->getPosition(), radius_);
+    }
+
 public:
     Ball(Vector position, float radius, std::shared_ptr<Material> material) : Object(position, material), radius_(radius) {}
 
@@ -30,34 +40,59 @@ public:
      */
     void collision(Ray& ray, Hit &rayHit, float& smallestDistance) {
 
-        Vector toBall = ray.origin - this->getPosition();
-
-        float a = ray.direction.dot(ray.direction);
-        float b = 2 * ray.direction.dot(toBall);
-        float c = toBall.dot(toBall) - radius_ * radius_;
+        float distance = intersect(ray);
 
-        float discriminant = b*b - 4*a*c;
-
-        if (discriminant >= 0)
+        if (distance > 0 && distance < smallestDistance)
         {
-            float distance = (-b - sqrt(discriminant)) / (2*a);
-
-            if (distance > 0 && distance < smallestDistance)
-            {
-                smallestDistance = distance;
-                rayHit.distance = distance;
-                rayHit.material = this->getMaterial();
-                rayHit.did_hit = true;
-                rayHit.point = ray.origin + ray.direction * distance;
-                rayHit.normal = (rayHit.point - this->getPosition()).normalized();
-            }
+            smallestDistance = distance;
+            rayHit.distance = distance;
+            rayHit.material = this->getMaterial();
+            rayHit.did_hit = true;
+            rayHit.point = ray.origin + ray.direction * distance;
+            rayHit.normal = (rayHit.point - this->getPosition()).normalized();
         }
 
         return;
     }
 
+    /**
+     * @brief Calculate whether a given ray hits the ball before the given distance.
+     * 
+     * @param ray ray whose collision will be checked
+     * @param maxDistance distance along the ray up to which hits are counted
+     * @return true if the ray hits the ball between its origin and the given distance
+     */
+    bool occluded(const Ray& ray, float maxDistance) const {
+        float distance = intersect(ray);
+        return distance > 0 && distance < maxDistance;
+    }
+
     float getRadius() const { return radius_; }
 
+    /**
+     * @brief Get the axis aligned bounding box of the ball.
+     * 
+     * @return AABB 
+     */
+    AABB getBounds() const {
+        AABB box;
+        Vector extent = Vector::Constant(std::abs(radius_));
+        box.grow(this->getPosition() - extent);
+        box.grow(this->getPosition() + extent);
+        return box;
+    }
+
+    /**
+     * @brief Append the ball as a single ball primitive.
+     * 
+     * @param primitives vector the primitive is appended to
+     * @return true 
+     */
+    bool getPrimitives(std::vector<Primitive>& primitives) const {
+        primitives.push_back(Primitive::MakeBall(this->getPosition(), radius_, this->getMaterial()));
+        return true;
+    }
+
     /**
      * @brief Print ball info to the desired output stream.
      * 
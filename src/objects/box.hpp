@@ -36,6 +36,43 @@ private:
                                             {4, 0, 3},
                                             {1, 5, 6}};
 
+    /**
+     * @brief Check whether the ray collides with the ball bounding the box.
+     * 
+     * @param ray ray whose collision will be checked
+     * @return true if the ray line passes through the bounding ball
+     */
+    bool boundingBallHit(const Ray& ray) const {
+        Vector toBall = ray.origin - this->getPosition();
+        float radius = width_ * width_ + height_ * height_ + depth_ * depth_;
+        float a = ray.direction.dot(ray.direction);
+        float b = 2 * ray.direction.dot(toBall);
+        float c = toBall.dot(toBall) - radius;
+        float discriminant = b*b - 4*a*c;
+        return discriminant >= 0;
+    }
+
+    /**
+     * @brief Distance at which the ray crosses one side of the box.
+     * 
+     * @param side corner indices of the side
+     * @param ray ray whose collision will be checked
+     * @param normal set to the normal of the side
+     * @return float the distance along the ray, zero if the ray misses the side
+     */
+    float intersectSide(const std::vector<int>& side, const Ray& ray, Vector& normal) const {
+        Vector topLeft = corners_[side[0]];
+        Vector bottomLeft = corners_[side[1]];
+        Vector bottomRight = corners_[side[2]];
+
+        Vector s1 = -bottomLeft + bottomRight;
+        Vector s2 = -bottomLeft + topLeft;
+
+        normal = s1.cross(s2).normalized();
+
+        return Primitive::IntersectQuad(ray, bottomLeft, s1, s2, normal);
+    }
+
 public:
     Box(Vector position, float width, float height, float depth, std::shared_ptr<Material> material) 
             : Object(position, material), width_(width), height_(height), depth_(depth) {
@@ -64,52 +101,63 @@ public:
     void collision(Ray& ray, Hit &rayHit, float& smallestDistance) {
 
         // Check first whether ray collides with the bounding ball
-        Vector toBall = ray.origin - this->getPosition();
-        float radius = width_ * width_ + height_ * height_ + depth_ * depth_;
-        float a = ray.direction.dot(ray.direction);
-        float b = 2 * ray.direction.dot(toBall);
-        float c = toBall.dot(toBall) - radius;
-        float discriminant = b*b - 4*a*c;
-        if (discriminant < 0) return;
+        if (!boundingBallHit(ray)) return;
 
         // If inside ball, check sides
-        for (auto side : sides_) {
-
-            Vector topLeft = corners_[side[0]];
-            Vector bottomLeft = corners_[side[1]];
-            Vector bottomRight = corners_[side[2]];
-
-            Vector s1 = -bottomLeft + bottomRight;
-            Vector s2 = -bottomLeft + topLeft;
+        for (const auto& side : sides_) {
 
-            Vector normal = s1.cross(s2).normalized();
+            Vector normal;
+            float distance = intersectSide(side, ray, normal);
 
-            float distance = (bottomLeft - ray.origin).dot(normal) / ray.direction.dot(normal);
-            Vector intersection = -bottomLeft + ray.origin + ray.direction * distance;
-
-            if (intersection.dot(s1) <= s1.squaredNorm() 
-                && intersection.dot(s1) >= 0 
-                && intersection.dot(s2) <= s2.squaredNorm() 
-                && intersection.dot(s2) >= 0
-            ) 
+            if (distance > 0 && distance < smallestDistance)
             {
-                if (distance > 0 && distance < smallestDistance)
-                {
-                    smallestDistance = distance;
-                    rayHit.distance = distance;
-                    rayHit.material = this->getMaterial();
-                    rayHit.did_hit = true;
-                    rayHit.point = ray.origin + ray.direction * distance;
-                    rayHit.normal = normal;
-                }
+                smallestDistance = distance;
+                rayHit.distance = distance;
+                rayHit.material = this->getMaterial();
+                rayHit.did_hit = true;
+                rayHit.point = ray.origin + ray.direction * distance;
+                rayHit.normal = normal;
             }
         }
     }
 
+    /**
+     * @brief Calculate whether a given ray hits the box before the given distance.
+     * 
+     * Returns at the first side found, without looking for the nearest one.
+     * 
+     * @param ray ray whose collision will be checked
+     * @param maxDistance distance along the ray up to which hits are counted
+     * @return true if the ray hits the box between its origin and the given distance
+     */
+    bool occluded(const Ray& ray, float maxDistance) const {
+        if (!boundingBallHit(ray)) return false;
+
+        for (const auto& side : sides_) {
+            Vector normal;
+            float distance = intersectSide(side, ray, normal);
+            if (distance > 0 && distance < maxDistance) return true;
+        }
+        return false;
+    }
+
     float getWidth() const { return width_; }
     float getHeight() const { return height_; }
     float getDepth() const { return depth_; }
 
+    /**
+     * @brief Move the box, translating its corners with its position.
+     * 
+     * @param position the new position of the center
+     */
+    void setPosition(Vector position) {
+        Vector shift = position - this->getPosition();
+        for (auto& corner : corners_) {
+            corner += shift;
+        }
+        Object::setPosition(position);
+    }
+
     /**
      * @brief Rotates the box around a given axis.
      * 
@@ -126,6 +174,33 @@ public:
         }
     }
 
+    /**
+     * @brief Get the axis aligned bounding box of the box.
+     * 
+     * @return AABB 
+     */
+    AABB getBounds() const {
+        AABB box;
+        for (const auto& corner : corners_) {
+            box.grow(corner);
+        }
+        return box;
+    }
+
+    /**
+     * @brief Append the six sides of the box as quad primitives, so that the top-level BVH
+     * bounds each side separately instead of testing all of them.
+     * 
+     * @param primitives vector the primitives are appended to
+     * @return true 
+     */
+    bool getPrimitives(std::vector<Primitive>& primitives) const {
+        for (const auto& side : sides_) {
+            primitives.push_back(Primitive::MakeQuad(corners_[side[0]], corners_[side[1]], corners_[side[2]], this->getMaterial()));
+        }
+        return true;
+    }
+
     /**
      * @brief Print box info to the desired output stream.
      * 
@@ -1,28 +1,151 @@
 #pragma once
 
 #include "types.hpp"
-#include "triangle.hpp"
+#include "meshtriangles.hpp"
+#include "bvhbuilder.hpp"
+#include "bvhstats.hpp"
 #include <vector>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#define BVH_PACKET_SIMD
+#endif
+
+/**
+ * @brief Single precision copy of a ray with the inverse of its direction precomputed.
+ * 
+ * Created once per ray so that the slab tests against the node boxes need no divisions,
+ * and the sign of each direction component tells which of the two planes is entered first.
+ */
+struct InvRay
+{
+    float origin[3];
+    float direction[3];
+    float invDirection[3];
+    int sign[3];
+
+    InvRay(const Ray& ray) {
+        for(int axis = 0; axis < 3; axis++) {
+            origin[axis] = ray.origin(axis);
+            direction[axis] = ray.direction(axis);
+            invDirection[axis] = 1.0f / direction[axis];
+            sign[axis] = invDirection[axis] < 0;
+        }
+    }
+};
 
 /**
- * @brief Struct representing an Axis Aligned Bounding Box
+ * @brief Closest triangle found so far during a traversal. Only the distance and the barycentric
+ * coordinates are found in the leaves, and the hit is resolved once the traversal has ended.
  * 
  */
-struct AABB
+struct TriangleHit
 {
-    Vector min, max;
+    int triangle = -1;  /* Index of the triangle, -1 if no triangle was hit */
+    float u, v;         /* Barycentric coordinates of the second and third vertex */
 };
 
 /**
- * @brief Struct representing a node in the bounding volume hiererchy
+ * @brief Single precision copy of a packet of rays stored coordinate by coordinate, so that the
+ * boxes and triangles are tested against four rays at once with SIMD instructions.
  * 
+ * The arrays are padded to a multiple of four with rays that never hit anything. When the
+ * direction of every ray has the same sign on each axis, the bounds of the origins and inverse
+ * directions let a box be rejected for the whole packet with one interval test.
  */
-struct Node
+struct alignas(16) PacketRays
 {
-    AABB box;
-    int leftChild;
-    bool isLeaf() { return triCount > 0; }
-    int firstTriIdx, triCount;
+    static constexpr int maxSize = RayPacket::maxSize;
+    int size = 0;
+    alignas(16) float origin[3][maxSize];
+    alignas(16) float direction[3][maxSize];
+    alignas(16) float invDirection[3][maxSize];
+    alignas(16) float distance[maxSize];    /* Distance of the closest hit of each ray so far */
+    alignas(16) int triangle[maxSize];      /* Closest triangle hit by each ray, -1 if none */
+    alignas(16) float u[maxSize];           /* Barycentric coordinates of the closest hits */
+    alignas(16) float v[maxSize];
+    bool coherent = true;                   /* The direction signs agree, so the bounds below are valid */
+    float originMin[3], originMax[3];
+    float invMin[3], invMax[3];
+
+    /**
+     * @brief Copy the rays of a packet
+     * 
+     * @param packet the rays and their closest distances so far
+     */
+    PacketRays(const RayPacket& packet) {
+        for(int i = 0; i < packet.size; i++) {
+            set(i, packet.rays[i].origin, packet.rays[i].direction, packet.distances[i]);
+        }
+        finish(packet.size);
+    }
+
+    /**
+     * @brief Copy the rays of a packet transformed into the object space of a mesh, like
+     * TriangleMesh::collision does for a single ray
+     * 
+     * @param packet the rays and their closest distances so far
+     * @param toObject rotation and scale from world space into object space
+     * @param position position of the object in world space
+     */
+    PacketRays(const RayPacket& packet, const Matrix& toObject, const Vector& position) {
+        for(int i = 0; i < packet.size; i++) {
+            set(i, toObject * (packet.rays[i].origin - position), toObject * packet.rays[i].direction, packet.distances[i]);
+        }
+        finish(packet.size);
+    }
+
+private:
+    /**
+     * @brief Store one ray
+     * 
+     * @param i index of the ray
+     * @param rayOrigin origin of the ray
+     * @param rayDirection direction of the ray
+     * @param smallestDistance distance of the closest hit of the ray so far
+     */
+    void set(int i, const Vector& rayOrigin, const Vector& rayDirection, float smallestDistance) {
+        for(int axis = 0; axis < 3; axis++) {
+            origin[axis][i] = rayOrigin(axis);
+            direction[axis][i] = rayDirection(axis);
+            invDirection[axis][i] = 1.0f / direction[axis][i];
+        }
+        distance[i] = smallestDistance;
+        triangle[i] = -1;
+    }
+
+    /**
+     * @brief Pad the arrays to a multiple of four and compute the bounds of the rays
+     * 
+     * @param count number of rays stored
+     */
+    void finish(int count) {
+        size = count;
+        for(int i = count; i < (count + 3) / 4 * 4; i++) {
+            for(int axis = 0; axis < 3; axis++) {
+                origin[axis][i] = 0;
+                direction[axis][i] = 1;
+                invDirection[axis][i] = 1;
+            }
+            distance[i] = -INFINITY;
+            triangle[i] = -1;
+        }
+        for(int axis = 0; axis < 3; axis++) {
+            originMin[axis] = invMin[axis] = INFINITY;
+            originMax[axis] = invMax[axis] = -INFINITY;
+            for(int i = 0; i < count; i++) {
+                originMin[axis] = std::min(originMin[axis], origin[axis][i]);
+                originMax[axis] = std::max(originMax[axis], origin[axis][i]);
+                invMin[axis] = std::min(invMin[axis], invDirection[axis][i]);
+                invMax[axis] = std::max(invMax[axis], invDirection[axis][i]);
+            }
+            bool sameSign = invMin[axis] > 0 || invMax[axis] < 0;
+            coherent = coherent && sameSign && std::isfinite(invMin[axis]) && std::isfinite(invMax[axis]);
+        }
+    }
 };
 
 /**
@@ -43,157 +166,570 @@ public:
     /**
      * @brief Construct a new BVH object
      * 
-     * @param tris vector containing all the triangles in the mesh
+     * @param tris the triangles of the mesh
+     * @param buildSettings settings used to build the hierarchy
      */
-    BVH(std::vector<Triangle> tris) {
-        //Initialize variables
-        n = tris.size();
-        triangles = tris;
-        std::vector<Node> bvhNodes(n*2 - 1);
+    BVH(MeshTriangles tris, BVHSettings buildSettings = BVHSettings()) {
+        triangles = std::move(tris);
+        settings = buildSettings;
+        settings.leafWidth = TriangleGroup::width;
         rootNodeIdx = 0;
-        nodesUsed = 1;
+        Build();
+    }
+
+    /**
+     * @brief Construct a new BVH object from a tree that was built earlier
+     * 
+     * @param tris the triangles of the mesh
+     * @param triIndices triangle indices referenced by the leaves
+     * @param bvhNodes nodes of the tree in depth-first order
+     * @param buildSettings settings the tree was built with
+     */
+    BVH(MeshTriangles tris, std::vector<int> triIndices, std::vector<Node> bvhNodes, BVHSettings buildSettings) {
+        triangles = std::move(tris);
+        triIdx = std::move(triIndices);
+        nodes = std::move(bvhNodes);
+        settings = buildSettings;
+        settings.leafWidth = TriangleGroup::width;
+        rootNodeIdx = 0;
+        builtSAHCost = SAHCost();
+        PrecomputeTransforms();
+    }
+
+    /**
+     * @brief Move the triangles and update the bounds of the nodes bottom-up without changing the
+     * topology of the tree. The tree is rebuilt instead if refitting has made its SAH cost exceed
+     * the rebuild threshold of the settings relative to the cost after the last build.
+     * 
+     * @param vertices new vertex positions, one per vertex in the order the vertices were given
+     * @return true if the tree was rebuilt
+     */
+    bool Refit(const std::vector<Vector>& vertices) {
+        if((int)vertices.size() != triangles.getVertexCount()) {
+            throw std::invalid_argument("BVH refit needs a position for every vertex.");
+        }
+
+        //Move the vertices
+        #pragma omp parallel for
+        for(size_t v = 0; v < vertices.size(); v++) {
+            triangles.setVertexPosition(v, vertices[v]);
+        }
+        int n = triangles.getTriangleCount();
+        std::vector<AABB> triBoxes(n);
+        #pragma omp parallel for
         for(int i = 0; i < n; i++) {
-            triIdx.push_back(i);
+            triBoxes[i] = triangles.getBounds(i);
         }
-        Node& root = bvhNodes[rootNodeIdx];
-        root.leftChild = 0;
-        root.triCount = n;
 
-        //Create the structure
-        UpdateNodeBounds(bvhNodes, rootNodeIdx);
-        Subdivide(bvhNodes, rootNodeIdx);
+        BVHBuilder::Refit(nodes, triBoxes, triIdx);
+        if(SAHCost() > settings.rebuildThreshold * builtSAHCost) {
+            Build();
+            return true;
+        }
+        PrecomputeTransforms();
+        return false;
+    }
 
-        //Copy structure to a private variable
-        for(int i = 0; i < bvhNodes.size(); i++) {
-            nodes.push_back(bvhNodes[i]);
+    /**
+     * @brief Get the SAH cost of the tree relative to its cost after the last build. Refitting
+     * usually makes the boxes overlap more, which increases the relative cost.
+     * 
+     * @return float 
+     */
+    float getRefitDegradation() const {
+        if(builtSAHCost == 0) return 1;
+        return SAHCost() / builtSAHCost;
+    }
+
+    /**
+     * @brief Calculate whether a given ray collides with the TriangleMesh contained in the BVH
+     * 
+     * @param ray ray whose collision will be checked
+     * @param rayHit address of a Hit data structure
+     * @param smallestDistance current smallest distance
+     * @param nodeIdx index of the node where the traversal starts
+     */
+    void BVHCollision(Ray& ray, Hit& rayHit, float& smallestDistance, const int nodeIdx) const {
+        InvRay invRay(ray);
+        TriangleHit closest;
+        Traverse(nodes, nodeIdx, ray, invRay, smallestDistance, [&](int first, int count) {
+            LeafCollision(first, count, invRay, closest, smallestDistance);
+            return false;
+        });
+        ResolveHit(closest, ray, rayHit, smallestDistance);
+    }
+
+    /**
+     * @brief Calculate whether a given ray hits any triangle of the BVH before the given distance.
+     * The traversal ends at the first hit found.
+     * 
+     * @param ray ray whose collision will be checked
+     * @param maxDistance distance along the ray up to which hits are counted
+     * @return true if the ray hits a triangle between its origin and the given distance
+     */
+    bool BVHOccluded(const Ray& ray, float maxDistance) const {
+        InvRay invRay(ray);
+        bool occluded = false;
+        Traverse(nodes, getRootNodeIdx(), ray, invRay, maxDistance, [&](int first, int count) {
+            occluded = LeafOccluded(first, count, invRay, maxDistance);
+            return occluded;
+        });
+        return occluded;
+    }
+
+    /**
+     * @brief Calculate the closest triangles hit by the rays of a packet. The distances of the
+     * rays are updated, and the closest triangle and its barycentric coordinates are stored for
+     * each ray that hits a triangle closer than its smallest distance so far.
+     * 
+     * @param rays rays whose collisions will be checked
+     */
+    void PacketCollision(PacketRays& rays) const {
+        TraversePacket(nodes, rays, [&](int first, int count, int firstRay) {
+            LeafPacketCollision(first, count, rays, firstRay);
+        });
+    }
+
+    /**
+     * @brief Traverse a binary hierarchy with a packet of rays and call the given function for
+     * every leaf that any ray of the packet enters before its smallest distance
+     * 
+     * Each node is visited once for the whole packet, together with the first ray that hits its
+     * box. That ray is tested first, since a ray hitting the parent usually hits the child too.
+     * Otherwise the box is rejected for every ray with an interval test over the bounds of the
+     * packet, and only if that fails are the remaining rays tested four at a time. Rays before
+     * the first one hitting a node never hit its children, so they are skipped below it.
+     * 
+     * @param nodes nodes of the hierarchy in depth-first order
+     * @param rays rays whose collisions will be checked, the leaf function updates their distances
+     * @param leafFunction called with the first primitive index and primitive count of each leaf,
+     * and the first ray hitting the leaf
+     */
+    template <typename LeafFunction>
+    static void TraversePacket(const std::vector<Node>& nodes, PacketRays& rays, LeafFunction leafFunction) {
+        if(nodes.empty() || rays.size == 0) return;
+
+        PacketStackEntry stack[BVHBuilder::maxDepth + 1];
+        int stackPtr = 0;
+        stack[stackPtr++] = { 0, 0 };
+        while(stackPtr > 0) {
+            PacketStackEntry entry = stack[--stackPtr];
+            int nodeIdx = entry.nodeIdx;
+            const Node& node = nodes[nodeIdx];
+            int first = FirstPacketHit(node, rays, entry.firstRay);
+            if(first == rays.size) continue;
+            if(node.isLeaf()) {
+                leafFunction(node.leftFirst, node.triCount, first);
+                continue;
+            }
+
+            //Visit first the child nearer along the first ray, which is on top of the stack
+            int nearIdx = nodeIdx + 1;
+            int farIdx = node.leftFirst;
+            float along = 0;
+            for(int axis = 0; axis < 3; axis++) {
+                float centerDifference = nodes[farIdx].min[axis] + nodes[farIdx].max[axis] - nodes[nearIdx].min[axis] - nodes[nearIdx].max[axis];
+                along += centerDifference * rays.direction[axis][first];
+            }
+            if(along < 0) std::swap(nearIdx, farIdx);
+            stack[stackPtr++] = { farIdx, first };
+            stack[stackPtr++] = { nearIdx, first };
         }
     }
 
     /**
-     * @brief Updates the bounds of the AABB based on the triangles it contains
+     * @brief Find the first ray of a packet that enters the box of a node before its smallest distance
      * 
-     * @param bvhNodes vector containing the nodes
-     * @param nodeIdx the current node index
+     * @param node the node whose AABB is tested
+     * @param rays rays of the packet
+     * @param first first ray that can hit the box
+     * @return int index of the first ray hitting the box, the size of the packet if none does
      */
-    void UpdateNodeBounds(std::vector<Node>& bvhNodes, int nodeIdx) {
-        Node& currentNode = bvhNodes[nodeIdx];
+    static int FirstPacketHit(const Node& node, const PacketRays& rays, int first) {
+        if(RayHitsBox(node, rays, first)) return first;
+        if(rays.coherent && PacketMissesBox(node, rays)) return rays.size;
 
-        //Set bounds to "infinity" in the beginning
-        currentNode.box.min = Vector(1e30f, 1e30f, 1e30f);
-        currentNode.box.max = Vector(-1e30f, -1e30f, -1e30f);
+#ifdef BVH_PACKET_SIMD
+        const __m128 boundsMin[3] = { _mm_set1_ps(node.min[0]), _mm_set1_ps(node.min[1]), _mm_set1_ps(node.min[2]) };
+        const __m128 boundsMax[3] = { _mm_set1_ps(node.max[0]), _mm_set1_ps(node.max[1]), _mm_set1_ps(node.max[2]) };
+        for(int start = (first + 1) / 4 * 4; start < rays.size; start += 4) {
+            __m128 tmin = _mm_set1_ps(-INFINITY);
+            __m128 tmax = _mm_set1_ps(INFINITY);
+            for(int axis = 0; axis < 3; axis++) {
+                __m128 origin = _mm_load_ps(&rays.origin[axis][start]);
+                __m128 invDirection = _mm_load_ps(&rays.invDirection[axis][start]);
+                __m128 t1 = _mm_mul_ps(_mm_sub_ps(boundsMin[axis], origin), invDirection);
+                __m128 t2 = _mm_mul_ps(_mm_sub_ps(boundsMax[axis], origin), invDirection);
+                tmin = _mm_max_ps(tmin, _mm_min_ps(t1, t2));
+                tmax = _mm_min_ps(tmax, _mm_max_ps(t1, t2));
+            }
+            __m128 hit = _mm_and_ps(_mm_cmpge_ps(tmax, tmin), _mm_cmpgt_ps(tmax, _mm_setzero_ps()));
+            hit = _mm_and_ps(hit, _mm_cmplt_ps(tmin, _mm_load_ps(&rays.distance[start])));
+            int mask = _mm_movemask_ps(hit) & (15 << std::max(first + 1 - start, 0)) & 15;
+            for(int lane = 0; mask != 0; lane++) {
+                if(mask >> lane & 1) return start + lane;
+            }
+        }
+        return rays.size;
+#else
+        for(int i = first + 1; i < rays.size; i++) {
+            if(RayHitsBox(node, rays, i)) return i;
+        }
+        return rays.size;
+#endif
+    }
 
-        //Loop over triangles and set new bounds accordingly
-        for(int first = currentNode.firstTriIdx, i=0; i < currentNode.triCount; i++) {
-            int leafTriIdx = triIdx[first + i];
-            Triangle &leafTriangle = triangles[leafTriIdx];
-            std::vector<Vector> vertices = leafTriangle.getVertexPos();
-            currentNode.box.min = currentNode.box.min.cwiseMin(vertices[0]);
-            currentNode.box.min = currentNode.box.min.cwiseMin(vertices[1]);
-            currentNode.box.min = currentNode.box.min.cwiseMin(vertices[2]);
-            currentNode.box.max = currentNode.box.max.cwiseMax(vertices[0]);
-            currentNode.box.max = currentNode.box.max.cwiseMax(vertices[1]);
-            currentNode.box.max = currentNode.box.max.cwiseMax(vertices[2]);
+    /**
+     * @brief Calculate whether one ray of a packet enters the box of a node before its smallest distance
+     * 
+     * @param node the node whose AABB is tested
+     * @param rays rays of the packet
+     * @param i index of the ray
+     * @return true if the ray hits the box
+     */
+    static bool RayHitsBox(const Node& node, const PacketRays& rays, int i) {
+        float tmin = -INFINITY;
+        float tmax = INFINITY;
+        for(int axis = 0; axis < 3; axis++) {
+            float t1 = (node.min[axis] - rays.origin[axis][i]) * rays.invDirection[axis][i];
+            float t2 = (node.max[axis] - rays.origin[axis][i]) * rays.invDirection[axis][i];
+            tmin = std::max(tmin, std::min(t1, t2));
+            tmax = std::min(tmax, std::max(t1, t2));
         }
+        return tmax >= tmin && tmin < rays.distance[i] && tmax > 0;
     }
 
     /**
-     * @brief Divides the traingles of the current node into new AABBs recursively
+     * @brief Calculate whether the box of a node is missed by every ray of a coherent packet.
+     * The distances at which the rays cross the planes of the box are bounded with interval
+     * arithmetic over the bounds of the origins and inverse directions of the packet.
      * 
-     * @param bvhNodes vector containing the nodes
-     * @param nodeIdx current node index
+     * @param node the node whose AABB is tested
+     * @param rays rays of the packet, which must be coherent
+     * @return true if no ray of the packet can hit the box
      */
-    void Subdivide(std::vector<Node>& bvhNodes, int nodeIdx) {
-        //Terminates recursion
-        Node &currentNode = bvhNodes[nodeIdx];
-        if(currentNode.triCount <= 2) return;
+    static bool PacketMissesBox(const Node& node, const PacketRays& rays) {
+        float entry = -INFINITY;
+        float exit = INFINITY;
+        for(int axis = 0; axis < 3; axis++) {
+            //The near plane is the same for every ray, since the direction signs agree
+            bool negative = rays.invMax[axis] < 0;
+            float nearPlane = negative ? node.max[axis] : node.min[axis];
+            float farPlane = negative ? node.min[axis] : node.max[axis];
+            float nearLo = nearPlane - rays.originMax[axis], nearHi = nearPlane - rays.originMin[axis];
+            float farLo = farPlane - rays.originMax[axis], farHi = farPlane - rays.originMin[axis];
+            float nearProducts[4] = { nearLo*rays.invMin[axis], nearLo*rays.invMax[axis], nearHi*rays.invMin[axis], nearHi*rays.invMax[axis] };
+            float farProducts[4] = { farLo*rays.invMin[axis], farLo*rays.invMax[axis], farHi*rays.invMin[axis], farHi*rays.invMax[axis] };
+            entry = std::max(entry, *std::min_element(nearProducts, nearProducts + 4));
+            exit = std::min(exit, *std::max_element(farProducts, farProducts + 4));
+        }
+        return entry > exit || exit <= 0;
+    }
 
-        //Determine the split
-        Vector extent = currentNode.box.max - currentNode.box.min;
-        int axis = 0;
-        if(extent(1) > extent(0)) axis = 1;
-        if(extent(2) > extent(axis)) axis = 2;
-        float splitPos = currentNode.box.min(axis) + extent(axis)*0.5f;
+    /**
+     * @brief Calculate whether the rays of a packet collide with the triangles of a leaf. Each
+     * triangle is tested against four rays at once, in the same order as LeafCollision tests them.
+     * 
+     * @param first first index of the leaf in the triangle index array
+     * @param count number of triangles in the leaf
+     * @param rays rays whose collisions will be checked
+     * @param firstRay first ray hitting the leaf, the rays before it are skipped
+     */
+    void LeafPacketCollision(int first, int count, PacketRays& rays, int firstRay) const {
+        const int width = TriangleGroup::width;
+        for(int i = first; i < first + count; i++) {
+            const TriangleGroup& group = groups[i / width];
+            int lane = i % width;
+#ifdef BVH_PACKET_SIMD
+            __m128 row[3][4];
+            for(int r = 0; r < 3; r++) {
+                for(int c = 0; c < 4; c++) {
+                    row[r][c] = _mm_set1_ps(group.row[r][c][lane]);
+                }
+            }
+            const __m128i index = _mm_set1_epi32(triIdx[i]);
+            for(int start = firstRay / 4 * 4; start < rays.size; start += 4) {
+                __m128 o[3], d[3];
+                for(int axis = 0; axis < 3; axis++) {
+                    o[axis] = _mm_load_ps(&rays.origin[axis][start]);
+                    d[axis] = _mm_load_ps(&rays.direction[axis][start]);
+                }
+                __m128 planeDirection = _mm_add_ps(_mm_add_ps(_mm_mul_ps(row[2][0], d[0]), _mm_mul_ps(row[2][1], d[1])), _mm_mul_ps(row[2][2], d[2]));
+                __m128 planeOrigin = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(row[2][0], o[0]), _mm_mul_ps(row[2][1], o[1])),
+                                                           _mm_mul_ps(row[2][2], o[2])), row[2][3]);
+                __m128 t = _mm_div_ps(_mm_xor_ps(planeOrigin, _mm_set1_ps(-0.0f)), planeDirection);
+                __m128 distance = _mm_load_ps(&rays.distance[start]);
+                __m128 mask = _mm_and_ps(_mm_cmpgt_ps(t, _mm_setzero_ps()), _mm_cmplt_ps(t, distance));
+                if(_mm_movemask_ps(mask) == 0) continue;
 
-        //Partition triangles
-        int i = currentNode.firstTriIdx;
-        int j = i + currentNode.triCount - 1;
-        while(i <= j) {
-            if(triangles[triIdx[i]].getCentroid()(axis) < splitPos) {
-                i++;
-            }else {
-                std::swap(triIdx[i], triIdx[j--]);
+                __m128 p[3];
+                for(int axis = 0; axis < 3; axis++) {
+                    p[axis] = _mm_add_ps(o[axis], _mm_mul_ps(t, d[axis]));
+                }
+                __m128 b1 = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(row[0][0], p[0]), _mm_mul_ps(row[0][1], p[1])),
+                                                  _mm_mul_ps(row[0][2], p[2])), row[0][3]);
+                __m128 b2 = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(row[1][0], p[0]), _mm_mul_ps(row[1][1], p[1])),
+                                                  _mm_mul_ps(row[1][2], p[2])), row[1][3]);
+                mask = _mm_and_ps(mask, _mm_cmpge_ps(b1, _mm_setzero_ps()));
+                mask = _mm_and_ps(mask, _mm_cmpge_ps(b2, _mm_setzero_ps()));
+                mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(b1, b2), _mm_set1_ps(1.0f)));
+                if(_mm_movemask_ps(mask) == 0) continue;
+
+                //Keep the new hits and the earlier closest hits of the other rays
+                __m128i maskInt = _mm_castps_si128(mask);
+                _mm_store_ps(&rays.distance[start], _mm_or_ps(_mm_and_ps(mask, t), _mm_andnot_ps(mask, distance)));
+                _mm_store_ps(&rays.u[start], _mm_or_ps(_mm_and_ps(mask, b1), _mm_andnot_ps(mask, _mm_load_ps(&rays.u[start]))));
+                _mm_store_ps(&rays.v[start], _mm_or_ps(_mm_and_ps(mask, b2), _mm_andnot_ps(mask, _mm_load_ps(&rays.v[start]))));
+                __m128i triangle = _mm_load_si128(reinterpret_cast<const __m128i*>(&rays.triangle[start]));
+                _mm_store_si128(reinterpret_cast<__m128i*>(&rays.triangle[start]),
+                                _mm_or_si128(_mm_and_si128(maskInt, index), _mm_andnot_si128(maskInt, triangle)));
+            }
+#else
+            TriangleTransform transform;
+            for(int r = 0; r < 3; r++) {
+                for(int c = 0; c < 4; c++) {
+                    transform.row[r][c] = group.row[r][c][lane];
+                }
             }
+            for(int ray = firstRay; ray < rays.size; ray++) {
+                float rayOrigin[3] = { rays.origin[0][ray], rays.origin[1][ray], rays.origin[2][ray] };
+                float rayDirection[3] = { rays.direction[0][ray], rays.direction[1][ray], rays.direction[2][ray] };
+                if(transform.Intersect(rayOrigin, rayDirection, rays.distance[ray], rays.distance[ray], rays.u[ray], rays.v[ray])) {
+                    rays.triangle[ray] = triIdx[i];
+                }
+            }
+#endif
         }
+    }
+
+    /**
+     * @brief Traverse a binary hierarchy and call the given function for every leaf the ray enters
+     * before the current smallest distance
+     * 
+     * The tree is traversed iteratively with an explicit stack. At each interior node the child
+     * the ray enters first is visited first, and boxes entered beyond the current smallest distance
+     * are skipped. The work is counted into the counters of the ray if it has them.
+     * 
+     * @param nodes nodes of the hierarchy in depth-first order
+     * @param nodeIdx index of the node where the traversal starts
+     * @param ray ray whose collision will be checked
+     * @param invRay the same ray with its inverse direction, created once by the caller
+     * @param smallestDistance current smallest distance, updated by the leaf function
+     * @param leafFunction called with the first primitive index and primitive count of each leaf,
+     * returns true to end the traversal
+     */
+    template <typename LeafFunction>
+    static void Traverse(const std::vector<Node>& nodes, int nodeIdx, const Ray& ray, const InvRay& invRay, const float& smallestDistance, LeafFunction leafFunction) {
+        if(nodes.empty()) return;
+        if(AABBDistance(nodes[nodeIdx], invRay, smallestDistance) == 1e30f) return;
+
+        StackEntry stack[BVHBuilder::maxDepth];
+        int stackPtr = 0;
+        int currentIdx = nodeIdx;
+        while(true) {
+            const Node& currentNode = nodes[currentIdx];
+            if(currentNode.isLeaf()) {
+                if(ray.counters) ray.counters->primitiveTests += currentNode.triCount;
+                if(leafFunction(currentNode.leftFirst, currentNode.triCount)) return;
+            }else {
+                if(ray.counters) ray.counters->nodeVisits++;
 
-        //Check if one of the sides is empty
-        int leftCount = i - currentNode.firstTriIdx;
-        if(leftCount == 0 || leftCount == currentNode.triCount) return;
+                //Order the children by the distance at which the ray enters them
+                int nearIdx = currentIdx + 1;
+                int farIdx = currentNode.leftFirst;
+                float nearDist = AABBDistance(nodes[nearIdx], invRay, smallestDistance);
+                float farDist = AABBDistance(nodes[farIdx], invRay, smallestDistance);
+                if(nearDist > farDist) {
+                    std::swap(nearIdx, farIdx);
+                    std::swap(nearDist, farDist);
+                }
+                if(nearDist != 1e30f) {
+                    if(farDist != 1e30f) stack[stackPtr++] = { farIdx, farDist };
+                    currentIdx = nearIdx;
+                    continue;
+                }
+            }
 
-        //create child nodes
-        int leftChildIdx = nodesUsed++;
-        int rightChildIdx = nodesUsed++;
-        bvhNodes[leftChildIdx].firstTriIdx = currentNode.firstTriIdx;
-        bvhNodes[leftChildIdx].triCount = leftCount;
-        bvhNodes[rightChildIdx].firstTriIdx = i;
-        bvhNodes[rightChildIdx].triCount = currentNode.triCount - leftCount;
-        currentNode.leftChild = leftChildIdx;
-        currentNode.triCount = 0;
-        
-        //Update node bounds
-        UpdateNodeBounds(bvhNodes, leftChildIdx);
-        UpdateNodeBounds(bvhNodes, rightChildIdx);
-        //Recursion
-        Subdivide(bvhNodes, leftChildIdx);
-        Subdivide(bvhNodes, rightChildIdx);
+            //Continue from the closest node on the stack that can still contain a closer hit
+            while(stackPtr > 0 && stack[stackPtr - 1].distance >= smallestDistance) stackPtr--;
+            if(stackPtr == 0) break;
+            currentIdx = stack[--stackPtr].nodeIdx;
+        }
     }
 
     /**
-     * @brief Calculate whether a given ray collides with the TriangleMesh contained in the BVH recursively
+     * @brief Calculate whether a given ray collides with the triangles of a leaf. The transforms
+     * of the leaf are stored next to each other in groups, in the order of the triangle index
+     * array, and each group is tested at once.
      * 
-     * @param ray ray whose collision will be checked
-     * @param rayHit address of a Hit data structure
+     * @param first first index of the leaf in the triangle index array
+     * @param count number of triangles in the leaf
+     * @param invRay ray whose collision will be checked
+     * @param closest set to the closest triangle hit so far
      * @param smallestDistance current smallest distance
-     * @param nodeIdx current node index
-     */
-    void BVHCollision(Ray& ray, Hit& rayHit, float& smallestDistance, const int nodeIdx) {
-        Node& currentNode = nodes[nodeIdx];
-        if(!AABBCollision(currentNode.box, ray, smallestDistance)) return;
-        if(currentNode.isLeaf()) {
-            for(int i = 0; i < currentNode.triCount; i++) {
-                triangles[triIdx[currentNode.firstTriIdx + i]].collision(ray, rayHit, smallestDistance);
+     */
+    void LeafCollision(int first, int count, const InvRay& invRay, TriangleHit& closest, float& smallestDistance) const {
+        const int width = TriangleGroup::width;
+        for(int start = first - first % width; start < first + count; start += width) {
+            float u, v;
+            int lanes = LaneMask(start, first, first + count);
+            int lane = groups[start / width].Intersect(invRay.origin, invRay.direction, smallestDistance, lanes, smallestDistance, u, v);
+            if(lane >= 0) {
+                closest.triangle = triIdx[start + lane];
+                closest.u = u;
+                closest.v = v;
             }
-        }else {
-            BVHCollision(ray, rayHit, smallestDistance, currentNode.leftChild);
-            BVHCollision(ray, rayHit, smallestDistance, currentNode.leftChild + 1);
         }
     }
 
     /**
-     * @brief Calculate whether a given ray collides with the AABB
+     * @brief Write the closest triangle found by a traversal into a Hit. The material of the hit
+     * is left for the mesh to set.
      * 
-     * @param box the AABB for which collision is tested
-     * @param ray ray whose collision will be checked
+     * @param closest closest triangle hit during the traversal
+     * @param ray ray whose collision was checked
+     * @param rayHit address of a Hit data structure
+     * @param smallestDistance distance of the closest hit
+     */
+    void ResolveHit(const TriangleHit& closest, const Ray& ray, Hit& rayHit, float smallestDistance) const {
+        if(closest.triangle < 0) return;
+        rayHit.did_hit = true;
+        rayHit.distance = smallestDistance;
+        rayHit.point = ray.origin + ray.direction*smallestDistance;
+        rayHit.normal = triangles.getNormal(closest.triangle);
+    }
+
+    /**
+     * @brief Calculate whether a given ray hits any triangle of a leaf before the given distance
+     * 
+     * @param first first index of the leaf in the triangle index array
+     * @param count number of triangles in the leaf
+     * @param invRay ray whose collision will be checked
+     * @param maxDistance distance along the ray up to which hits are counted
+     * @return true if the ray hits a triangle of the leaf
+     */
+    bool LeafOccluded(int first, int count, const InvRay& invRay, float maxDistance) const {
+        const int width = TriangleGroup::width;
+        for(int start = first - first % width; start < first + count; start += width) {
+            int lanes = LaneMask(start, first, first + count);
+            if(groups[start / width].Occluded(invRay.origin, invRay.direction, maxDistance, lanes)) return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Calculate the distance at which a given ray enters the AABB of a node
+     * 
+     * @param node the node whose AABB is tested
+     * @param invRay ray whose collision will be checked
      * @param smallestDistance current smallest distance
-     * @return true If the ray collides with the box
-     * @return false If the ray does not collide with the boc
+     * @return float distance to the box, or 1e30 if the ray misses the box or enters it
+     * beyond the smallest distance
      */
-    bool AABBCollision(AABB box, Ray ray, float smallestDistance) {
-        float tx1 = (box.min(0) - ray.origin(0))/ray.direction(0);
-        float tx2 = (box.max(0) - ray.origin(0))/ray.direction(0);
-        float tmin = std::min(tx1, tx2);
-        float tmax = std::max(tx1, tx2);
+    static float AABBDistance(const Node& node, const InvRay& invRay, float smallestDistance) {
+        const float* bounds[2] = { node.min, node.max };
+
+        float tmin = (bounds[invRay.sign[0]][0] - invRay.origin[0]) * invRay.invDirection[0];
+        float tmax = (bounds[1 - invRay.sign[0]][0] - invRay.origin[0]) * invRay.invDirection[0];
+
+        float ty1 = (bounds[invRay.sign[1]][1] - invRay.origin[1]) * invRay.invDirection[1];
+        float ty2 = (bounds[1 - invRay.sign[1]][1] - invRay.origin[1]) * invRay.invDirection[1];
+        tmin = std::max(tmin, ty1);
+        tmax = std::min(tmax, ty2);
 
-        float ty1 = (box.min(1) - ray.origin(1))/ray.direction(1);
-        float ty2 = (box.max(1) - ray.origin(1))/ray.direction(1);
-        tmin = std::max(tmin, std::min(ty1, ty2));
-        tmax = std::min(tmax, std::max(ty1, ty2));
+        float tz1 = (bounds[invRay.sign[2]][2] - invRay.origin[2]) * invRay.invDirection[2];
+        float tz2 = (bounds[1 - invRay.sign[2]][2] - invRay.origin[2]) * invRay.invDirection[2];
+        tmin = std::max(tmin, tz1);
+        tmax = std::min(tmax, tz2);
 
-        float tz1 = (box.min(2) - ray.origin(2))/ray.direction(2);
-        float tz2 = (box.max(2) - ray.origin(2))/ray.direction(2);
-        tmin = std::max(tmin, std::min(tz1, tz2));
-        tmax = std::min(tmax, std::max(tz1, tz2));
+        if(tmax >= tmin && tmin < smallestDistance && tmax > 0) return tmin;
+        return 1e30f;
+    }
 
-        return tmax >= tmin && tmin < smallestDistance && tmax > 0;
+    /**
+     * @brief Compute the SAH cost of the whole hierarchy, i.e., the expected cost of tracing a
+     * random ray that hits the root box, using the traversal and intersection costs of the settings.
+     * 
+     * @return float 
+     */
+    float SAHCost() const {
+        return BVHBuilder::SAHCost(nodes, settings);
+    }
+
+    /**
+     * @brief Build a tree over the same triangles without spatial splits and get its SAH cost,
+     * for reporting the gain of spatial splits. This builds a whole second tree, so it is only
+     * called for diagnostics, never while loading or refitting.
+     * 
+     * @return float the SAH cost of the tree built in the quality mode
+     */
+    float ObjectSplitSAHCost() const {
+        int n = triangles.getTriangleCount();
+        std::vector<AABB> triBoxes(n);
+        std::vector<Vector> centroids(n);
+        #pragma omp parallel for
+        for(int i = 0; i < n; i++) {
+            triBoxes[i] = triangles.getBounds(i);
+            centroids[i] = triangles.getCentroid(i);
+        }
+
+        BVHSettings objectSettings = settings;
+        objectSettings.mode = BVHBuildMode::Quality;
+        std::vector<Node> objectNodes;
+        std::vector<int> objectTriIdx;
+        BVHBuilder(triBoxes, centroids, objectSettings).Build(objectNodes, objectTriIdx);
+        return BVHBuilder::SAHCost(objectNodes, objectSettings);
+    }
+
+    /**
+     * @brief Get the number of triangle references in the leaves. Spatial splits can reference
+     * a triangle from several leaves.
+     * 
+     * @return int 
+     */
+    int getReferenceCount() const {
+        int count = 0;
+        for(const Node& node : nodes) {
+            if(node.isLeaf()) count += node.triCount;
+        }
+        return count;
+    }
+
+    /**
+     * @brief Get the bounds of the whole hierarchy
+     * 
+     * @return AABB the box of the root node, or an empty box if there are no triangles
+     */
+    AABB getBounds() const {
+        if(nodes.empty()) return AABB();
+        return nodes[rootNodeIdx].getBounds();
+    }
+
+    /**
+     * @brief Get the time it took to build the BVH
+     * 
+     * @return float build time in seconds
+     */
+    float getBuildTime() const {
+        return buildTime;
+    }
+
+    /**
+     * @brief Get the number of nodes in the BVH
+     * 
+     * @return int 
+     */
+    int getNodeCount() const {
+        return nodes.size();
+    }
+
+    /**
+     * @brief Get the settings used to build the BVH
+     * 
+     * @return BVHSettings 
+     */
+    BVHSettings getSettings() const {
+        return settings;
     }
 
     /**
@@ -206,29 +742,217 @@ public:
     }
 
     /**
-     * @brief Get the triangles vector
+     * @brief Get the triangles of the mesh
      * 
-     * @return std::vector<Triangle> 
+     * @return const MeshTriangles& 
      */
-    std::vector<Triangle> getTriangles() const {
+    const MeshTriangles& getTriangles() const {
         return triangles;
     }
 
+    /**
+     * @brief Get the number of triangles in the mesh
+     * 
+     * @return int
+     */
+    int getTriangleCount() const {
+        return triangles.getTriangleCount();
+    }
+
+    /**
+     * @brief Get the triangle indices referenced by the leaves. Each leaf starts at a multiple of
+     * the triangle group width, and the indices between the leaves are padding.
+     * 
+     * @return const std::vector<int>& 
+     */
+    const std::vector<int>& getTriangleIndices() const {
+        return triIdx;
+    }
+
     /**
      * @brief Get the nodes vector
      * 
-     * @return std::vector<Node> 
+     * @return const std::vector<Node>& 
      */
-    std::vector<Node> getNodes() const {
+    const std::vector<Node>& getNodes() const {
         return nodes;
     }
 
+    /**
+     * @brief Get the memory taken by the nodes and the triangle index array
+     * 
+     * @return size_t bytes
+     */
+    size_t getMemoryUsage() const {
+        return nodes.size() * sizeof(Node) + triIdx.size() * sizeof(int);
+    }
+
+    /**
+     * @brief Get the memory taken by the precomputed intersection transforms of the leaves
+     * 
+     * @return size_t bytes
+     */
+    size_t getTransformMemoryUsage() const {
+        return groups.size() * sizeof(TriangleGroup);
+    }
+
+    /**
+     * @brief Get the quality and size statistics of the tree
+     * 
+     * @return BVHStats 
+     */
+    BVHStats getStats() const {
+        BVHStats stats = BVHStats::Compute(nodes, settings);
+        stats.primitiveCount = getTriangleCount();
+        stats.nodeMemory = getMemoryUsage();
+        stats.primitiveMemory = triangles.getMemoryUsage() + getTransformMemoryUsage();
+        return stats;
+    }
 
 private:
-    std::vector<Triangle> triangles;
+    MeshTriangles triangles;
     std::vector<int> triIdx;
+    std::vector<TriangleGroup> groups;  /* Intersection transforms in the order of triIdx, a group per width indices */
     std::vector<Node> nodes;
     int rootNodeIdx;
-    int nodesUsed;
-    int n;
+    BVHSettings settings;
+    float buildTime = 0;
+    float builtSAHCost = 0;
+
+    /**
+     * @brief Bounds of the part of a triangle inside a slab, used for the spatial splits
+     * 
+     * @param triangles the triangles of the mesh
+     * @param triangle index of the triangle
+     * @param axis axis of the slab
+     * @param lo lower plane of the slab
+     * @param hi upper plane of the slab
+     * @param box bounds of the part of the triangle being split
+     * @return AABB the bounds limited to the box and the slab, or an empty box
+     */
+    static AABB ClipTriangle(const MeshTriangles& triangles, int triangle, int axis, double lo, double hi, const AABB& box) {
+        AABB clipped;
+        for(int i = 0; i < 3; i++) {
+            Vector v0 = triangles.getVertex(triangle, i);
+            Vector v1 = triangles.getVertex(triangle, (i + 1) % 3);
+            if(v0(axis) >= lo && v0(axis) <= hi) clipped.grow(v0);
+
+            //Points where the edge crosses the planes of the slab
+            for(double plane : { lo, hi }) {
+                if((v0(axis) < plane) != (v1(axis) < plane)) {
+                    Vector p = v0 + (v1 - v0) * ((plane - v0(axis)) / (v1(axis) - v0(axis)));
+                    p(axis) = plane;
+                    clipped.grow(p);
+                }
+            }
+        }
+        clipped.min = clipped.min.cwiseMax(box.min);
+        clipped.max = clipped.max.cwiseMin(box.max);
+        clipped.min(axis) = std::max(clipped.min(axis), lo);
+        clipped.max(axis) = std::min(clipped.max(axis), hi);
+        if((clipped.min.array() > clipped.max.array()).any()) return AABB();
+        return clipped;
+    }
+
+    /**
+     * @brief Build the tree over the current triangles
+     * 
+     */
+    void Build() {
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        //Initialize variables
+        int n = triangles.getTriangleCount();
+        std::vector<AABB> triBoxes(n);
+        std::vector<Vector> centroids(n);
+
+        //Precompute the bounds and centroids of the triangles
+        #pragma omp parallel for
+        for(int i = 0; i < n; i++) {
+            triBoxes[i] = triangles.getBounds(i);
+            centroids[i] = triangles.getCentroid(i);
+        }
+
+        //Create the structure
+        BVHBuilder builder(triBoxes, centroids, settings, [this](int triangle, int axis, double lo, double hi, const AABB& box) {
+            return ClipTriangle(triangles, triangle, axis, lo, hi, box);
+        });
+        builder.Build(nodes, triIdx);
+        AlignLeaves();
+        builtSAHCost = SAHCost();
+        PrecomputeTransforms();
+
+        auto endTime = std::chrono::high_resolution_clock::now();
+        buildTime = std::chrono::duration<float>(endTime - startTime).count();
+    }
+
+    /**
+     * @brief Move the triangle indices of each leaf to start at a multiple of the triangle group
+     * width, so that a leaf of up to the width triangles is tested as a single group. The gaps
+     * are padded with the last index of the leaf before them, and are never tested.
+     * 
+     */
+    void AlignLeaves() {
+        const int width = TriangleGroup::width;
+        std::vector<int> aligned;
+        aligned.reserve(triIdx.size() + triIdx.size() / 2);
+        for(Node& node : nodes) {
+            if(!node.isLeaf()) continue;
+            int first = aligned.size();
+            aligned.insert(aligned.end(), triIdx.begin() + node.leftFirst, triIdx.begin() + node.leftFirst + node.triCount);
+            while(aligned.size() % width != 0) aligned.push_back(aligned.back());
+            node.leftFirst = first;
+        }
+        triIdx = std::move(aligned);
+    }
+
+    /**
+     * @brief Compute the intersection transforms of the triangles in the order of the triangle
+     * index array, so that the triangles of a leaf are tested from consecutive memory
+     * 
+     */
+    void PrecomputeTransforms() {
+        const int width = TriangleGroup::width;
+        groups.assign((triIdx.size() + width - 1) / width, TriangleGroup());
+        #pragma omp parallel for
+        for(size_t g = 0; g < groups.size(); g++) {
+            for(int i = g*width; i < std::min<int>((g + 1)*width, triIdx.size()); i++) {
+                groups[g].set(i - g*width, triangles.getTransform(triIdx[i]));
+            }
+        }
+    }
+
+    /**
+     * @brief Select the triangles of a group that belong to a leaf
+     * 
+     * @param start first index of the group in the triangle index array
+     * @param first first index of the leaf
+     * @param last index after the last triangle of the leaf
+     * @return int bit mask of the triangles of the leaf in the group
+     */
+    static int LaneMask(int start, int first, int last) {
+        int lo = std::max(first - start, 0);
+        int hi = std::min(last - start, TriangleGroup::width);
+        return (1 << hi) - (1 << lo);
+    }
+
+    /**
+     * @brief Node waiting on the traversal stack together with the distance to its box
+     * 
+     */
+    struct StackEntry
+    {
+        int nodeIdx;
+        float distance;
+    };
+
+    /**
+     * @brief Node waiting on the packet traversal stack together with the first ray that hit its parent
+     * 
+     */
+    struct PacketStackEntry
+    {
+        int nodeIdx;
+        int firstRay;
+    };
 };
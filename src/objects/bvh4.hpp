@@ -0,0 +1,314 @@
+#pragma once
+
+#include "types.hpp"
+#include "bvh.hpp"
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#define BVH4_SIMD
+#endif
+
+/**
+ * @brief Struct representing a node in the 4-wide bounding volume hierarchy
+ * 
+ * The boxes of the four children are stored as a structure of arrays, so that a ray can be
+ * tested against all of them with a single SIMD slab test. Unused child slots have an
+ * inverted box which no ray can hit.
+ */
+struct alignas(64) Node4
+{
+    float minX[4], minY[4], minZ[4];
+    float maxX[4], maxY[4], maxZ[4];
+    int child[4];       /* Index of an interior child node, first triangle index of a leaf child */
+    int triCount[4];    /* Number of triangles in a leaf child, zero for interior children */
+
+    /**
+     * @brief Set the box of a child slot
+     * 
+     * @param slot child slot (0-3)
+     * @param node binary node whose bounds are copied
+     */
+    void setBounds(int slot, const Node& node) {
+        minX[slot] = node.min[0];
+        minY[slot] = node.min[1];
+        minZ[slot] = node.min[2];
+        maxX[slot] = node.max[0];
+        maxY[slot] = node.max[1];
+        maxZ[slot] = node.max[2];
+    }
+
+    /**
+     * @brief Mark a child slot as unused
+     * 
+     * @param slot child slot (0-3)
+     */
+    void setEmpty(int slot) {
+        minX[slot] = minY[slot] = minZ[slot] = 1e30f;
+        maxX[slot] = maxY[slot] = maxZ[slot] = -1e30f;
+        child[slot] = 0;
+        triCount[slot] = 0;
+    }
+
+    /**
+     * @brief Calculate the distances at which a given ray enters the four children
+     * 
+     * @param invRay ray whose collision will be checked
+     * @param smallestDistance current smallest distance
+     * @param distances set to the entry distance of each child
+     * @return int bit mask of the children that the ray enters before the smallest distance
+     */
+    int Intersect(const InvRay& invRay, float smallestDistance, float distances[4]) const {
+        //The sign of the direction tells which plane of each slab the ray enters first, which
+        //also makes the inverted boxes of unused slots miss
+        const float* nearX = invRay.sign[0] ? maxX : minX;
+        const float* farX = invRay.sign[0] ? minX : maxX;
+        const float* nearY = invRay.sign[1] ? maxY : minY;
+        const float* farY = invRay.sign[1] ? minY : maxY;
+        const float* nearZ = invRay.sign[2] ? maxZ : minZ;
+        const float* farZ = invRay.sign[2] ? minZ : maxZ;
+#ifdef BVH4_SIMD
+        const __m128 originX = _mm_set1_ps(invRay.origin[0]);
+        const __m128 originY = _mm_set1_ps(invRay.origin[1]);
+        const __m128 originZ = _mm_set1_ps(invRay.origin[2]);
+        const __m128 invX = _mm_set1_ps(invRay.invDirection[0]);
+        const __m128 invY = _mm_set1_ps(invRay.invDirection[1]);
+        const __m128 invZ = _mm_set1_ps(invRay.invDirection[2]);
+
+        __m128 tmin = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(nearX), originX), invX);
+        __m128 tmax = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(farX), originX), invX);
+        tmin = _mm_max_ps(tmin, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(nearY), originY), invY));
+        tmax = _mm_min_ps(tmax, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(farY), originY), invY));
+        tmin = _mm_max_ps(tmin, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(nearZ), originZ), invZ));
+        tmax = _mm_min_ps(tmax, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(farZ), originZ), invZ));
+
+        __m128 hit = _mm_and_ps(_mm_cmpge_ps(tmax, tmin), _mm_cmpgt_ps(tmax, _mm_setzero_ps()));
+        hit = _mm_and_ps(hit, _mm_cmplt_ps(tmin, _mm_set1_ps(smallestDistance)));
+        _mm_storeu_ps(distances, tmin);
+        return _mm_movemask_ps(hit);
+#else
+        int hitMask = 0;
+        for(int slot = 0; slot < 4; slot++) {
+            float tmin = (nearX[slot] - invRay.origin[0]) * invRay.invDirection[0];
+            float tmax = (farX[slot] - invRay.origin[0]) * invRay.invDirection[0];
+            tmin = std::max(tmin, (nearY[slot] - invRay.origin[1]) * invRay.invDirection[1]);
+            tmax = std::min(tmax, (farY[slot] - invRay.origin[1]) * invRay.invDirection[1]);
+            tmin = std::max(tmin, (nearZ[slot] - invRay.origin[2]) * invRay.invDirection[2]);
+            tmax = std::min(tmax, (farZ[slot] - invRay.origin[2]) * invRay.invDirection[2]);
+            distances[slot] = tmin;
+            if(tmax >= tmin && tmax > 0 && tmin < smallestDistance) hitMask |= 1 << slot;
+        }
+        return hitMask;
+#endif
+    }
+};
+
+/**
+ * @brief 4-wide bounding volume hierarchy created by collapsing a binary BVH.
+ * 
+ * Every node has up to four children, which halves the depth of the tree and lets each
+ * traversal step test four boxes at once. The triangles and their order are shared with
+ * the binary BVH it was created from.
+ */
+class BVH4
+{
+public:
+    /**
+     * @brief Construct a new BVH4 object by collapsing a binary BVH
+     * 
+     * @param binaryBVH the BVH to be collapsed
+     */
+    BVH4(std::shared_ptr<BVH> binaryBVH) : bvh(binaryBVH) {
+        if(bvh->getNodeCount() == 0) return;
+        nodes.reserve(bvh->getNodeCount() / 2 + 1);
+        Collapse(bvh->getRootNodeIdx());
+    }
+
+    /**
+     * @brief Calculate whether a given ray collides with the TriangleMesh contained in the BVH4
+     * 
+     * The children of each node are tested at once and the ones that were hit are visited
+     * from the nearest to the farthest.
+     * 
+     * @param ray ray whose collision will be checked
+     * @param rayHit address of a Hit data structure
+     * @param smallestDistance current smallest distance
+     */
+    void BVH4Collision(Ray& ray, Hit& rayHit, float& smallestDistance) const {
+        InvRay invRay(ray);
+        TriangleHit closest;
+        Traverse(nodes, ray, invRay, smallestDistance, [&](int first, int count) {
+            bvh->LeafCollision(first, count, invRay, closest, smallestDistance);
+            return false;
+        });
+        bvh->ResolveHit(closest, ray, rayHit, smallestDistance);
+    }
+
+    /**
+     * @brief Calculate whether a given ray hits any triangle of the BVH4 before the given distance.
+     * The traversal ends at the first hit found.
+     * 
+     * @param ray ray whose collision will be checked
+     * @param maxDistance distance along the ray up to which hits are counted
+     * @return true if the ray hits a triangle between its origin and the given distance
+     */
+    bool BVH4Occluded(const Ray& ray, float maxDistance) const {
+        InvRay invRay(ray);
+        bool occluded = false;
+        Traverse(nodes, ray, invRay, maxDistance, [&](int first, int count) {
+            occluded = bvh->LeafOccluded(first, count, invRay, maxDistance);
+            return occluded;
+        });
+        return occluded;
+    }
+
+    /**
+     * @brief Traverse a 4-wide hierarchy whose node type tests its four children with an
+     * Intersect method, and call the given function for every leaf the ray enters before the
+     * current smallest distance. The work is counted into the counters of the ray if it has them.
+     * 
+     * @param wideNodes nodes of the hierarchy, root first
+     * @param ray ray whose collision will be checked
+     * @param invRay the same ray with its inverse direction, created once by the caller
+     * @param smallestDistance current smallest distance, updated by the leaf function
+     * @param leafFunction called with the first triangle index and triangle count of each leaf,
+     * returns true to end the traversal
+     */
+    template <typename NodeType, typename LeafFunction>
+    static void Traverse(const std::vector<NodeType>& wideNodes, const Ray& ray, const InvRay& invRay, const float& smallestDistance, LeafFunction leafFunction) {
+        if(wideNodes.empty()) return;
+        StackEntry stack[stackSize];
+        int stackPtr = 0;
+        stack[stackPtr++] = { 0, 0, -1e30f };
+
+        while(stackPtr > 0) {
+            StackEntry entry = stack[--stackPtr];
+            if(entry.distance >= smallestDistance) continue;
+            if(entry.triCount > 0) {
+                if(ray.counters) ray.counters->primitiveTests += entry.triCount;
+                if(leafFunction(entry.index, entry.triCount)) return;
+                continue;
+            }
+            if(ray.counters) ray.counters->nodeVisits++;
+
+            const NodeType& node = wideNodes[entry.index];
+            float distances[4];
+            int hitMask = node.Intersect(invRay, smallestDistance, distances);
+
+            //Sort the children that were hit from the farthest to the nearest
+            int order[4];
+            int hitCount = 0;
+            for(int slot = 0; slot < 4; slot++) {
+                if(!(hitMask & (1 << slot))) continue;
+                int i = hitCount++;
+                while(i > 0 && distances[order[i - 1]] < distances[slot]) {
+                    order[i] = order[i - 1];
+                    i--;
+                }
+                order[i] = slot;
+            }
+
+            //Push them so that the nearest child is popped first
+            for(int i = 0; i < hitCount; i++) {
+                int slot = order[i];
+                stack[stackPtr++] = { node.child[slot], node.triCount[slot], distances[slot] };
+            }
+        }
+    }
+
+    /**
+     * @brief Get the nodes vector
+     * 
+     * @return const std::vector<Node4>&
+     */
+    const std::vector<Node4>& getNodes() const {
+        return nodes;
+    }
+
+    /**
+     * @brief Get the memory taken by the nodes
+     * 
+     * @return size_t bytes
+     */
+    size_t getMemoryUsage() const {
+        return nodes.size() * sizeof(Node4);
+    }
+
+private:
+    /**
+     * @brief Node or leaf waiting on the traversal stack together with the distance to its box
+     * 
+     */
+    struct StackEntry
+    {
+        int index;
+        int triCount;
+        float distance;
+    };
+
+    static constexpr int stackSize = 256;   /* Each level of a 64 level tree adds at most three entries */
+
+    std::shared_ptr<BVH> bvh;
+    std::vector<Node4> nodes;
+
+    /**
+     * @brief Creates a 4-wide node from a binary node and its descendants recursively
+     * 
+     * The children of the binary node are expanded, largest surface area first, until there
+     * are four children or only leaves are left.
+     * 
+     * @param nodeIdx index of the binary node
+     * @return int index of the created 4-wide node
+     */
+    int Collapse(int nodeIdx) {
+        const std::vector<Node>& binaryNodes = bvh->getNodes();
+        const Node& binaryNode = binaryNodes[nodeIdx];
+
+        //Gather up to four children
+        std::vector<int> children;
+        if(binaryNode.isLeaf()) {
+            children.push_back(nodeIdx);
+        }else {
+            children.push_back(nodeIdx + 1);
+            children.push_back(binaryNode.leftFirst);
+        }
+        while(children.size() < 4) {
+            int largest = -1;
+            double largestArea = -1;
+            for(size_t i = 0; i < children.size(); i++) {
+                const Node& child = binaryNodes[children[i]];
+                double area = child.getBounds().area();
+                if(!child.isLeaf() && area > largestArea) {
+                    largest = i;
+                    largestArea = area;
+                }
+            }
+            if(largest == -1) break;
+            int expanded = children[largest];
+            children[largest] = expanded + 1;
+            children.push_back(binaryNodes[expanded].leftFirst);
+        }
+
+        int node4Idx = nodes.size();
+        nodes.push_back(Node4());
+        for(int slot = 0; slot < 4; slot++) {
+            if(slot >= (int)children.size()) {
+                nodes[node4Idx].setEmpty(slot);
+                continue;
+            }
+            const Node& child = binaryNodes[children[slot]];
+            nodes[node4Idx].setBounds(slot, child);
+            if(child.isLeaf()) {
+                nodes[node4Idx].child[slot] = child.leftFirst;
+                nodes[node4Idx].triCount[slot] = child.triCount;
+            }else {
+                int childIdx = Collapse(children[slot]);
+                nodes[node4Idx].child[slot] = childIdx;
+                nodes[node4Idx].triCount[slot] = 0;
+            }
+        }
+        return node4Idx;
+    }
+};
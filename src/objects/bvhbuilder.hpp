@@ -0,0 +1,1190 @@
+#pragma once
+
+#include "types.hpp"
+#include "morton.hpp"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <omp.h>
+
+/**
+ * @brief Strategies for splitting the primitives of a node when building the BVH
+ * 
+ */
+enum class BVHBuildMode
+{
+    Fast,       /* Spatial midpoint of the longest axis */
+    Quality,    /* Binned surface area heuristic (SAH) */
+    Spatial,    /* Binned SAH that may also split primitives with planes (SBVH) */
+    Linear      /* Primitives sorted by the Morton codes of their centroids (LBVH) */
+};
+
+/**
+ * @brief Node layouts the BVH of a mesh can be traversed in
+ * 
+ */
+enum class BVHLayout
+{
+    BVH2,           /* Binary tree */
+    BVH4,           /* 4-wide tree with SIMD box tests, collapsed from the binary tree */
+    CompressedBVH4  /* 4-wide tree with child boxes quantized to 8 bits, half the size of BVH4 nodes */
+};
+
+/**
+ * @brief Settings used when building the BVH
+ * 
+ */
+struct BVHSettings
+{
+    BVHBuildMode mode = BVHBuildMode::Quality;
+    BVHLayout layout = BVHLayout::BVH2;
+    float traversalCost = 1.0f;     /* SAH cost of testing a ray against one node */
+    float intersectionCost = 1.0f;  /* SAH cost of testing a ray against one primitive, or one group of the leaf width */
+    int bins = 16;                  /* Number of centroid bins evaluated per axis */
+    int maxLeafSize = 16;           /* Leaves are always split above this size */
+    float rebuildThreshold = 1.5f;  /* A refitted tree is rebuilt once its SAH cost exceeds this multiple of the cost after building */
+    bool cache = false;             /* Load and store the built tree of a mesh in a cache file next to its .obj file */
+    float splitBudget = 0.3f;       /* Spatial splits may add at most this fraction of extra primitive references */
+    int leafWidth = 1;              /* Primitives of a leaf tested at once, the SAH counts a leaf per group of this many */
+};
+
+/**
+ * @brief Struct representing a node of the bounding volume hierarchy while it is being built
+ * 
+ */
+struct BuildNode
+{
+    AABB box;
+    int leftChild;
+    bool isLeaf() { return triCount > 0; }
+    int firstTriIdx, triCount;
+};
+
+/**
+ * @brief Struct representing a node in the bounding volume hiererchy
+ * 
+ * Nodes are 32 bytes and stored in depth-first order, so the left child of an interior node
+ * is always the next node and only the index of the right child is stored. The bounds are
+ * single precision floats rounded outwards from the exact bounds.
+ */
+struct alignas(32) Node
+{
+    float min[3];
+    int leftFirst;  /* Right child of an interior node, first primitive index of a leaf */
+    float max[3];
+    int triCount;   /* Number of primitives in a leaf, zero for interior nodes */
+
+    bool isLeaf() const { return triCount > 0; }
+
+    /**
+     * @brief Set the bounds of the node so that they contain the given box
+     * 
+     * @param box box with the exact bounds
+     */
+    void setBounds(const AABB& box) {
+        for(int axis = 0; axis < 3; axis++) {
+            min[axis] = std::nextafter((float)box.min(axis), -INFINITY);
+            max[axis] = std::nextafter((float)box.max(axis), INFINITY);
+        }
+    }
+
+    /**
+     * @brief Get the bounds of the node
+     * 
+     * @return AABB 
+     */
+    AABB getBounds() const {
+        AABB box;
+        box.min = Vector(min[0], min[1], min[2]);
+        box.max = Vector(max[0], max[1], max[2]);
+        return box;
+    }
+};
+
+/**
+ * @brief Builds a bounding volume hierarchy over any kind of primitives given their bounding boxes.
+ * 
+ * Subtrees are built concurrently as OpenMP tasks, and the bounds of the large nodes
+ * near the root are computed as parallel reductions.
+ * 
+ * In the spatial split mode a primitive can be split by a plane and referenced from both
+ * sides, which needs a function that clips the primitive to a slab. Without one the
+ * spatial split mode builds the same tree as the quality mode.
+ * 
+ * The linear mode sorts the primitives along a Morton curve and builds the whole tree in a
+ * few parallel passes without evaluating any splits, in a fraction of the time of the other
+ * modes but with a higher SAH cost.
+ */
+class BVHBuilder
+{
+public:
+    static constexpr int maxDepth = 64;         /* Depth limit of the tree, also the size of the traversal stacks */
+
+    /**
+     * @brief Function returning the bounds of the part of a primitive inside a slab, given the
+     * primitive index, the axis and the lower and upper planes of the slab, and the bounds of the
+     * part of the primitive being split. Returns an empty box if no part is inside the slab.
+     */
+    typedef std::function<AABB(int, int, double, double, const AABB&)> ClipFunction;
+
+    /**
+     * @brief Construct a new BVHBuilder object
+     * 
+     * @param primBoxes bounding boxes of the primitives
+     * @param primCentroids centroids of the primitives, used to sort them into the child nodes
+     * @param buildSettings settings used to build the hierarchy
+     */
+    BVHBuilder(const std::vector<AABB>& primBoxes, const std::vector<Vector>& primCentroids, BVHSettings buildSettings)
+                : boxes(primBoxes), centroids(primCentroids), settings(buildSettings) {}
+
+    /**
+     * @brief Construct a new BVHBuilder object that can make spatial splits
+     * 
+     * @param primBoxes bounding boxes of the primitives
+     * @param primCentroids centroids of the primitives, used to sort them into the child nodes
+     * @param buildSettings settings used to build the hierarchy
+     * @param clipFunction function clipping a primitive to a slab
+     */
+    BVHBuilder(const std::vector<AABB>& primBoxes, const std::vector<Vector>& primCentroids, BVHSettings buildSettings,
+               ClipFunction clipFunction) : boxes(primBoxes), centroids(primCentroids), settings(buildSettings), clip(clipFunction) {}
+
+    /**
+     * @brief Build the hierarchy
+     * 
+     * @param bvhNodes set to the nodes of the hierarchy in depth-first order, root first
+     * @param primIndices set to the primitive indices referenced by the leaves. With spatial
+     * splits a primitive can be referenced by several leaves.
+     */
+    void Build(std::vector<Node>& bvhNodes, std::vector<int>& primIndices) {
+        int n = boxes.size();
+        bvhNodes.clear();
+        primIdx.resize(n);
+        for(int i = 0; i < n; i++) {
+            primIdx[i] = i;
+        }
+        if(n == 0) {
+            primIndices = primIdx;
+            return;
+        }
+
+        nodes = &bvhNodes;
+        if(settings.mode == BVHBuildMode::Linear) {
+            BuildLinear();
+            primIndices = std::move(primIdx);
+            return;
+        }
+
+        std::vector<BuildNode> buildNodes;
+        if(settings.mode == BVHBuildMode::Spatial && clip) {
+            BuildSpatial(buildNodes);
+        }else {
+            buildNodes.resize(n*2 - 1);
+            nodesUsed = 1;
+            BuildNode& root = buildNodes[0];
+            root.leftChild = 0;
+            root.firstTriIdx = 0;
+            root.triCount = n;
+
+            //Create the structure
+            #pragma omp parallel
+            #pragma omp single
+            {
+                UpdateNodeBounds(buildNodes, 0);
+                Subdivide(buildNodes, 0);
+            }
+        }
+
+        //Copy structure in depth-first order
+        nodes->reserve(nodesUsed);
+        Flatten(buildNodes, 0);
+        primIndices = std::move(primIdx);
+    }
+
+    /**
+     * @brief Recompute the bounds of every node from the current primitive boxes without
+     * changing the topology of the tree
+     * 
+     * Subtrees are refitted bottom-up as separate OpenMP tasks when they are large enough.
+     * 
+     * @param bvhNodes nodes of the hierarchy in depth-first order
+     * @param primBoxes current bounding boxes of the primitives
+     * @param primIndices primitive indices referenced by the leaves
+     */
+    static void Refit(std::vector<Node>& bvhNodes, const std::vector<AABB>& primBoxes, const std::vector<int>& primIndices) {
+        if(bvhNodes.empty()) return;
+        #pragma omp parallel
+        #pragma omp single
+        RefitNode(bvhNodes, primBoxes, primIndices, 0);
+    }
+
+    /**
+     * @brief Compute the SAH cost of a hierarchy, i.e., the expected cost of tracing a random ray
+     * that hits the root box, using the traversal and intersection costs of the settings
+     * 
+     * @param bvhNodes nodes of the hierarchy in depth-first order
+     * @param buildSettings settings containing the cost constants
+     * @return float 
+     */
+    static float SAHCost(const std::vector<Node>& bvhNodes, const BVHSettings& buildSettings) {
+        if(bvhNodes.empty()) return 0;
+        double rootArea = bvhNodes[0].getBounds().area();
+        if(rootArea == 0) return 0;
+        double cost = 0;
+        for(const Node& node : bvhNodes) {
+            double relativeArea = node.getBounds().area() / rootArea;
+            if(node.triCount > 0) {
+                cost += IntersectionCost(buildSettings, node.triCount) * relativeArea;
+            }else {
+                cost += buildSettings.traversalCost * relativeArea;
+            }
+        }
+        return cost;
+    }
+
+    /**
+     * @brief SAH cost of testing a ray against the primitives of a leaf, which are tested
+     * in groups of the leaf width of the settings
+     * 
+     * @param buildSettings settings containing the cost constants
+     * @param count number of primitives
+     * @return float 
+     */
+    static float IntersectionCost(const BVHSettings& buildSettings, int count) {
+        return buildSettings.intersectionCost * ((count + buildSettings.leafWidth - 1) / buildSettings.leafWidth);
+    }
+
+private:
+    const std::vector<AABB>& boxes;
+    const std::vector<Vector>& centroids;
+    BVHSettings settings;
+    ClipFunction clip;
+    std::vector<int> primIdx;
+    std::vector<Node>* nodes = nullptr;
+    int nodesUsed = 0;
+    int referencesUsed = 0;     /* Primitive references created by the spatial split build */
+    int maxReferences = 0;      /* Reference budget of the spatial split build */
+    int leafReferences = 0;     /* Primitive references placed into leaves by the spatial split build */
+    double rootArea = 0;
+
+    static constexpr int chunkSize = 16384;     /* Primitives per parallel chunk in bounds and binning passes */
+    static constexpr int taskThreshold = 1024;  /* Smallest node whose subtrees are built on separate tasks */
+    static constexpr double overlapThreshold = 1e-5;    /* Relative child overlap above which spatial splits are tried */
+    static constexpr int radixBits = 8;         /* Bits of the keys sorted by each pass of the radix sort */
+
+    /**
+     * @brief Reference to a primitive, or to the part of it inside the box, in the spatial split build
+     * 
+     */
+    struct Reference
+    {
+        int primIdx;
+        AABB box;
+    };
+
+    /**
+     * @brief Split of a node found by the spatial split build
+     * 
+     */
+    struct Split
+    {
+        float cost = 1e30f;
+        int axis = 0;
+        int bin = 0;            /* Object splits: first bin on the right side */
+        double pos = 0;         /* Spatial splits: position of the split plane */
+        double overlap = 0;     /* Object splits: surface area of the overlap of the two children */
+    };
+
+    /**
+     * @brief Node of the linear build. The n - 1 interior nodes come first, followed by a leaf
+     * for each of the n sorted primitives.
+     * 
+     */
+    struct LinearNode
+    {
+        AABB box;
+        int parent = -1;
+        int left, right;    /* Children of an interior node */
+        int first, count;   /* Range of sorted primitives below the node */
+        float cost;         /* SAH cost of the subtree, not divided by the area of the root */
+        bool leaf;          /* The subtree is cheaper as a single leaf */
+    };
+
+    /**
+     * @brief Updates the bounds of the AABB based on the primitives it contains
+     * 
+     * @param bvhNodes vector containing the nodes
+     * @param nodeIdx the current node index
+     */
+    void UpdateNodeBounds(std::vector<BuildNode>& bvhNodes, int nodeIdx) {
+        BuildNode& currentNode = bvhNodes[nodeIdx];
+        std::vector<AABB> partial(ChunkCount(currentNode.triCount));
+
+        //Each chunk of primitives is bounded separately and the results are merged
+        ForEachChunk(currentNode.firstTriIdx, currentNode.triCount, [&](int first, int count, int chunk) {
+            for(int i = 0; i < count; i++) {
+                partial[chunk].grow(boxes[primIdx[first + i]]);
+            }
+        });
+
+        currentNode.box = AABB();
+        for(const AABB& box : partial) {
+            currentNode.box.grow(box);
+        }
+    }
+
+    /**
+     * @brief Divides the primitives of the current node into new AABBs recursively
+     * 
+     * The two subtrees are built as separate OpenMP tasks when the node is large enough.
+     * 
+     * @param bvhNodes vector containing the nodes
+     * @param nodeIdx current node index
+     * @param depth depth of the current node, nodes at the maximum depth are left as leaves
+     */
+    void Subdivide(std::vector<BuildNode>& bvhNodes, int nodeIdx, int depth = 0) {
+        //Terminates recursion
+        BuildNode &currentNode = bvhNodes[nodeIdx];
+        if(currentNode.triCount <= 2 || depth >= maxDepth - 1) return;
+
+        //Determine the split
+        int axis;
+        double splitPos;
+        if(settings.mode != BVHBuildMode::Fast) {
+            float leafCost = IntersectionCost(settings, currentNode.triCount);
+            float splitCost = FindBestSplit(currentNode, axis, splitPos);
+            //Keep the node as a leaf if it cannot be split or splitting does not pay off
+            if(splitCost >= 1e30f) return;
+            if(splitCost >= leafCost && currentNode.triCount <= settings.maxLeafSize) return;
+        }else {
+            Vector extent = currentNode.box.max - currentNode.box.min;
+            axis = 0;
+            if(extent(1) > extent(0)) axis = 1;
+            if(extent(2) > extent(axis)) axis = 2;
+            splitPos = currentNode.box.min(axis) + extent(axis)*0.5f;
+        }
+
+        //Partition primitives
+        int i = currentNode.firstTriIdx;
+        int j = i + currentNode.triCount - 1;
+        while(i <= j) {
+            if(centroids[primIdx[i]](axis) < splitPos) {
+                i++;
+            }else {
+                std::swap(primIdx[i], primIdx[j--]);
+            }
+        }
+
+        //Check if one of the sides is empty
+        int leftCount = i - currentNode.firstTriIdx;
+        if(leftCount == 0 || leftCount == currentNode.triCount) return;
+
+        //create child nodes
+        int leftChildIdx;
+        #pragma omp atomic capture
+        {
+            leftChildIdx = nodesUsed;
+            nodesUsed += 2;
+        }
+        int rightChildIdx = leftChildIdx + 1;
+        bvhNodes[leftChildIdx].firstTriIdx = currentNode.firstTriIdx;
+        bvhNodes[leftChildIdx].triCount = leftCount;
+        bvhNodes[rightChildIdx].firstTriIdx = i;
+        bvhNodes[rightChildIdx].triCount = currentNode.triCount - leftCount;
+        currentNode.leftChild = leftChildIdx;
+        bool spawnTasks = currentNode.triCount > taskThreshold;
+        currentNode.triCount = 0;
+        
+        //Update node bounds and recurse, the left subtree on a new task
+        #pragma omp task if(spawnTasks) shared(bvhNodes)
+        {
+            UpdateNodeBounds(bvhNodes, leftChildIdx);
+            Subdivide(bvhNodes, leftChildIdx, depth + 1);
+        }
+        UpdateNodeBounds(bvhNodes, rightChildIdx);
+        Subdivide(bvhNodes, rightChildIdx, depth + 1);
+        #pragma omp taskwait
+    }
+
+    /**
+     * @brief Finds the cheapest split of a node using the binned surface area heuristic.
+     * 
+     * Primitive centroids are sorted into equally sized bins along each axis and every
+     * plane between two bins is evaluated as a candidate split.
+     * 
+     * @param node node to be split
+     * @param bestAxis set to the axis of the cheapest split
+     * @param bestPos set to the position of the cheapest split plane
+     * @return float SAH cost of the cheapest split, or infinity if the node cannot be split
+     */
+    float FindBestSplit(const BuildNode& node, int& bestAxis, double& bestPos) {
+        int binCount = settings.bins;
+        int chunks = ChunkCount(node.triCount);
+        float bestCost = 1e30f;
+
+        //Bins are placed over the bounds of the centroids, not the primitives
+        std::vector<AABB> partialBounds(chunks);
+        ForEachChunk(node.firstTriIdx, node.triCount, [&](int first, int count, int chunk) {
+            for(int i = 0; i < count; i++) {
+                partialBounds[chunk].grow(centroids[primIdx[first + i]]);
+            }
+        });
+        AABB centroidBounds;
+        for(const AABB& box : partialBounds) {
+            centroidBounds.grow(box);
+        }
+        Vector boundsMin = centroidBounds.min;
+        Vector scale;
+        for(int axis = 0; axis < 3; axis++) {
+            double extent = centroidBounds.max(axis) - boundsMin(axis);
+            scale(axis) = extent > 0 ? binCount / extent : 0;
+        }
+
+        //Sort the primitives into the bins of all three axes, one set of bins per chunk
+        std::vector<std::vector<AABB>> partialBoxes(chunks, std::vector<AABB>(3*binCount));
+        std::vector<std::vector<int>> partialTris(chunks, std::vector<int>(3*binCount));
+        ForEachChunk(node.firstTriIdx, node.triCount, [&](int first, int count, int chunk) {
+            std::vector<AABB>& binBoxes = partialBoxes[chunk];
+            std::vector<int>& binTris = partialTris[chunk];
+            for(int i = 0; i < count; i++) {
+                int leafPrimIdx = primIdx[first + i];
+                for(int axis = 0; axis < 3; axis++) {
+                    int bin = std::min(binCount - 1, (int)((centroids[leafPrimIdx](axis) - boundsMin(axis)) * scale(axis)));
+                    binTris[axis*binCount + bin]++;
+                    binBoxes[axis*binCount + bin].grow(boxes[leafPrimIdx]);
+                }
+            }
+        });
+        for(int chunk = 1; chunk < chunks; chunk++) {
+            for(int bin = 0; bin < 3*binCount; bin++) {
+                partialBoxes[0][bin].grow(partialBoxes[chunk][bin]);
+                partialTris[0][bin] += partialTris[chunk][bin];
+            }
+        }
+
+        double parentArea = node.box.area();
+        std::vector<float> leftArea(binCount - 1), rightArea(binCount - 1);
+        std::vector<int> leftCount(binCount - 1), rightCount(binCount - 1);
+
+        for(int axis = 0; axis < 3; axis++) {
+            if(scale(axis) == 0) continue;
+            AABB* binBoxes = &partialBoxes[0][axis*binCount];
+            int* binTris = &partialTris[0][axis*binCount];
+
+            //Sweep from both sides to get the areas and counts on each side of every plane
+            AABB leftBox, rightBox;
+            int leftSum = 0, rightSum = 0;
+            for(int i = 0; i < binCount - 1; i++) {
+                leftSum += binTris[i];
+                leftCount[i] = leftSum;
+                leftBox.grow(binBoxes[i]);
+                leftArea[i] = leftBox.area();
+                rightSum += binTris[binCount - 1 - i];
+                rightCount[binCount - 2 - i] = rightSum;
+                rightBox.grow(binBoxes[binCount - 1 - i]);
+                rightArea[binCount - 2 - i] = rightBox.area();
+            }
+
+            //Evaluate the cost of each plane
+            for(int i = 0; i < binCount - 1; i++) {
+                if(leftCount[i] == 0 || rightCount[i] == 0) continue;
+                float cost = settings.traversalCost + (IntersectionCost(settings, leftCount[i])*leftArea[i] +
+                            IntersectionCost(settings, rightCount[i])*rightArea[i]) / parentArea;
+                if(cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestPos = boundsMin(axis) + (i + 1) / scale(axis);
+                }
+            }
+        }
+        return bestCost;
+    }
+
+    /**
+     * @brief Build the tree with both object and spatial splits, following the SBVH of
+     * Stich et al. Primitives cut by a spatial split plane are clipped to each side and
+     * referenced from both, until the reference budget of the settings is used up.
+     * 
+     * @param buildNodes set to the build nodes, root first
+     */
+    void BuildSpatial(std::vector<BuildNode>& buildNodes) {
+        int n = boxes.size();
+        maxReferences = n + (int)(n * settings.splitBudget);
+        referencesUsed = n;
+        leafReferences = 0;
+        primIdx.resize(maxReferences);
+        buildNodes.resize(maxReferences*2 - 1);
+        nodesUsed = 1;
+
+        std::vector<Reference> refs(n);
+        AABB rootBox;
+        for(int i = 0; i < n; i++) {
+            refs[i] = { i, boxes[i] };
+            rootBox.grow(boxes[i]);
+        }
+        rootArea = rootBox.area();
+
+        #pragma omp parallel
+        #pragma omp single
+        SubdivideSpatial(buildNodes, 0, refs, 0);
+
+        primIdx.resize(leafReferences);
+    }
+
+    /**
+     * @brief Divides the references of the current node into new AABBs recursively, using
+     * whichever of the best object split, the best spatial split and a leaf is the cheapest
+     * 
+     * @param bvhNodes vector containing the nodes
+     * @param nodeIdx current node index
+     * @param refs references inside the node, released when the node has been split
+     * @param depth depth of the current node
+     */
+    void SubdivideSpatial(std::vector<BuildNode>& bvhNodes, int nodeIdx, std::vector<Reference>& refs, int depth) {
+        BuildNode& currentNode = bvhNodes[nodeIdx];
+        currentNode.box = AABB();
+        for(const Reference& ref : refs) {
+            currentNode.box.grow(ref.box);
+        }
+        int count = refs.size();
+        if(count <= 2 || depth >= maxDepth - 1) {
+            MakeLeaf(currentNode, refs);
+            return;
+        }
+
+        //Spatial splits only pay off where the children of the object split overlap
+        Split objectSplit = FindObjectSplit(refs, currentNode.box);
+        Split spatialSplit;
+        int referencesSoFar;
+        #pragma omp atomic read
+        referencesSoFar = referencesUsed;
+        if(objectSplit.overlap > overlapThreshold * rootArea && referencesSoFar < maxReferences) {
+            spatialSplit = FindSpatialSplit(refs, currentNode.box);
+        }
+        bool spatial = spatialSplit.cost < objectSplit.cost;
+        float splitCost = std::min(spatialSplit.cost, objectSplit.cost);
+        float leafCost = IntersectionCost(settings, count);
+        if(splitCost >= 1e30f || (splitCost >= leafCost && count <= settings.maxLeafSize)) {
+            MakeLeaf(currentNode, refs);
+            return;
+        }
+
+        //Reserve the duplicated references, or fall back to the object split if the budget is used up
+        int straddling = 0;
+        if(spatial) {
+            for(const Reference& ref : refs) {
+                if(ref.box.min(spatialSplit.axis) < spatialSplit.pos && ref.box.max(spatialSplit.axis) > spatialSplit.pos) {
+                    straddling++;
+                }
+            }
+            int used;
+            #pragma omp atomic capture
+            {
+                used = referencesUsed;
+                referencesUsed += straddling;
+            }
+            if(used + straddling > maxReferences) {
+                #pragma omp atomic
+                referencesUsed -= straddling;
+                straddling = 0;
+                spatial = false;
+                if(objectSplit.cost >= 1e30f || (objectSplit.cost >= leafCost && count <= settings.maxLeafSize)) {
+                    MakeLeaf(currentNode, refs);
+                    return;
+                }
+            }
+        }
+
+        //Partition references
+        std::vector<Reference> left, right;
+        if(spatial) {
+            int axis = spatialSplit.axis;
+            double pos = spatialSplit.pos;
+            for(const Reference& ref : refs) {
+                if(ref.box.max(axis) <= pos) {
+                    left.push_back(ref);
+                }else if(ref.box.min(axis) >= pos) {
+                    right.push_back(ref);
+                }else {
+                    AABB leftBox = clip(ref.primIdx, axis, ref.box.min(axis), pos, ref.box);
+                    AABB rightBox = clip(ref.primIdx, axis, pos, ref.box.max(axis), ref.box);
+                    if(!IsEmpty(leftBox)) left.push_back({ ref.primIdx, leftBox });
+                    if(!IsEmpty(rightBox)) right.push_back({ ref.primIdx, rightBox });
+                }
+            }
+        }else {
+            AABB centroidBounds = CentroidBounds(refs);
+            int axis = objectSplit.axis;
+            double scale = settings.bins / (centroidBounds.max(axis) - centroidBounds.min(axis));
+            for(const Reference& ref : refs) {
+                if(Bin(ref, axis, centroidBounds.min(axis), scale) < objectSplit.bin) {
+                    left.push_back(ref);
+                }else {
+                    right.push_back(ref);
+                }
+            }
+        }
+        if(left.empty() || right.empty()) {
+            //No references were duplicated, so give back the reservation
+            if(spatial) {
+                #pragma omp atomic
+                referencesUsed -= straddling;
+            }
+            MakeLeaf(currentNode, refs);
+            return;
+        }
+        std::vector<Reference>().swap(refs);
+
+        //create child nodes
+        int leftChildIdx;
+        #pragma omp atomic capture
+        {
+            leftChildIdx = nodesUsed;
+            nodesUsed += 2;
+        }
+        int rightChildIdx = leftChildIdx + 1;
+        currentNode.leftChild = leftChildIdx;
+        currentNode.triCount = 0;
+        bool spawnTasks = count > taskThreshold;
+
+        #pragma omp task if(spawnTasks) shared(bvhNodes, left)
+        SubdivideSpatial(bvhNodes, leftChildIdx, left, depth + 1);
+        SubdivideSpatial(bvhNodes, rightChildIdx, right, depth + 1);
+        #pragma omp taskwait
+    }
+
+    /**
+     * @brief Turn a node of the spatial split build into a leaf containing the given references
+     * 
+     * @param node the node
+     * @param refs references inside the node
+     */
+    void MakeLeaf(BuildNode& node, const std::vector<Reference>& refs) {
+        int first;
+        #pragma omp atomic capture
+        {
+            first = leafReferences;
+            leafReferences += refs.size();
+        }
+        for(size_t i = 0; i < refs.size(); i++) {
+            primIdx[first + i] = refs[i].primIdx;
+        }
+        node.firstTriIdx = first;
+        node.triCount = refs.size();
+    }
+
+    /**
+     * @brief Finds the cheapest object split of a node of the spatial split build with binned SAH
+     * 
+     * @param refs references inside the node
+     * @param box bounds of the node
+     * @return Split the cheapest split, with the overlap of its children
+     */
+    Split FindObjectSplit(const std::vector<Reference>& refs, const AABB& box) {
+        int binCount = settings.bins;
+        AABB centroidBounds = CentroidBounds(refs);
+        double parentArea = box.area();
+        Split best;
+
+        std::vector<AABB> binBoxes(binCount);
+        std::vector<int> binCounts(binCount);
+        std::vector<AABB> rightBoxes(binCount);
+        for(int axis = 0; axis < 3; axis++) {
+            double extent = centroidBounds.max(axis) - centroidBounds.min(axis);
+            if(extent <= 0) continue;
+            double scale = binCount / extent;
+            std::fill(binBoxes.begin(), binBoxes.end(), AABB());
+            std::fill(binCounts.begin(), binCounts.end(), 0);
+            for(const Reference& ref : refs) {
+                int bin = Bin(ref, axis, centroidBounds.min(axis), scale);
+                binCounts[bin]++;
+                binBoxes[bin].grow(ref.box);
+            }
+
+            //Sweep from the right to get the boxes right of every plane, then from the left
+            AABB rightBox;
+            for(int i = binCount - 1; i > 0; i--) {
+                rightBox.grow(binBoxes[i]);
+                rightBoxes[i] = rightBox;
+            }
+            AABB leftBox;
+            int leftCount = 0;
+            for(int i = 1; i < binCount; i++) {
+                leftBox.grow(binBoxes[i - 1]);
+                leftCount += binCounts[i - 1];
+                int rightCount = refs.size() - leftCount;
+                if(leftCount == 0 || rightCount == 0) continue;
+                float cost = settings.traversalCost + (IntersectionCost(settings, leftCount)*leftBox.area() +
+                            IntersectionCost(settings, rightCount)*rightBoxes[i].area()) / parentArea;
+                if(cost < best.cost) {
+                    best.cost = cost;
+                    best.axis = axis;
+                    best.bin = i;
+                    best.overlap = OverlapArea(leftBox, rightBoxes[i]);
+                }
+            }
+        }
+        return best;
+    }
+
+    /**
+     * @brief Finds the cheapest spatial split of a node. The node is divided into equally wide bins
+     * along each axis, and every reference is clipped to each of the bins it overlaps.
+     * 
+     * @param refs references inside the node
+     * @param box bounds of the node
+     * @return Split the cheapest split
+     */
+    Split FindSpatialSplit(const std::vector<Reference>& refs, const AABB& box) {
+        int binCount = settings.bins;
+        double parentArea = box.area();
+        Split best;
+
+        std::vector<AABB> binBoxes(binCount);
+        std::vector<int> entries(binCount), exits(binCount);
+        std::vector<AABB> rightBoxes(binCount);
+        for(int axis = 0; axis < 3; axis++) {
+            double extent = box.max(axis) - box.min(axis);
+            if(extent <= 0) continue;
+            double width = extent / binCount;
+            std::fill(binBoxes.begin(), binBoxes.end(), AABB());
+            std::fill(entries.begin(), entries.end(), 0);
+            std::fill(exits.begin(), exits.end(), 0);
+            for(const Reference& ref : refs) {
+                int firstBin = std::clamp((int)((ref.box.min(axis) - box.min(axis)) / width), 0, binCount - 1);
+                int lastBin = std::clamp((int)((ref.box.max(axis) - box.min(axis)) / width), firstBin, binCount - 1);
+                entries[firstBin]++;
+                exits[lastBin]++;
+                if(firstBin == lastBin) {
+                    binBoxes[firstBin].grow(ref.box);
+                    continue;
+                }
+                for(int bin = firstBin; bin <= lastBin; bin++) {
+                    double lo = bin == firstBin ? ref.box.min(axis) : box.min(axis) + bin*width;
+                    double hi = bin == lastBin ? ref.box.max(axis) : box.min(axis) + (bin + 1)*width;
+                    binBoxes[bin].grow(clip(ref.primIdx, axis, lo, hi, ref.box));
+                }
+            }
+
+            AABB rightBox;
+            for(int i = binCount - 1; i > 0; i--) {
+                rightBox.grow(binBoxes[i]);
+                rightBoxes[i] = rightBox;
+            }
+            AABB leftBox;
+            int leftCount = 0;
+            int rightCount = refs.size();
+            for(int i = 1; i < binCount; i++) {
+                leftBox.grow(binBoxes[i - 1]);
+                leftCount += entries[i - 1];
+                rightCount -= exits[i - 1];
+                if(leftCount == 0 || rightCount == 0) continue;
+                float cost = settings.traversalCost + (IntersectionCost(settings, leftCount)*leftBox.area() +
+                            IntersectionCost(settings, rightCount)*rightBoxes[i].area()) / parentArea;
+                if(cost < best.cost) {
+                    best.cost = cost;
+                    best.axis = axis;
+                    best.pos = box.min(axis) + i*width;
+                }
+            }
+        }
+        return best;
+    }
+
+    /**
+     * @brief Build the tree from the primitives sorted along a Morton curve, following the LBVH
+     * of Karras. Every interior node is found from the sorted codes independently of the others,
+     * and the bounds are then merged bottom-up, collapsing the subtrees that are cheaper as
+     * leaves by the SAH.
+     * 
+     */
+    void BuildLinear() {
+        int n = boxes.size();
+
+        //The Morton grid is placed over the bounds of the centroids
+        std::vector<AABB> partial(ChunkCount(n));
+        #pragma omp parallel
+        #pragma omp single
+        ForEachChunk(0, n, [&](int first, int count, int chunk) {
+            for(int i = 0; i < count; i++) {
+                partial[chunk].grow(centroids[first + i]);
+            }
+        });
+        AABB centroidBounds;
+        for(const AABB& box : partial) {
+            centroidBounds.grow(box);
+        }
+
+        std::vector<uint32_t> codes(n);
+        #pragma omp parallel for
+        for(int i = 0; i < n; i++) {
+            codes[i] = Morton::Code(centroids[i], centroidBounds);
+        }
+        RadixSort(codes, primIdx);
+
+        std::vector<LinearNode> linearNodes(2*n - 1);
+        LinearTopology(codes, linearNodes);
+        LinearBounds(linearNodes);
+
+        nodes->reserve(2*n - 1);
+        FlattenLinear(linearNodes, 0);
+    }
+
+    /**
+     * @brief Sort keys and the values attached to them with a parallel least significant digit
+     * radix sort. Each thread counts the digits of its part of the keys, and the counts give
+     * every thread the positions its keys are moved to.
+     * 
+     * @param keys keys to be sorted
+     * @param values values moved along with the keys
+     */
+    static void RadixSort(std::vector<uint32_t>& keys, std::vector<int>& values) {
+        const int buckets = 1 << radixBits;
+        int n = keys.size();
+        std::vector<uint32_t> sortedKeys(n);
+        std::vector<int> sortedValues(n);
+        std::vector<int> offsets(omp_get_max_threads() * buckets);
+
+        for(int shift = 0; shift < 32; shift += radixBits) {
+            #pragma omp parallel if(n > chunkSize)
+            {
+                int thread = omp_get_thread_num();
+                int threads = omp_get_num_threads();
+                int first = (long)n * thread / threads;
+                int last = (long)n * (thread + 1) / threads;
+                int* offset = &offsets[thread * buckets];
+                std::fill(offset, offset + buckets, 0);
+                for(int i = first; i < last; i++) {
+                    offset[(keys[i] >> shift) & (buckets - 1)]++;
+                }
+                #pragma omp barrier
+
+                //Turn the counts into positions, by digit and then by thread so that the sort is stable
+                #pragma omp single
+                {
+                    int position = 0;
+                    for(int digit = 0; digit < buckets; digit++) {
+                        for(int t = 0; t < threads; t++) {
+                            int count = offsets[t*buckets + digit];
+                            offsets[t*buckets + digit] = position;
+                            position += count;
+                        }
+                    }
+                }
+
+                for(int i = first; i < last; i++) {
+                    int position = offset[(keys[i] >> shift) & (buckets - 1)]++;
+                    sortedKeys[position] = keys[i];
+                    sortedValues[position] = values[i];
+                }
+            }
+            keys.swap(sortedKeys);
+            values.swap(sortedValues);
+        }
+    }
+
+    /**
+     * @brief Find the range of sorted primitives and the children of every interior node of the
+     * linear build in parallel. Interior node i covers a range that has i at one end and is split
+     * where the highest differing bit of the codes in the range changes.
+     * 
+     * @param codes sorted Morton codes
+     * @param linearNodes nodes of the linear build
+     */
+    static void LinearTopology(const std::vector<uint32_t>& codes, std::vector<LinearNode>& linearNodes) {
+        int n = codes.size();
+        #pragma omp parallel for
+        for(int i = 0; i < n; i++) {
+            LinearNode& leaf = linearNodes[n - 1 + i];
+            leaf.first = i;
+            leaf.count = 1;
+        }
+
+        #pragma omp parallel for
+        for(int i = 0; i < n - 1; i++) {
+            //The range extends towards the neighbour sharing the longer prefix with i
+            int direction = CommonPrefix(codes, i, i + 1) > CommonPrefix(codes, i, i - 1) ? 1 : -1;
+            int minPrefix = CommonPrefix(codes, i, i - direction);
+
+            //Find the other end of the range with an exponential and a binary search
+            int maxLength = 2;
+            while(CommonPrefix(codes, i, i + maxLength*direction) > minPrefix) {
+                maxLength *= 2;
+            }
+            int length = 0;
+            for(int step = maxLength / 2; step >= 1; step /= 2) {
+                if(CommonPrefix(codes, i, i + (length + step)*direction) > minPrefix) length += step;
+            }
+            int j = i + length*direction;
+
+            //Find the last position from i that shares more than the prefix of the whole range
+            int nodePrefix = CommonPrefix(codes, i, j);
+            int split = 0;
+            int step = length;
+            do {
+                step = (step + 1) / 2;
+                if(CommonPrefix(codes, i, i + (split + step)*direction) > nodePrefix) split += step;
+            } while(step > 1);
+            int gamma = i + split*direction + std::min(direction, 0);
+
+            LinearNode& node = linearNodes[i];
+            node.first = std::min(i, j);
+            node.count = length + 1;
+            node.left = node.first == gamma ? n - 1 + gamma : gamma;
+            node.right = std::max(i, j) == gamma + 1 ? n - 1 + gamma + 1 : gamma + 1;
+            linearNodes[node.left].parent = i;
+            linearNodes[node.right].parent = i;
+        }
+    }
+
+    /**
+     * @brief Compute the bounds and SAH costs of the nodes of the linear build bottom-up in
+     * parallel. A thread starts from every leaf and walks towards the root, and the second thread
+     * to reach a node merges its children while the first one stops.
+     * 
+     * @param linearNodes nodes of the linear build
+     */
+    void LinearBounds(std::vector<LinearNode>& linearNodes) {
+        int n = boxes.size();
+        std::vector<int> arrivals(n - 1);
+        #pragma omp parallel for
+        for(int i = 0; i < n; i++) {
+            LinearNode& leaf = linearNodes[n - 1 + i];
+            leaf.box = boxes[primIdx[i]];
+            leaf.cost = IntersectionCost(settings, 1) * leaf.box.area();
+            leaf.leaf = true;
+
+            int nodeIdx = leaf.parent;
+            while(nodeIdx >= 0) {
+                int arrived;
+                #pragma omp flush
+                #pragma omp atomic capture
+                arrived = arrivals[nodeIdx]++;
+                if(arrived == 0) break;
+                #pragma omp flush
+
+                LinearNode& node = linearNodes[nodeIdx];
+                const LinearNode& left = linearNodes[node.left];
+                const LinearNode& right = linearNodes[node.right];
+                node.box = left.box;
+                node.box.grow(right.box);
+                double area = node.box.area();
+                float splitCost = settings.traversalCost * area + left.cost + right.cost;
+                float leafCost = IntersectionCost(settings, node.count) * area;
+                node.leaf = node.count <= settings.maxLeafSize && leafCost <= splitCost;
+                node.cost = node.leaf ? leafCost : splitCost;
+                nodeIdx = node.parent;
+            }
+        }
+    }
+
+    /**
+     * @brief Length of the common prefix of two sorted Morton codes. Equal codes are told apart
+     * by their positions, so every pair of positions has a different prefix.
+     * 
+     * @param codes sorted Morton codes
+     * @param i first position
+     * @param j second position
+     * @return int -1 if the second position is outside the codes
+     */
+    static int CommonPrefix(const std::vector<uint32_t>& codes, int i, int j) {
+        if(j < 0 || j >= (int)codes.size()) return -1;
+        if(codes[i] == codes[j]) return 32 + LeadingZeros(i ^ j);
+        return LeadingZeros(codes[i] ^ codes[j]);
+    }
+
+    /**
+     * @brief Number of zero bits above the highest set bit of a non-zero number
+     * 
+     * @param bits the number
+     * @return int 
+     */
+    static int LeadingZeros(uint32_t bits) {
+#if defined(__GNUC__)
+        return __builtin_clz(bits);
+#else
+        int zeros = 0;
+        while(!(bits & 0x80000000u)) {
+            bits <<= 1;
+            zeros++;
+        }
+        return zeros;
+#endif
+    }
+
+    /**
+     * @brief Copies the subtree of a node of the linear build into the compact node vector in
+     * depth-first order. Collapsed subtrees and subtrees at the maximum depth become leaves.
+     * 
+     * @param linearNodes nodes of the linear build
+     * @param linearIdx index of the node of the linear build
+     * @param depth depth of the node
+     * @return int index of the copied node
+     */
+    int FlattenLinear(const std::vector<LinearNode>& linearNodes, int linearIdx, int depth = 0) {
+        const LinearNode& linearNode = linearNodes[linearIdx];
+        int nodeIdx = nodes->size();
+        nodes->push_back(Node());
+        (*nodes)[nodeIdx].setBounds(linearNode.box);
+        if(linearNode.leaf || depth >= maxDepth - 1) {
+            (*nodes)[nodeIdx].leftFirst = linearNode.first;
+            (*nodes)[nodeIdx].triCount = linearNode.count;
+        }else {
+            FlattenLinear(linearNodes, linearNode.left, depth + 1);
+            int rightChildIdx = FlattenLinear(linearNodes, linearNode.right, depth + 1);
+            (*nodes)[nodeIdx].leftFirst = rightChildIdx;
+            (*nodes)[nodeIdx].triCount = 0;
+        }
+        return nodeIdx;
+    }
+
+    /**
+     * @brief Bounds of the centers of the reference boxes
+     * 
+     * @param refs references
+     * @return AABB 
+     */
+    static AABB CentroidBounds(const std::vector<Reference>& refs) {
+        AABB bounds;
+        for(const Reference& ref : refs) {
+            bounds.grow(Vector((ref.box.min + ref.box.max) / 2));
+        }
+        return bounds;
+    }
+
+    /**
+     * @brief Object split bin of a reference along an axis
+     * 
+     * @param ref the reference
+     * @param axis the axis
+     * @param boundsMin minimum of the centroid bounds on the axis
+     * @param scale number of bins per unit length
+     * @return int 
+     */
+    int Bin(const Reference& ref, int axis, double boundsMin, double scale) const {
+        double center = (ref.box.min(axis) + ref.box.max(axis)) / 2;
+        return std::min(settings.bins - 1, (int)((center - boundsMin) * scale));
+    }
+
+    /**
+     * @brief Surface area of the intersection of two boxes
+     * 
+     * @param a first box
+     * @param b second box
+     * @return double zero if the boxes do not intersect
+     */
+    static double OverlapArea(const AABB& a, const AABB& b) {
+        AABB overlap;
+        overlap.min = a.min.cwiseMax(b.min);
+        overlap.max = a.max.cwiseMin(b.max);
+        if(IsEmpty(overlap)) return 0;
+        return overlap.area();
+    }
+
+    /**
+     * @brief Check whether a box is empty on any axis
+     * 
+     * @param box the box
+     * @return true if the box contains no points
+     */
+    static bool IsEmpty(const AABB& box) {
+        return (box.min.array() > box.max.array()).any();
+    }
+
+    /**
+     * @brief Copies the subtree of a build node into the compact node vector in depth-first order
+     * 
+     * @param bvhNodes vector containing the build nodes
+     * @param buildIdx index of the build node
+     * @return int index of the copied node
+     */
+    int Flatten(const std::vector<BuildNode>& bvhNodes, int buildIdx) {
+        const BuildNode& buildNode = bvhNodes[buildIdx];
+        int nodeIdx = nodes->size();
+        nodes->push_back(Node());
+        (*nodes)[nodeIdx].setBounds(buildNode.box);
+        if(buildNode.triCount > 0) {
+            (*nodes)[nodeIdx].leftFirst = buildNode.firstTriIdx;
+            (*nodes)[nodeIdx].triCount = buildNode.triCount;
+        }else {
+            Flatten(bvhNodes, buildNode.leftChild);
+            int rightChildIdx = Flatten(bvhNodes, buildNode.leftChild + 1);
+            (*nodes)[nodeIdx].leftFirst = rightChildIdx;
+            (*nodes)[nodeIdx].triCount = 0;
+        }
+        return nodeIdx;
+    }
+
+    /**
+     * @brief Recompute the bounds of a node and its subtree
+     * 
+     * @param bvhNodes nodes of the hierarchy in depth-first order
+     * @param primBoxes current bounding boxes of the primitives
+     * @param primIndices primitive indices referenced by the leaves
+     * @param nodeIdx index of the node
+     */
+    static void RefitNode(std::vector<Node>& bvhNodes, const std::vector<AABB>& primBoxes, const std::vector<int>& primIndices, int nodeIdx) {
+        Node& node = bvhNodes[nodeIdx];
+        if(node.isLeaf()) {
+            AABB box;
+            for(int i = 0; i < node.triCount; i++) {
+                box.grow(primBoxes[primIndices[node.leftFirst + i]]);
+            }
+            node.setBounds(box);
+            return;
+        }
+
+        //The left subtree fills the nodes between this node and the right child
+        int leftIdx = nodeIdx + 1;
+        int rightIdx = node.leftFirst;
+        bool spawnTasks = rightIdx - leftIdx > taskThreshold;
+        #pragma omp task if(spawnTasks) shared(bvhNodes, primBoxes, primIndices)
+        RefitNode(bvhNodes, primBoxes, primIndices, leftIdx);
+        RefitNode(bvhNodes, primBoxes, primIndices, rightIdx);
+        #pragma omp taskwait
+
+        //The child bounds are already rounded outwards and can be merged exactly
+        const Node& left = bvhNodes[leftIdx];
+        const Node& right = bvhNodes[rightIdx];
+        for(int axis = 0; axis < 3; axis++) {
+            node.min[axis] = std::min(left.min[axis], right.min[axis]);
+            node.max[axis] = std::max(left.max[axis], right.max[axis]);
+        }
+    }
+
+    /**
+     * @brief Number of chunks a range of primitives is split into by ForEachChunk
+     * 
+     * @param count number of primitives in the range
+     * @return int 
+     */
+    static int ChunkCount(int count) {
+        return std::max(1, (count + chunkSize - 1) / chunkSize);
+    }
+
+    /**
+     * @brief Calls the given function for consecutive chunks of a range in primIdx.
+     * 
+     * Ranges larger than one chunk are processed in parallel as OpenMP tasks.
+     * 
+     * @param first first index of the range
+     * @param count length of the range
+     * @param function called with the first index, length and number of each chunk
+     */
+    template <typename Function>
+    static void ForEachChunk(int first, int count, Function function) {
+        int chunks = ChunkCount(count);
+        if(chunks == 1) {
+            function(first, count, 0);
+            return;
+        }
+        for(int chunk = 0; chunk < chunks; chunk++) {
+            #pragma omp task firstprivate(chunk) shared(function)
+            {
+                int chunkFirst = first + chunk*chunkSize;
+                function(chunkFirst, std::min(chunkSize, first + count - chunkFirst), chunk);
+            }
+        }
+        #pragma omp taskwait
+    }
+};
@@ -0,0 +1,313 @@
+#pragma once
+
+#include "types.hpp"
+#include "meshtriangles.hpp"
+#include "bvh.hpp"
+#include <vector>
+#include <string>
+#include <memory>
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <utility>
+
+/**
+ * @brief Binary cache of the object space triangles and the built BVH of a mesh.
+ * 
+ * The cache file is stored next to the .obj file and named after the BVH build settings.
+ * Its header holds a hash of the contents of the .obj file, so a cache made from an older
+ * version of the file is detected as stale and replaced. The file is memory mapped and the
+ * triangles, the triangle index array and the flattened nodes are copied out as they are,
+ * without parsing the .obj file or building the tree.
+ */
+class BVHCache
+{
+public:
+    /**
+     * @brief Load the BVH of a mesh from its cache file
+     * 
+     * @param obj_filepath filepath of the .obj file
+     * @param settings settings the BVH should be built with
+     * @return std::shared_ptr<BVH> the cached BVH, or nullptr if there is no valid cache file
+     */
+    static std::shared_ptr<BVH> Load(const std::string& obj_filepath, BVHSettings settings) {
+        uint64_t contentHash;
+        if(!HashFile(obj_filepath, contentHash)) return nullptr;
+
+        int fd = open(CachePath(obj_filepath, settings).c_str(), O_RDONLY);
+        if(fd < 0) return nullptr;
+        struct stat buf;
+        if(fstat(fd, &buf) != 0 || buf.st_size < (off_t)sizeof(Header)) {
+            close(fd);
+            return nullptr;
+        }
+        size_t size = buf.st_size;
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(mapped == MAP_FAILED) return nullptr;
+
+        //Check that the cache was made from the same file with the same settings
+        const char* data = static_cast<const char*>(mapped);
+        Header header;
+        std::memcpy(&header, data, sizeof(Header));
+        bool valid = std::memcmp(header.magic, magic, sizeof(header.magic)) == 0
+                  && header.version == version
+                  && header.contentHash == contentHash
+                  && header.settingsHash == SettingsHash(settings)
+                  && header.nodeSize == sizeof(Node)
+                  && size == FileSize(header.vertexCount, header.triangleCount, header.indexCount, header.nodeCount);
+
+        std::shared_ptr<BVH> bvh;
+        if(valid) {
+            const char* section = data + sizeof(Header);
+            std::vector<float> coordinates[3];
+            for(int axis = 0; axis < 3; axis++) {
+                coordinates[axis].resize(header.vertexCount);
+                std::memcpy(coordinates[axis].data(), section, header.vertexCount*sizeof(float));
+                section += header.vertexCount*sizeof(float);
+            }
+
+            std::vector<int> vertexIdx(3*(size_t)header.triangleCount);
+            std::memcpy(vertexIdx.data(), section, vertexIdx.size()*sizeof(int));
+            section += vertexIdx.size()*sizeof(int);
+
+            std::vector<int> triIdx(header.indexCount);
+            std::memcpy(triIdx.data(), section, triIdx.size()*sizeof(int));
+            section += triIdx.size()*sizeof(int);
+
+            std::vector<Node> nodes(header.nodeCount);
+            std::memcpy(nodes.data(), section, nodes.size()*sizeof(Node));
+
+            //The hashes cover only the .obj file and the settings, so check that a damaged or
+            //edited cache cannot make the traversal read out of bounds
+            if(!ValidIndices(header, vertexIdx, triIdx, nodes)) {
+                munmap(mapped, size);
+                return nullptr;
+            }
+
+            MeshTriangles triangles(std::move(coordinates[0]), std::move(coordinates[1]), std::move(coordinates[2]), std::move(vertexIdx));
+            bvh = std::make_shared<BVH>(std::move(triangles), std::move(triIdx), std::move(nodes), settings);
+        }
+
+        munmap(mapped, size);
+        return bvh;
+    }
+
+    /**
+     * @brief Write the BVH of a mesh into its cache file, replacing a stale one
+     * 
+     * @param obj_filepath filepath of the .obj file
+     * @param bvh BVH built from the .obj file
+     * @return true if the cache file was written
+     */
+    static bool Store(const std::string& obj_filepath, const BVH& bvh) {
+        Header header = {};
+        std::memcpy(header.magic, magic, sizeof(header.magic));
+        header.version = version;
+        if(!HashFile(obj_filepath, header.contentHash)) return false;
+        header.settingsHash = SettingsHash(bvh.getSettings());
+        const MeshTriangles& triangles = bvh.getTriangles();
+        header.vertexCount = triangles.getVertexCount();
+        header.triangleCount = triangles.getTriangleCount();
+        header.nodeCount = bvh.getNodeCount();
+        header.nodeSize = sizeof(Node);
+        header.indexCount = bvh.getTriangleIndices().size();
+
+        //Write into a temporary file first, so that a cache is never read half written. The name
+        //of the temporary file is unique, so writers storing the same cache at once never share it
+        std::string path = CachePath(obj_filepath, bvh.getSettings());
+        std::vector<char> tmpName(path.begin(), path.end());
+        const char suffix[] = ".tmp.XXXXXX";
+        tmpName.insert(tmpName.end(), suffix, suffix + sizeof(suffix));
+        int fd = mkstemp(tmpName.data());
+        if(fd < 0) return false;
+        fchmod(fd, 0644);
+        close(fd);
+        std::string tmpPath(tmpName.data());
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        if(!out) {
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+        out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+        for(int axis = 0; axis < 3; axis++) {
+            out.write(reinterpret_cast<const char*>(triangles.getCoordinates(axis).data()), header.vertexCount*sizeof(float));
+        }
+        out.write(reinterpret_cast<const char*>(triangles.getIndices().data()), 3*(size_t)header.triangleCount*sizeof(int));
+        out.write(reinterpret_cast<const char*>(bvh.getTriangleIndices().data()), header.indexCount*sizeof(int));
+        out.write(reinterpret_cast<const char*>(bvh.getNodes().data()), header.nodeCount*sizeof(Node));
+        out.close();
+        if(!out || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Get the filepath of the cache file of a mesh
+     * 
+     * @param obj_filepath filepath of the .obj file
+     * @param settings settings the BVH is built with
+     * @return std::string
+     */
+    static std::string CachePath(const std::string& obj_filepath, BVHSettings settings) {
+        char hash[17];
+        std::snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)SettingsHash(settings));
+        return obj_filepath + "." + hash + ".bvhcache";
+    }
+
+private:
+    static constexpr char magic[8] = { 'P', 'T', 'B', 'V', 'H', 'C', 'A', 'C' };
+    static constexpr uint32_t version = 3;
+
+    /**
+     * @brief Header at the start of a cache file, followed by the x, y and z coordinate arrays of
+     * the vertices, the three vertex indices of each triangle, the triangle index array and the nodes
+     * 
+     */
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t vertexCount;
+        uint32_t triangleCount;
+        uint32_t nodeCount;
+        uint64_t contentHash;   /* Hash of the contents of the .obj file */
+        uint64_t settingsHash;  /* Hash of the settings that change the built tree */
+        uint32_t nodeSize;
+        uint32_t indexCount;    /* Length of the triangle index array, larger than the triangle count with spatial splits */
+    };
+
+    /**
+     * @brief Size of a valid cache file
+     * 
+     * @param vertexCount number of vertices
+     * @param triangleCount number of triangles
+     * @param indexCount length of the triangle index array
+     * @param nodeCount number of nodes
+     * @return size_t
+     */
+    static size_t FileSize(size_t vertexCount, size_t triangleCount, size_t indexCount, size_t nodeCount) {
+        return sizeof(Header) + vertexCount*3*sizeof(float) + triangleCount*3*sizeof(int) + indexCount*sizeof(int) + nodeCount*sizeof(Node);
+    }
+
+    /**
+     * @brief Check that every index of a loaded cache points inside its array: the vertex indices
+     * of the triangles below the vertex count, the triangle indices below the triangle count, and
+     * the nodes forming a depth-first tree no deeper than the traversal stacks, whose leaves
+     * reference ranges of the triangle index array
+     * 
+     * @param header header of the cache file
+     * @param vertexIdx the three vertex indices of each triangle
+     * @param triIdx the triangle index array
+     * @param nodes the nodes
+     * @return true if the indices are valid
+     */
+    static bool ValidIndices(const Header& header, const std::vector<int>& vertexIdx, const std::vector<int>& triIdx, const std::vector<Node>& nodes) {
+        for(int v : vertexIdx) {
+            if(v < 0 || (uint32_t)v >= header.vertexCount) return false;
+        }
+        for(int t : triIdx) {
+            if(t < 0 || (uint32_t)t >= header.triangleCount) return false;
+        }
+        if(nodes.empty()) return triIdx.empty();
+
+        //Walk the tree from the root. The left child of a node is the next node and the right
+        //child comes after the left subtree, so every node is reached once in a valid tree
+        long long count = nodes.size();
+        long long visited = 0;
+        std::vector<std::pair<long long, int>> stack = { { 0, 1 } };
+        while(!stack.empty()) {
+            auto [index, depth] = stack.back();
+            stack.pop_back();
+            if(++visited > count || depth > BVHBuilder::maxDepth) return false;
+            const Node& node = nodes[index];
+            if(node.triCount < 0) return false;
+            if(node.isLeaf()) {
+                if(node.leftFirst < 0 || (long long)node.leftFirst + node.triCount > (long long)triIdx.size()) return false;
+            }else {
+                if(node.leftFirst <= index + 1 || node.leftFirst >= count) return false;
+                stack.push_back({ node.leftFirst, depth + 1 });
+                stack.push_back({ index + 1, depth + 1 });
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief Continue an FNV-1a hash over the given bytes
+     * 
+     * @param hash hash of the preceding bytes
+     * @param data bytes to be hashed
+     * @param size number of bytes
+     * @return uint64_t
+     */
+    static uint64_t Hash(uint64_t hash, const void* data, size_t size) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for(size_t i = 0; i < size; i++) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    /**
+     * @brief Hash the settings that change the built tree. The layout is left out, since the
+     * 4-wide tree is collapsed from the binary one after loading. The triangle group width is
+     * included, since the leaves are sized and aligned for it.
+     * 
+     * @param settings settings the BVH is built with
+     * @return uint64_t
+     */
+    static uint64_t SettingsHash(BVHSettings settings) {
+        uint64_t hash = 14695981039346656037ull;
+        int mode = (int)settings.mode;
+        hash = Hash(hash, &mode, sizeof(mode));
+        hash = Hash(hash, &settings.traversalCost, sizeof(settings.traversalCost));
+        hash = Hash(hash, &settings.intersectionCost, sizeof(settings.intersectionCost));
+        hash = Hash(hash, &settings.bins, sizeof(settings.bins));
+        hash = Hash(hash, &settings.maxLeafSize, sizeof(settings.maxLeafSize));
+        int width = TriangleGroup::width;
+        hash = Hash(hash, &width, sizeof(width));
+        if(settings.mode == BVHBuildMode::Spatial) {
+            hash = Hash(hash, &settings.splitBudget, sizeof(settings.splitBudget));
+        }
+        return hash;
+    }
+
+    /**
+     * @brief Hash the contents of a file
+     * 
+     * @param filepath filepath of the file
+     * @param hash set to the hash of the contents
+     * @return true if the file could be read
+     */
+    static bool HashFile(const std::string& filepath, uint64_t& hash) {
+        int fd = open(filepath.c_str(), O_RDONLY);
+        if(fd < 0) return false;
+        struct stat buf;
+        if(fstat(fd, &buf) != 0) {
+            close(fd);
+            return false;
+        }
+        hash = 14695981039346656037ull;
+        if(buf.st_size > 0) {
+            void* mapped = mmap(nullptr, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(mapped == MAP_FAILED) {
+                close(fd);
+                return false;
+            }
+            hash = Hash(hash, mapped, buf.st_size);
+            munmap(mapped, buf.st_size);
+        }
+        close(fd);
+        return true;
+    }
+};
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "bvhbuilder.hpp"
+#include <vector>
+#include <string>
+#include <iostream>
+#include <algorithm>
+
+/**
+ * @brief Quality and size of a built hierarchy, for finding meshes that are slow to trace.
+ * 
+ * The histograms count leaves: depthHistogram[d] is the number of leaves at depth d, the root
+ * being at depth zero, and leafSizeHistogram[n] the number of leaves with n primitives.
+ */
+struct BVHStats
+{
+    int nodeCount = 0;
+    int leafCount = 0;
+    int primitiveCount = 0;         /* Primitives the hierarchy was built over */
+    int referenceCount = 0;         /* Primitive references in the leaves */
+    float sahCost = 0;
+    int maxDepth = 0;
+    float averageLeafDepth = 0;
+    float averageLeafSize = 0;
+    std::vector<int> depthHistogram;
+    std::vector<int> leafSizeHistogram;
+    size_t nodeMemory = 0;          /* Bytes taken by the nodes and the primitive index array */
+    size_t primitiveMemory = 0;     /* Bytes taken by the primitives and their precomputed data */
+    float objectSplitSAHCost = -1;  /* SAH cost of the tree built without spatial splits, negative if not computed */
+
+    /**
+     * @brief Compute the statistics of the shape of a hierarchy. The counts of primitives and
+     * the memory are left for the owner of the hierarchy to fill in.
+     * 
+     * @param nodes nodes of the hierarchy in depth-first order
+     * @param settings settings containing the SAH cost constants
+     * @return BVHStats
+     */
+    static BVHStats Compute(const std::vector<Node>& nodes, const BVHSettings& settings) {
+        BVHStats stats;
+        stats.nodeCount = nodes.size();
+        stats.sahCost = BVHBuilder::SAHCost(nodes, settings);
+        if(nodes.empty()) return stats;
+
+        //Walk the tree to find the depth of every leaf
+        struct Entry { int nodeIdx, depth; };
+        std::vector<Entry> stack = { { 0, 0 } };
+        long depthSum = 0;
+        while(!stack.empty()) {
+            Entry entry = stack.back();
+            stack.pop_back();
+            const Node& node = nodes[entry.nodeIdx];
+            if(!node.isLeaf()) {
+                stack.push_back({ node.leftFirst, entry.depth + 1 });
+                stack.push_back({ entry.nodeIdx + 1, entry.depth + 1 });
+                continue;
+            }
+            stats.leafCount++;
+            stats.referenceCount += node.triCount;
+            stats.maxDepth = std::max(stats.maxDepth, entry.depth);
+            depthSum += entry.depth;
+            Increment(stats.depthHistogram, entry.depth);
+            Increment(stats.leafSizeHistogram, node.triCount);
+        }
+        stats.averageLeafDepth = (float)depthSum / stats.leafCount;
+        stats.averageLeafSize = (float)stats.referenceCount / stats.leafCount;
+        return stats;
+    }
+
+    /**
+     * @brief Print the statistics in a few lines of text
+     * 
+     * @param out output stream
+     */
+    void Print(std::ostream& out) const {
+        out << "BVH quality: SAH cost " << sahCost << ", " << nodeCount << " nodes, " << leafCount << " leaves, depth "
+            << averageLeafDepth << " on average and " << maxDepth << " at most, " << averageLeafSize
+            << " primitives per leaf on average." << std::endl;
+        out << "Leaves by size:";
+        PrintHistogram(out, leafSizeHistogram);
+        out << "Leaves by depth:";
+        PrintHistogram(out, depthHistogram);
+    }
+
+    /**
+     * @brief Write the statistics as a JSON object
+     * 
+     * @param out output stream
+     * @param name name of the hierarchy, e.g. the mesh it was built for
+     */
+    void WriteJSON(std::ostream& out, const std::string& name) const {
+        std::string escaped;
+        for(char c : name) {
+            if(c == '"' || c == '\\') escaped += '\\';
+            escaped += c;
+        }
+        out << "{\"name\": \"" << escaped << "\", \"nodes\": " << nodeCount << ", \"leaves\": " << leafCount
+            << ", \"primitives\": " << primitiveCount << ", \"references\": " << referenceCount
+            << ", \"sahCost\": " << sahCost << ", \"maxDepth\": " << maxDepth
+            << ", \"averageLeafDepth\": " << averageLeafDepth << ", \"averageLeafSize\": " << averageLeafSize
+            << ", \"nodeBytes\": " << nodeMemory << ", \"primitiveBytes\": " << primitiveMemory
+            << ", \"depthHistogram\": ";
+        WriteArray(out, depthHistogram);
+        out << ", \"leafSizeHistogram\": ";
+        WriteArray(out, leafSizeHistogram);
+        if(objectSplitSAHCost >= 0) out << ", \"objectSplitSahCost\": " << objectSplitSAHCost;
+        out << "}";
+    }
+
+private:
+    /**
+     * @brief Add one to a bin of a histogram, growing the histogram if needed
+     * 
+     * @param histogram counts of the bins
+     * @param bin index of the bin
+     */
+    static void Increment(std::vector<int>& histogram, int bin) {
+        if(bin >= (int)histogram.size()) histogram.resize(bin + 1);
+        histogram[bin]++;
+    }
+
+    /**
+     * @brief Print the non-empty bins of a histogram on one line
+     * 
+     * @param out output stream
+     * @param histogram counts of the bins
+     */
+    static void PrintHistogram(std::ostream& out, const std::vector<int>& histogram) {
+        for(size_t bin = 0; bin < histogram.size(); bin++) {
+            if(histogram[bin] > 0) out << " " << bin << ": " << histogram[bin];
+        }
+        out << std::endl;
+    }
+
+    /**
+     * @brief Write integers as a JSON array
+     * 
+     * @param out output stream
+     * @param values integers to write
+     */
+    static void WriteArray(std::ostream& out, const std::vector<int>& values) {
+        out << "[";
+        for(size_t i = 0; i < values.size(); i++) {
+            out << (i > 0 ? ", " : "") << values[i];
+        }
+        out << "]";
+    }
+};
@@ -0,0 +1,288 @@
+#pragma once
+
+#include "types.hpp"
+#include "bvh.hpp"
+#include "bvh4.hpp"
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+/**
+ * @brief Struct representing a node in the compressed 4-wide bounding volume hierarchy
+ * 
+ * The boxes of the children are stored as 8-bit offsets on a grid spanning the box of the
+ * node. The grid spacing is a power of two on each axis, so the offsets dequantize exactly,
+ * and the offsets are rounded outwards so that the dequantized boxes always contain the
+ * exact ones. A node takes one cache line, half of a Node4.
+ */
+struct alignas(64) CompressedNode4
+{
+    float origin[3];        /* Minimum corner of the node box, the origin of the grid */
+    int8_t exponent[3];     /* The grid spacing on each axis is 2^exponent */
+    uint8_t childCount;
+    uint8_t qmin[3][4];     /* Minimum corners of the child boxes in grid units, per axis */
+    uint8_t qmax[3][4];     /* Maximum corners of the child boxes in grid units, per axis */
+    int child[4];           /* Index of an interior child node, first triangle index of a leaf child */
+    uint16_t triCount[4];   /* Number of triangles in a leaf child, zero for interior children */
+
+    /**
+     * @brief Calculate the distances at which a given ray enters the four children
+     * 
+     * @param invRay ray whose collision will be checked
+     * @param smallestDistance current smallest distance
+     * @param distances set to the entry distance of each child
+     * @return int bit mask of the children that the ray enters before the smallest distance
+     */
+    int Intersect(const InvRay& invRay, float smallestDistance, float distances[4]) const {
+        Node4 boxes;
+        float* mins[3] = { boxes.minX, boxes.minY, boxes.minZ };
+        float* maxs[3] = { boxes.maxX, boxes.maxY, boxes.maxZ };
+        for(int axis = 0; axis < 3; axis++) {
+            float scale = std::ldexp(1.0f, exponent[axis]);
+#ifdef BVH4_SIMD
+            const __m128i zero = _mm_setzero_si128();
+            const __m128 originAxis = _mm_set1_ps(origin[axis]);
+            const __m128 scaleAxis = _mm_set1_ps(scale);
+            int packedMin, packedMax;
+            std::memcpy(&packedMin, qmin[axis], sizeof(int));
+            std::memcpy(&packedMax, qmax[axis], sizeof(int));
+            __m128i wideMin = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packedMin), zero), zero);
+            __m128i wideMax = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packedMax), zero), zero);
+            _mm_store_ps(mins[axis], _mm_add_ps(originAxis, _mm_mul_ps(_mm_cvtepi32_ps(wideMin), scaleAxis)));
+            _mm_store_ps(maxs[axis], _mm_add_ps(originAxis, _mm_mul_ps(_mm_cvtepi32_ps(wideMax), scaleAxis)));
+#else
+            for(int slot = 0; slot < 4; slot++) {
+                mins[axis][slot] = Dequantize(origin[axis], qmin[axis][slot], scale);
+                maxs[axis][slot] = Dequantize(origin[axis], qmax[axis][slot], scale);
+            }
+#endif
+        }
+        return boxes.Intersect(invRay, smallestDistance, distances) & ((1 << childCount) - 1);
+    }
+
+    /**
+     * @brief Position of a grid point. The product is exact, so the result is rounded only once
+     * however the expression is evaluated.
+     * 
+     * @param origin origin of the grid
+     * @param q grid coordinate
+     * @param scale grid spacing
+     * @return float
+     */
+    static float Dequantize(float origin, int q, float scale) {
+        return origin + q * scale;
+    }
+};
+
+/**
+ * @brief Compressed 4-wide bounding volume hierarchy with quantized child boxes.
+ * 
+ * Has the same structure as the BVH4 it is created from, but its nodes take half the memory.
+ * The child boxes are dequantized conservatively during the traversal, so they can be
+ * slightly larger than the exact ones.
+ */
+class CompressedBVH4
+{
+public:
+    /**
+     * @brief Construct a new CompressedBVH4 object by collapsing and quantizing a binary BVH
+     * 
+     * @param binaryBVH the BVH to be compressed
+     */
+    CompressedBVH4(std::shared_ptr<BVH> binaryBVH) : bvh(binaryBVH) {
+        BVH4 wide(bvh);
+        if(wide.getNodes().empty()) return;
+        nodes.reserve(wide.getNodes().size());
+        Compress(wide.getNodes(), 0);
+    }
+
+    /**
+     * @brief Calculate whether a given ray collides with the TriangleMesh contained in the hierarchy
+     * 
+     * @param ray ray whose collision will be checked
+     * @param rayHit address of a Hit data structure
+     * @param smallestDistance current smallest distance
+     */
+    void CompressedBVH4Collision(Ray& ray, Hit& rayHit, float& smallestDistance) const {
+        InvRay invRay(ray);
+        TriangleHit closest;
+        BVH4::Traverse(nodes, ray, invRay, smallestDistance, [&](int first, int count) {
+            bvh->LeafCollision(first, count, invRay, closest, smallestDistance);
+            return false;
+        });
+        bvh->ResolveHit(closest, ray, rayHit, smallestDistance);
+    }
+
+    /**
+     * @brief Calculate whether a given ray hits any triangle of the hierarchy before the given
+     * distance. The traversal ends at the first hit found.
+     * 
+     * @param ray ray whose collision will be checked
+     * @param maxDistance distance along the ray up to which hits are counted
+     * @return true if the ray hits a triangle between its origin and the given distance
+     */
+    bool CompressedBVH4Occluded(const Ray& ray, float maxDistance) const {
+        InvRay invRay(ray);
+        bool occluded = false;
+        BVH4::Traverse(nodes, ray, invRay, maxDistance, [&](int first, int count) {
+            occluded = bvh->LeafOccluded(first, count, invRay, maxDistance);
+            return occluded;
+        });
+        return occluded;
+    }
+
+    /**
+     * @brief Get the nodes vector
+     * 
+     * @return const std::vector<CompressedNode4>&
+     */
+    const std::vector<CompressedNode4>& getNodes() const {
+        return nodes;
+    }
+
+    /**
+     * @brief Get the memory taken by the nodes
+     * 
+     * @return size_t bytes
+     */
+    size_t getMemoryUsage() const {
+        return nodes.size() * sizeof(CompressedNode4);
+    }
+
+private:
+    static constexpr int maxLeafCount = UINT16_MAX;     /* Larger leaves are spread over extra nodes */
+
+    std::shared_ptr<BVH> bvh;
+    std::vector<CompressedNode4> nodes;
+
+    /**
+     * @brief Child of a compressed node before quantization
+     * 
+     */
+    struct Child
+    {
+        float min[3], max[3];
+        int index;          /* Index of the BVH4 node, or first triangle index of a leaf */
+        int triCount;
+    };
+
+    /**
+     * @brief Creates the compressed node of a BVH4 node and its descendants recursively
+     * 
+     * @param wideNodes nodes of the BVH4
+     * @param wideIdx index of the BVH4 node
+     * @return int index of the created node
+     */
+    int Compress(const std::vector<Node4>& wideNodes, int wideIdx) {
+        const Node4& wide = wideNodes[wideIdx];
+        std::vector<Child> children;
+        for(int slot = 0; slot < 4; slot++) {
+            if(wide.minX[slot] > wide.maxX[slot]) continue;
+            children.push_back({ { wide.minX[slot], wide.minY[slot], wide.minZ[slot] },
+                                 { wide.maxX[slot], wide.maxY[slot], wide.maxZ[slot] },
+                                 wide.child[slot], wide.triCount[slot] });
+        }
+        return AddNode(wideNodes, children);
+    }
+
+    /**
+     * @brief Quantizes the given children into a new node and creates the nodes of the interior
+     * children recursively. Leaves with too many triangles for a slot are split over a new node.
+     * 
+     * @param wideNodes nodes of the BVH4
+     * @param children children of the node
+     * @return int index of the created node
+     */
+    int AddNode(const std::vector<Node4>& wideNodes, const std::vector<Child>& children) {
+        int nodeIdx = nodes.size();
+        nodes.push_back(CompressedNode4());
+        Quantize(nodes[nodeIdx], children);
+
+        for(size_t slot = 0; slot < children.size(); slot++) {
+            const Child& child = children[slot];
+            int childIdx = 0;
+            int triCount = 0;
+            if(child.triCount == 0) {
+                childIdx = Compress(wideNodes, child.index);
+            }else if(child.triCount > maxLeafCount) {
+                std::vector<Child> parts;
+                int partSize = (child.triCount + 3) / 4;
+                for(int first = 0; first < child.triCount; first += partSize) {
+                    Child part = child;
+                    part.index = child.index + first;
+                    part.triCount = std::min(partSize, child.triCount - first);
+                    parts.push_back(part);
+                }
+                childIdx = AddNode(wideNodes, parts);
+            }else {
+                childIdx = child.index;
+                triCount = child.triCount;
+            }
+            nodes[nodeIdx].child[slot] = childIdx;
+            nodes[nodeIdx].triCount[slot] = triCount;
+        }
+        return nodeIdx;
+    }
+
+    /**
+     * @brief Set the grid of a node and the quantized boxes of its children
+     * 
+     * @param node the node
+     * @param children children of the node
+     */
+    static void Quantize(CompressedNode4& node, const std::vector<Child>& children) {
+        node.childCount = children.size();
+        for(int axis = 0; axis < 3; axis++) {
+            float min = 1e30f, max = -1e30f;
+            for(const Child& child : children) {
+                min = std::min(min, child.min[axis]);
+                max = std::max(max, child.max[axis]);
+            }
+            node.origin[axis] = min;
+
+            //Smallest power of two spacing with which 255 steps cover the node
+            int exponent = max > min ? (int)std::ceil(std::log2((max - min) / 255.0)) : -126;
+            exponent = std::max(exponent, -126);
+            while(!QuantizeAxis(node, children, axis, exponent)) exponent++;
+        }
+
+        //Unused slots get an inverted box
+        for(int slot = children.size(); slot < 4; slot++) {
+            for(int axis = 0; axis < 3; axis++) {
+                node.qmin[axis][slot] = 255;
+                node.qmax[axis][slot] = 0;
+            }
+            node.child[slot] = 0;
+            node.triCount[slot] = 0;
+        }
+    }
+
+    /**
+     * @brief Quantize the child boxes on one axis with the given grid spacing, rounding outwards
+     * 
+     * @param node the node
+     * @param children children of the node
+     * @param axis the axis
+     * @param exponent the grid spacing is 2^exponent
+     * @return true if the boxes fit in the grid
+     */
+    static bool QuantizeAxis(CompressedNode4& node, const std::vector<Child>& children, int axis, int exponent) {
+        float origin = node.origin[axis];
+        float scale = std::ldexp(1.0f, exponent);
+        node.exponent[axis] = exponent;
+        for(size_t slot = 0; slot < children.size(); slot++) {
+            const Child& child = children[slot];
+            int qmin = std::clamp((int)std::floor((child.min[axis] - origin) / scale), 0, 255);
+            while(qmin > 0 && CompressedNode4::Dequantize(origin, qmin, scale) > child.min[axis]) qmin--;
+            int qmax = std::clamp((int)std::ceil((child.max[axis] - origin) / scale), 0, 255);
+            while(qmax < 255 && CompressedNode4::Dequantize(origin, qmax, scale) < child.max[axis]) qmax++;
+            if(CompressedNode4::Dequantize(origin, qmax, scale) < child.max[axis]) return false;
+            node.qmin[axis][slot] = qmin;
+            node.qmax[axis][slot] = qmax;
+        }
+        return true;
+    }
+};
@@ -0,0 +1,460 @@
+#pragma once
+
+#include "types.hpp"
+#include <vector>
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define TRIANGLE_GROUP_AVX
+#elif defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#define TRIANGLE_GROUP_SSE
+#endif
+
+/**
+ * @brief Precomputed affine transform of a triangle into a space where it is the unit triangle
+ * (Baldwin and Weber, "Fast Ray-Triangle Intersections by Coordinate Transformation", 2016).
+ * 
+ * The third row maps a point to its signed distance from the plane of the triangle, scaled so
+ * that the ray distance is found with one division, and the first two rows map the point on the
+ * plane to its barycentric coordinates. A test costs three dot products and a division instead
+ * of the cross products of Möller-Trumbore, at the cost of twelve floats per triangle.
+ */
+struct alignas(16) TriangleTransform
+{
+    float row[3][4];
+
+    /**
+     * @brief Calculate where a ray crosses the triangle
+     * 
+     * @param origin origin of the ray
+     * @param direction direction of the ray
+     * @param maxDistance distance along the ray up to which hits are counted
+     * @param t set to the distance along the ray
+     * @param u set to the barycentric coordinate of the second vertex
+     * @param v set to the barycentric coordinate of the third vertex
+     * @return true if the ray crosses the triangle between its origin and the given distance
+     */
+    bool Intersect(const float origin[3], const float direction[3], float maxDistance, float& t, float& u, float& v) const {
+        float planeDirection = row[2][0]*direction[0] + row[2][1]*direction[1] + row[2][2]*direction[2];
+        float planeOrigin = row[2][0]*origin[0] + row[2][1]*origin[1] + row[2][2]*origin[2] + row[2][3];
+        float distance = -planeOrigin / planeDirection;
+        if(!(distance > 0 && distance < maxDistance)) return false;
+
+        float point[3] = { origin[0] + distance*direction[0], origin[1] + distance*direction[1], origin[2] + distance*direction[2] };
+        float b1 = row[0][0]*point[0] + row[0][1]*point[1] + row[0][2]*point[2] + row[0][3];
+        if(b1 < 0) return false;
+        float b2 = row[1][0]*point[0] + row[1][1]*point[1] + row[1][2]*point[2] + row[1][3];
+        if(b2 < 0 || b1 + b2 > 1) return false;
+
+        t = distance;
+        u = b1;
+        v = b2;
+        return true;
+    }
+};
+
+/**
+ * @brief Intersection transforms of a group of triangles stored coefficient by coefficient, so
+ * that a ray is tested against all the triangles of the group at once with SIMD instructions.
+ * 
+ * A group holds eight triangles when compiled with AVX and four otherwise. The tests give the
+ * same results as TriangleTransform::Intersect run on each triangle in turn.
+ */
+struct alignas(32) TriangleGroup
+{
+#ifdef TRIANGLE_GROUP_AVX
+    static constexpr int width = 8;
+#else
+    static constexpr int width = 4;
+#endif
+
+    float row[3][4][width];     /* Coefficient of the transform of each triangle in the group */
+
+    /**
+     * @brief Store the transform of a triangle in the group
+     * 
+     * @param lane position of the triangle in the group
+     * @param transform transform of the triangle
+     */
+    void set(int lane, const TriangleTransform& transform) {
+        for(int i = 0; i < 3; i++) {
+            for(int j = 0; j < 4; j++) {
+                row[i][j][lane] = transform.row[i][j];
+            }
+        }
+    }
+
+    /**
+     * @brief Calculate where a ray crosses the closest of the given triangles of the group
+     * 
+     * @param origin origin of the ray
+     * @param direction direction of the ray
+     * @param maxDistance distance along the ray up to which hits are counted
+     * @param lanes bit mask of the triangles to test
+     * @param t set to the distance along the ray
+     * @param u set to the barycentric coordinate of the second vertex
+     * @param v set to the barycentric coordinate of the third vertex
+     * @return int position of the closest triangle hit in the group, -1 if none was hit
+     */
+    int Intersect(const float origin[3], const float direction[3], float maxDistance, int lanes, float& t, float& u, float& v) const {
+        alignas(32) float distances[width], b1[width], b2[width];
+        int hits = HitMask(origin, direction, maxDistance, lanes, distances, b1, b2);
+        if(hits == 0) return -1;
+
+        //Lowest distance of the triangles hit, the first one on ties like a sequential test
+        int closest = -1;
+        for(int lane = 0; lane < width; lane++) {
+            if((hits >> lane & 1) && (closest < 0 || distances[lane] < distances[closest])) closest = lane;
+        }
+        t = distances[closest];
+        u = b1[closest];
+        v = b2[closest];
+        return closest;
+    }
+
+    /**
+     * @brief Calculate whether a ray crosses any of the given triangles of the group
+     * 
+     * @param origin origin of the ray
+     * @param direction direction of the ray
+     * @param maxDistance distance along the ray up to which hits are counted
+     * @param lanes bit mask of the triangles to test
+     * @return true if the ray crosses a triangle between its origin and the given distance
+     */
+    bool Occluded(const float origin[3], const float direction[3], float maxDistance, int lanes) const {
+        alignas(32) float distances[width], b1[width], b2[width];
+        return HitMask(origin, direction, maxDistance, lanes, distances, b1, b2) != 0;
+    }
+
+private:
+    /**
+     * @brief Test a ray against every triangle of the group
+     * 
+     * @param origin origin of the ray
+     * @param direction direction of the ray
+     * @param maxDistance distance along the ray up to which hits are counted
+     * @param lanes bit mask of the triangles to test
+     * @param distances set to the distance along the ray of each triangle hit
+     * @param b1 set to the barycentric coordinate of the second vertex of each triangle hit
+     * @param b2 set to the barycentric coordinate of the third vertex of each triangle hit
+     * @return int bit mask of the triangles hit
+     */
+    int HitMask(const float origin[3], const float direction[3], float maxDistance, int lanes,
+                float* distances, float* b1, float* b2) const {
+#if defined(TRIANGLE_GROUP_AVX)
+        const __m256 o[3] = { _mm256_set1_ps(origin[0]), _mm256_set1_ps(origin[1]), _mm256_set1_ps(origin[2]) };
+        const __m256 d[3] = { _mm256_set1_ps(direction[0]), _mm256_set1_ps(direction[1]), _mm256_set1_ps(direction[2]) };
+        auto dot = [&](int i, const __m256 p[3]) {
+            return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(row[i][0]), p[0]), _mm256_mul_ps(_mm256_load_ps(row[i][1]), p[1])),
+                                 _mm256_mul_ps(_mm256_load_ps(row[i][2]), p[2]));
+        };
+
+        //Distance to the plane of each triangle
+        __m256 planeDirection = dot(2, d);
+        __m256 planeOrigin = _mm256_add_ps(dot(2, o), _mm256_load_ps(row[2][3]));
+        __m256 t = _mm256_div_ps(_mm256_xor_ps(planeOrigin, _mm256_set1_ps(-0.0f)), planeDirection);
+        __m256 mask = _mm256_and_ps(_mm256_cmp_ps(t, _mm256_setzero_ps(), _CMP_GT_OQ), _mm256_cmp_ps(t, _mm256_set1_ps(maxDistance), _CMP_LT_OQ));
+
+        //Barycentric coordinates of the point on the plane
+        const __m256 p[3] = { _mm256_add_ps(o[0], _mm256_mul_ps(t, d[0])), _mm256_add_ps(o[1], _mm256_mul_ps(t, d[1])),
+                              _mm256_add_ps(o[2], _mm256_mul_ps(t, d[2])) };
+        __m256 u = _mm256_add_ps(dot(0, p), _mm256_load_ps(row[0][3]));
+        __m256 v = _mm256_add_ps(dot(1, p), _mm256_load_ps(row[1][3]));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(u, _mm256_setzero_ps(), _CMP_GE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_GE_OQ));
+        mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.0f), _CMP_LE_OQ));
+        int hits = _mm256_movemask_ps(mask) & lanes;
+        if(hits != 0) {
+            _mm256_store_ps(distances, t);
+            _mm256_store_ps(b1, u);
+            _mm256_store_ps(b2, v);
+        }
+        return hits;
+#elif defined(TRIANGLE_GROUP_SSE)
+        const __m128 o[3] = { _mm_set1_ps(origin[0]), _mm_set1_ps(origin[1]), _mm_set1_ps(origin[2]) };
+        const __m128 d[3] = { _mm_set1_ps(direction[0]), _mm_set1_ps(direction[1]), _mm_set1_ps(direction[2]) };
+        auto dot = [&](int i, const __m128 p[3]) {
+            return _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(row[i][0]), p[0]), _mm_mul_ps(_mm_load_ps(row[i][1]), p[1])),
+                              _mm_mul_ps(_mm_load_ps(row[i][2]), p[2]));
+        };
+
+        //Distance to the plane of each triangle
+        __m128 planeDirection = dot(2, d);
+        __m128 planeOrigin = _mm_add_ps(dot(2, o), _mm_load_ps(row[2][3]));
+        __m128 t = _mm_div_ps(_mm_xor_ps(planeOrigin, _mm_set1_ps(-0.0f)), planeDirection);
+        __m128 mask = _mm_and_ps(_mm_cmpgt_ps(t, _mm_setzero_ps()), _mm_cmplt_ps(t, _mm_set1_ps(maxDistance)));
+
+        //Barycentric coordinates of the point on the plane
+        const __m128 p[3] = { _mm_add_ps(o[0], _mm_mul_ps(t, d[0])), _mm_add_ps(o[1], _mm_mul_ps(t, d[1])),
+                              _mm_add_ps(o[2], _mm_mul_ps(t, d[2])) };
+        __m128 u = _mm_add_ps(dot(0, p), _mm_load_ps(row[0][3]));
+        __m128 v = _mm_add_ps(dot(1, p), _mm_load_ps(row[1][3]));
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(u, _mm_setzero_ps()));
+        mask = _mm_and_ps(mask, _mm_cmpge_ps(v, _mm_setzero_ps()));
+        mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+        int hits = _mm_movemask_ps(mask) & lanes;
+        if(hits != 0) {
+            _mm_store_ps(distances, t);
+            _mm_store_ps(b1, u);
+            _mm_store_ps(b2, v);
+        }
+        return hits;
+#else
+        int hits = 0;
+        for(int lane = 0; lane < width; lane++) {
+            if(!(lanes >> lane & 1)) continue;
+            TriangleTransform transform;
+            for(int i = 0; i < 3; i++) {
+                for(int j = 0; j < 4; j++) {
+                    transform.row[i][j] = row[i][j][lane];
+                }
+            }
+            if(transform.Intersect(origin, direction, maxDistance, distances[lane], b1[lane], b2[lane])) hits |= 1 << lane;
+        }
+        return hits;
+#endif
+    }
+};
+
+/**
+ * @brief Triangles of a mesh stored as flat arrays.
+ * 
+ * The vertex positions are kept in one single precision array per coordinate and each triangle
+ * is three indices into them, so vertices shared by neighbouring triangles are stored once.
+ * Unlike Triangle, the mesh triangles are not objects: they have no material, normal or edge
+ * vectors of their own, which are given by the mesh or computed when a triangle is hit.
+ */
+class MeshTriangles
+{
+public:
+    /**
+     * @brief Default constructor for MeshTriangles, creates an empty mesh
+     * 
+     */
+    MeshTriangles() { }
+
+    /**
+     * @brief Construct a new MeshTriangles object
+     * 
+     * @param vertices positions of the vertices
+     * @param vertexIndices three vertex indices per triangle
+     */
+    MeshTriangles(const std::vector<Vector>& vertices, std::vector<int> vertexIndices) : indices(std::move(vertexIndices)) {
+        x.reserve(vertices.size());
+        y.reserve(vertices.size());
+        z.reserve(vertices.size());
+        for(const Vector& vertex : vertices) {
+            x.push_back(vertex(0));
+            y.push_back(vertex(1));
+            z.push_back(vertex(2));
+        }
+    }
+
+    /**
+     * @brief Construct a new MeshTriangles object from arrays that were stored earlier
+     * 
+     * @param xs x coordinates of the vertices
+     * @param ys y coordinates of the vertices
+     * @param zs z coordinates of the vertices
+     * @param vertexIndices three vertex indices per triangle
+     */
+    MeshTriangles(std::vector<float> xs, std::vector<float> ys, std::vector<float> zs, std::vector<int> vertexIndices)
+                : x(std::move(xs)), y(std::move(ys)), z(std::move(zs)), indices(std::move(vertexIndices)) { }
+
+    /**
+     * @brief Calculate the distance at which a ray crosses a triangle using the Möller-Trumbore
+     * algorithm. Kept as the reference for the faster TriangleTransform test used in the leaves.
+     * 
+     * @param tri index of the triangle
+     * @param ray ray whose collision will be checked
+     * @return float the distance along the ray, zero if the ray misses the triangle
+     */
+    float Intersect(int tri, const Ray& ray) const {
+        Vector a = getVertex(tri, 0);
+        Vector e1 = getVertex(tri, 1) - a;
+        Vector e2 = getVertex(tri, 2) - a;
+
+        //Compute determinant
+        Vector p = ray.direction.cross(e2);
+        float det = e1.dot(p);
+
+        //Check if the ray is on the same plane as the triangle
+        if(det == 0) return 0;
+
+        float invDet = 1 / det;
+
+        //Compute beta
+        Vector s = ray.origin - a;
+        float beta = s.dot(p)*invDet;
+
+        //If beta < 0 or beta > 1 the ray does not intersect the triangle
+        if(beta < 0 || beta > 1) return 0;
+
+        //Compute gamma
+        Vector q = s.cross(e1);
+        float gamma = ray.direction.dot(q)*invDet;
+
+        //If gamma < 0 or beta + gamma > 1 the ray does not intersect the triangle
+        if(gamma < 0 || beta + gamma > 1) return 0;
+
+        //Compute t
+        return e2.dot(q)*invDet;
+    }
+
+    /**
+     * @brief Get the precomputed intersection transform of a triangle. The coordinate with the
+     * largest normal component is mapped to the plane distance, which keeps the divisions stable.
+     * 
+     * @param tri index of the triangle
+     * @return TriangleTransform the transform, which never reports a hit if the triangle is degenerate
+     */
+    TriangleTransform getTransform(int tri) const {
+        Vector v0 = getVertex(tri, 0);
+        Vector v1 = getVertex(tri, 1);
+        Vector v2 = getVertex(tri, 2);
+        Vector e1 = v1 - v0;
+        Vector e2 = v2 - v0;
+        Vector n = e1.cross(e2);
+        Vector c20 = v2.cross(v0);
+        Vector c10 = v1.cross(v0);
+
+        //Largest component of the normal
+        int k = 0;
+        if(std::abs(n(1)) > std::abs(n(k))) k = 1;
+        if(std::abs(n(2)) > std::abs(n(k))) k = 2;
+        int k1 = (k + 1) % 3;
+        int k2 = (k + 2) % 3;
+        double r = 1 / n(k);
+
+        double rows[3][4] = {};
+        rows[0][k1] = e2(k2)*r;
+        rows[0][k2] = -e2(k1)*r;
+        rows[0][3] = c20(k)*r;
+        rows[1][k1] = -e1(k2)*r;
+        rows[1][k2] = e1(k1)*r;
+        rows[1][3] = -c10(k)*r;
+        rows[2][k] = 1;
+        rows[2][k1] = n(k1)*r;
+        rows[2][k2] = n(k2)*r;
+        rows[2][3] = -n.dot(v0)*r;
+
+        TriangleTransform transform;
+        for(int i = 0; i < 3; i++) {
+            for(int j = 0; j < 4; j++) {
+                transform.row[i][j] = rows[i][j];
+            }
+        }
+        return transform;
+    }
+
+    /**
+     * @brief Get a vertex of a triangle
+     * 
+     * @param tri index of the triangle
+     * @param i index of the vertex in the triangle (0, 1 or 2)
+     * @return Vector
+     */
+    Vector getVertex(int tri, int i) const {
+        int v = indices[3*tri + i];
+        return Vector(x[v], y[v], z[v]);
+    }
+
+    /**
+     * @brief Get the unit normal of a triangle
+     * 
+     * @param tri index of the triangle
+     * @return Vector
+     */
+    Vector getNormal(int tri) const {
+        Vector a = getVertex(tri, 0);
+        return (getVertex(tri, 1) - a).cross(getVertex(tri, 2) - a).normalized();
+    }
+
+    /**
+     * @brief Get the centroid of a triangle
+     * 
+     * @param tri index of the triangle
+     * @return Vector
+     */
+    Vector getCentroid(int tri) const {
+        return (getVertex(tri, 0) + getVertex(tri, 1) + getVertex(tri, 2)) / 3;
+    }
+
+    /**
+     * @brief Get the axis aligned bounding box of a triangle
+     * 
+     * @param tri index of the triangle
+     * @return AABB
+     */
+    AABB getBounds(int tri) const {
+        AABB box;
+        for(int i = 0; i < 3; i++) {
+            box.grow(getVertex(tri, i));
+        }
+        return box;
+    }
+
+    /**
+     * @brief Move a vertex
+     * 
+     * @param v index of the vertex
+     * @param position new position of the vertex
+     */
+    void setVertexPosition(int v, const Vector& position) {
+        x[v] = position(0);
+        y[v] = position(1);
+        z[v] = position(2);
+    }
+
+    /**
+     * @brief Get the number of triangles
+     * 
+     * @return int
+     */
+    int getTriangleCount() const {
+        return indices.size() / 3;
+    }
+
+    /**
+     * @brief Get the number of vertices
+     * 
+     * @return int
+     */
+    int getVertexCount() const {
+        return x.size();
+    }
+
+    /**
+     * @brief Get the coordinate arrays of the vertices
+     * 
+     * @param axis the coordinate (0, 1 or 2)
+     * @return const std::vector<float>&
+     */
+    const std::vector<float>& getCoordinates(int axis) const {
+        return axis == 0 ? x : (axis == 1 ? y : z);
+    }
+
+    /**
+     * @brief Get the vertex indices, three per triangle
+     * 
+     * @return const std::vector<int>&
+     */
+    const std::vector<int>& getIndices() const {
+        return indices;
+    }
+
+    /**
+     * @brief Get the memory taken by the vertices and the indices
+     * 
+     * @return size_t bytes
+     */
+    size_t getMemoryUsage() const {
+        return 3 * x.size() * sizeof(float) + indices.size() * sizeof(int);
+    }
+
+private:
+    std::vector<float> x, y, z;     /* Vertex positions */
+    std::vector<int> indices;       /* Three vertex indices per triangle */
+};
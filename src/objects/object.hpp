@@ -2,8 +2,10 @@
 
 #include "types.hpp"
 #include "material.hpp"
+#include "primitive.hpp"
 
 #include <memory>
+#include <vector>
 
 /**
  * @brief An abstract base class for any type of visible object in a scene
@@ -23,6 +25,15 @@ public:
     virtual ~Object() { }
 
     Vector getPosition() const { return position_; }
+
+    /**
+     * @brief Move the object. Objects that keep their geometry in world space override this to
+     * move it along, call Renderer::refitScene afterwards to update the top-level BVH.
+     * 
+     * @param position the new position
+     */
+    virtual void setPosition(Vector position) { position_ = position; }
+
     std::shared_ptr<Material> getMaterial() const { return material_; }
 
     /**
@@ -37,6 +48,58 @@ public:
      */
     virtual void collision(Ray& ray, Hit &rayHit, float& smallestDistance) = 0;
 
+    /**
+     * @brief Calculate whether the rays of a packet collide with the object, updating the hit and
+     * the smallest distance of each ray like collision does.
+     * 
+     * Objects that can test several rays at once override this, by default the rays are tested
+     * one by one.
+     * 
+     * @param packet rays whose collisions will be checked
+     * @param first first ray of the packet that can hit the object, the rays before it are skipped
+     */
+    virtual void packetCollision(RayPacket& packet, int first) {
+        for(int i = first; i < packet.size; i++) {
+            collision(packet.rays[i], packet.hits[i], packet.distances[i]);
+        }
+    }
+
+    /**
+     * @brief Calculate whether a given ray hits the object before the given distance.
+     * 
+     * Used for shadow and visibility tests, which only need to know whether anything blocks the
+     * ray. Returns at the first hit found instead of searching for the closest one, and does not
+     * write any hit data.
+     * 
+     * @param ray ray whose collision will be checked
+     * @param maxDistance distance along the ray up to which hits are counted
+     * @return true if the ray hits the object between its origin and the given distance
+     */
+    virtual bool occluded(const Ray& ray, float maxDistance) const = 0;
+
+    /**
+     * @brief Get the axis aligned bounding box of the object.
+     * 
+     * Used to build the top-level BVH over the objects of a scene.
+     * 
+     * @return AABB box containing the whole object
+     */
+    virtual AABB getBounds() const = 0;
+
+    /**
+     * @brief Append the balls and quads the object consists of, so that the top-level BVH can
+     * test them inline.
+     * 
+     * Objects that cannot be described by such primitives keep the default, and are tested
+     * through their collision methods.
+     * 
+     * @param primitives vector the primitives are appended to
+     * @return true if the object was appended as primitives
+     */
+    virtual bool getPrimitives(std::vector<Primitive>& /*primitives*/) const {
+        return false;
+    }
+
     /**
      * @brief Print object info to the desired output stream.
      * 
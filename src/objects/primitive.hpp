@@ -0,0 +1,183 @@
+#pragma once
+
+#include "types.hpp"
+#include "material.hpp"
+#include <memory>
+#include <cmath>
+
+/**
+ * @brief Types of the primitives in the leaves of the top-level BVH
+ * 
+ */
+enum class PrimitiveType
+{
+    Ball,       /* Sphere, tested inline */
+    Quad,       /* Parallelogram, i.e. a rectangle or a side of a box, tested inline */
+    Object      /* Any other object, e.g. a mesh with its own BVH, tested through its virtual methods */
+};
+
+/**
+ * @brief Primitive in a leaf of the top-level BVH, tagged with its type.
+ * 
+ * Balls, rectangles and the sides of boxes carry everything their intersection test needs, so
+ * the traversal tests them with a switch on the type instead of a virtual call per object.
+ * Objects that cannot be split into such primitives are referenced by their index.
+ */
+struct Primitive
+{
+    PrimitiveType type = PrimitiveType::Object;
+    int object = 0;         /* Index of the object the primitive belongs to */
+    Vector point;           /* Center of a ball, bottom left corner of a quad */
+    Vector edge1, edge2;    /* Bottom and left sides of a quad, starting from the corner */
+    Vector normal;          /* Normal of a quad */
+    float radius = 0;       /* Radius of a ball */
+    std::shared_ptr<Material> material;
+
+    /**
+     * @brief Create a ball primitive
+     * 
+     * @param center center of the ball
+     * @param radius radius of the ball
+     * @param material material of the ball
+     * @return Primitive
+     */
+    static Primitive MakeBall(const Vector& center, float radius, std::shared_ptr<Material> material) {
+        Primitive primitive;
+        primitive.type = PrimitiveType::Ball;
+        primitive.point = center;
+        primitive.radius = radius;
+        primitive.material = material;
+        return primitive;
+    }
+
+    /**
+     * @brief Create a quad primitive from three of its corners
+     * 
+     * @param topLeft top left corner
+     * @param bottomLeft bottom left corner
+     * @param bottomRight bottom right corner
+     * @param material material of the quad
+     * @return Primitive
+     */
+    static Primitive MakeQuad(const Vector& topLeft, const Vector& bottomLeft, const Vector& bottomRight, std::shared_ptr<Material> material) {
+        Primitive primitive;
+        primitive.type = PrimitiveType::Quad;
+        primitive.point = bottomLeft;
+        primitive.edge1 = -bottomLeft + bottomRight;
+        primitive.edge2 = -bottomLeft + topLeft;
+        primitive.normal = primitive.edge1.cross(primitive.edge2).normalized();
+        primitive.material = material;
+        return primitive;
+    }
+
+    /**
+     * @brief Distance at which the ray enters a ball.
+     * 
+     * @param ray ray whose collision will be checked
+     * @param center center of the ball
+     * @param radius radius of the ball
+     * @return float the distance along the ray, zero if the ray misses the ball
+     */
+    static float IntersectBall(const Ray& ray, const Vector& center, float radius) {
+        Vector toBall = ray.origin - center;
+
+        float a = ray.direction.dot(ray.direction);
+        float b = 2 * ray.direction.dot(toBall);
+        float c = toBall.dot(toBall) - radius * radius;
+
+        float discriminant = b*b - 4*a*c;
+        if (discriminant < 0) return 0;
+
+        return (-b - sqrt(discriminant)) / (2*a);
+    }
+
+    /**
+     * @brief Distance at which the ray crosses a parallelogram.
+     * 
+     * @param ray ray whose collision will be checked
+     * @param corner bottom left corner
+     * @param s1 bottom side, starting from the corner
+     * @param s2 left side, starting from the corner
+     * @param normal normal of the parallelogram
+     * @return float the distance along the ray, zero if the ray misses the parallelogram
+     */
+    static float IntersectQuad(const Ray& ray, const Vector& corner, const Vector& s1, const Vector& s2, const Vector& normal) {
+        float distance = (corner - ray.origin).dot(normal) / ray.direction.dot(normal);
+        Vector intersection = -corner + ray.origin + ray.direction * distance;
+
+        if (intersection.dot(s1) <= s1.squaredNorm()
+            && intersection.dot(s1) >= 0
+            && intersection.dot(s2) <= s2.squaredNorm()
+            && intersection.dot(s2) >= 0
+        )
+        {
+            return distance;
+        }
+        return 0;
+    }
+
+    /**
+     * @brief Distance at which the ray hits a ball or quad primitive
+     * 
+     * @param ray ray whose collision will be checked
+     * @return float the distance along the ray, zero if the ray misses the primitive
+     */
+    float Intersect(const Ray& ray) const {
+        if (type == PrimitiveType::Ball) return IntersectBall(ray, point, radius);
+        return IntersectQuad(ray, point, edge1, edge2, normal);
+    }
+
+    /**
+     * @brief Calculate whether a given ray collides with a ball or quad primitive, updating the hit
+     * like Object::collision does
+     * 
+     * @param ray ray whose collision will be checked
+     * @param rayHit address of a Hit data structure
+     * @param smallestDistance current smallest distance
+     */
+    void Collision(const Ray& ray, Hit& rayHit, float& smallestDistance) const {
+        float distance = Intersect(ray);
+        if (distance > 0 && distance < smallestDistance)
+        {
+            smallestDistance = distance;
+            rayHit.distance = distance;
+            rayHit.material = material;
+            rayHit.did_hit = true;
+            rayHit.point = ray.origin + ray.direction * distance;
+            rayHit.normal = type == PrimitiveType::Ball ? Vector((rayHit.point - point).normalized()) : normal;
+        }
+    }
+
+    /**
+     * @brief Calculate whether a given ray hits a ball or quad primitive before the given distance.
+     * 
+     * @param ray ray whose collision will be checked
+     * @param maxDistance distance along the ray up to which hits are counted
+     * @return true if the ray hits the primitive between its origin and the given distance
+     */
+    bool Occluded(const Ray& ray, float maxDistance) const {
+        float distance = Intersect(ray);
+        return distance > 0 && distance < maxDistance;
+    }
+
+    /**
+     * @brief Get the axis aligned bounding box of a ball or quad primitive.
+     * 
+     * @return AABB
+     */
+    AABB getBounds() const {
+        AABB box;
+        if (type == PrimitiveType::Ball) {
+            Vector extent = Vector::Constant(std::abs(radius));
+            box.grow(point - extent);
+            box.grow(point + extent);
+        }
+        else {
+            box.grow(point);
+            box.grow(point + edge1);
+            box.grow(point + edge2);
+            box.grow(point + edge1 + edge2);
+        }
+        return box;
+    }
+};
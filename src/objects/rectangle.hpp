@@ -28,6 +28,26 @@ private:
     * When looking towards positive x-direction
     */
 
+    /**
+     * @brief Distance at which the ray crosses the rectangle.
+     * 
+     * @param ray ray whose collision will be checked
+     * @param normal set to the normal of the rectangle
+     * @return float the distance along the ray, zero if the ray misses the rectangle
+     */
+    float intersect(const Ray& ray, Vector& normal) const {
+        Vector topLeft = corners_[0];
+        Vector bottomLeft = corners_[1];
+        Vector bottomRight = corners_[2];
+
+        Vector s1 = -bottomLeft + bottomRight;
+        Vector s2 = -bottomLeft + topLeft;
+
+        normal = s1.cross(s2).normalized();
+
+        return Primitive::IntersectQuad(ray, bottomLeft, s1, s2, normal);
+    }
+
 public:
     Rectangle(Vector position, float width, float height, std::shared_ptr<Material> material) 
             : Object(position, material), width_(width), height_(height) {
@@ -50,39 +70,49 @@ public:
      */
     void collision(Ray& ray, Hit &rayHit, float& smallestDistance) {
 
-        Vector topLeft = corners_[0];
-        Vector bottomLeft = corners_[1];
-        Vector bottomRight = corners_[2];
+        Vector normal;
+        float distance = intersect(ray, normal);
 
-        Vector s1 = -bottomLeft + bottomRight;
-        Vector s2 = -bottomLeft + topLeft;
-
-        Vector normal = s1.cross(s2).normalized();
-
-        float distance = (bottomLeft - ray.origin).dot(normal) / ray.direction.dot(normal);
-        Vector intersection = -bottomLeft + ray.origin + ray.direction * distance;
-
-        if (intersection.dot(s1) <= s1.squaredNorm() 
-            && intersection.dot(s1) >= 0 
-            && intersection.dot(s2) <= s2.squaredNorm() 
-            && intersection.dot(s2) >= 0
-        ) 
+        if (distance > 0 && distance < smallestDistance)
         {
-            if (distance > 0 && distance < smallestDistance)
-            {
-                smallestDistance = distance;
-                rayHit.distance = distance;
-                rayHit.material = this->getMaterial();
-                rayHit.did_hit = true;
-                rayHit.point = ray.origin + ray.direction * distance;
-                rayHit.normal = normal;
-            }
+            smallestDistance = distance;
+            rayHit.distance = distance;
+            rayHit.material = this->getMaterial();
+            rayHit.did_hit = true;
+            rayHit.point = ray.origin + ray.direction * distance;
+            rayHit.normal = normal;
         }
     }
 
+    /**
+     * @brief Calculate whether a given ray hits the rectangle before the given distance.
+     * 
+     * @param ray ray whose collision will be checked
+     * @param maxDistance distance along the ray up to which hits are counted
+     * @return true if the ray hits the rectangle between its origin and the given distance
+     */
+    bool occluded(const Ray& ray, float maxDistance) const {
+        Vector normal;
+        float distance = intersect(ray, normal);
+        return distance > 0 && distance < maxDistance;
+    }
+
     float getWidth() const { return width_; }
     float getHeight() const { return height_; }
 
+    /**
+     * @brief Move the rectangle, translating its corners with its position.
+     * 
+     * @param position the new position of the center
+     */
+    void setPosition(Vector position) {
+        Vector shift = position - this->getPosition();
+        for (auto& corner : corners_) {
+            corner += shift;
+        }
+        Object::setPosition(position);
+    }
+
     /**
      * @brief Rotates the box around a given axis.
      * 
@@ -99,6 +129,30 @@ public:
         }
     }
 
+    /**
+     * @brief Get the axis aligned bounding box of the rectangle.
+     * 
+     * @return AABB 
+     */
+    AABB getBounds() const {
+        AABB box;
+        for (const auto& corner : corners_) {
+            box.grow(corner);
+        }
+        return box;
+    }
+
+    /**
+     * @brief Append the rectangle as a single quad primitive.
+     * 
+     * @param primitives vector the primitive is appended to
+     * @return true 
+     */
+    bool getPrimitives(std::vector<Primitive>& primitives) const {
+        primitives.push_back(Primitive::MakeQuad(corners_[0], corners_[1], corners_[2], this->getMaterial()));
+        return true;
+    }
+
     /**
      * @brief Print box info to the desired output stream.
      * 
@@ -0,0 +1,249 @@
+#pragma once
+
+#include "types.hpp"
+#include "object.hpp"
+#include "bvh.hpp"
+#include "primitive.hpp"
+#include <vector>
+#include <list>
+#include <memory>
+
+/**
+ * @brief Top-level bounding volume hierarchy over the objects of a scene.
+ * 
+ * The objects are sorted into a binary BVH by their bounding boxes, so that a ray only
+ * tests the objects whose boxes it enters before its closest hit so far, instead of every
+ * object in the scene. Meshes keep their own BVH, which is traversed when their leaf is reached.
+ * 
+ * The leaves reference tagged primitives: balls, rectangles and the six sides of boxes are
+ * stored in the tree as ball and quad primitives and tested inline, and only the remaining
+ * objects are tested through a virtual call.
+ */
+class TLAS
+{
+public:
+    /**
+     * @brief Default constructor for TLAS, creates an empty hierarchy
+     * 
+     */
+    TLAS() { }
+
+    /**
+     * @brief Construct a new TLAS object
+     * 
+     * @param sceneObjects objects of the scene
+     * @param buildSettings settings used to build the hierarchy
+     */
+    TLAS(const std::list<std::shared_ptr<Object>>& sceneObjects, BVHSettings buildSettings = BVHSettings())
+                : objects(sceneObjects.begin(), sceneObjects.end()) {
+        settings = buildSettings;
+        Build();
+    }
+
+    /**
+     * @brief Update the bounds of the nodes after the objects have moved, without changing the
+     * topology of the tree. The tree is rebuilt instead if its SAH cost exceeds the rebuild
+     * threshold of the settings relative to the cost after the last build.
+     * 
+     * @return true if the tree was rebuilt
+     */
+    bool Refit() {
+        size_t count = primitives.size();
+        CollectPrimitives();
+        if(primitives.size() != count) {
+            Build();
+            return true;
+        }
+
+        int n = primitives.size();
+        std::vector<AABB> boxes(n);
+        for(int i = 0; i < n; i++) {
+            boxes[i] = PrimitiveBounds(primitives[i]);
+        }
+
+        BVHBuilder::Refit(nodes, boxes, primitiveIdx);
+        if(BVHBuilder::SAHCost(nodes, settings) > settings.rebuildThreshold * builtSAHCost) {
+            Build();
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Calculate whether a given ray collides with any of the objects in the TLAS
+     * 
+     * @param ray ray whose collision will be checked
+     * @param rayHit address of a Hit data structure
+     * @param smallestDistance current smallest distance
+     */
+    void TLASCollision(Ray& ray, Hit& rayHit, float& smallestDistance) const {
+        InvRay invRay(ray);
+        BVH::Traverse(nodes, 0, ray, invRay, smallestDistance, [&](int first, int count) {
+            for(int i = 0; i < count; i++) {
+                const Primitive& primitive = primitives[primitiveIdx[first + i]];
+                if(primitive.type == PrimitiveType::Object) {
+                    objects[primitive.object]->collision(ray, rayHit, smallestDistance);
+                }else {
+                    primitive.Collision(ray, rayHit, smallestDistance);
+                }
+            }
+            return false;
+        });
+    }
+
+    /**
+     * @brief Calculate the closest hits of the rays of a packet with the objects in the TLAS,
+     * traversing the tree once for the whole packet
+     * 
+     * @param packet rays whose collisions will be checked, with their hits and smallest distances
+     */
+    void TLASPacketCollision(RayPacket& packet) const {
+        PacketRays rays(packet);
+        BVH::TraversePacket(nodes, rays, [&](int first, int count, int firstRay) {
+            for(int i = 0; i < count; i++) {
+                const Primitive& primitive = primitives[primitiveIdx[first + i]];
+                if(primitive.type == PrimitiveType::Object) {
+                    objects[primitive.object]->packetCollision(packet, firstRay);
+                    continue;
+                }
+                for(int ray = firstRay; ray < packet.size; ray++) {
+                    primitive.Collision(packet.rays[ray], packet.hits[ray], packet.distances[ray]);
+                }
+            }
+            for(int ray = firstRay; ray < packet.size; ray++) {
+                rays.distance[ray] = packet.distances[ray];
+            }
+        });
+    }
+
+    /**
+     * @brief Calculate whether a given ray hits any of the objects in the TLAS before the given
+     * distance. The traversal ends at the first object found blocking the ray.
+     * 
+     * @param ray ray whose collision will be checked
+     * @param maxDistance distance along the ray up to which hits are counted
+     * @return true if the ray hits an object between its origin and the given distance
+     */
+    bool TLASOccluded(const Ray& ray, float maxDistance) const {
+        InvRay invRay(ray);
+        bool occluded = false;
+        BVH::Traverse(nodes, 0, ray, invRay, maxDistance, [&](int first, int count) {
+            for(int i = 0; i < count && !occluded; i++) {
+                const Primitive& primitive = primitives[primitiveIdx[first + i]];
+                if(primitive.type == PrimitiveType::Object) {
+                    occluded = objects[primitive.object]->occluded(ray, maxDistance);
+                }else {
+                    occluded = primitive.Occluded(ray, maxDistance);
+                }
+            }
+            return occluded;
+        });
+        return occluded;
+    }
+
+    /**
+     * @brief Get the bounds of all the objects in the TLAS
+     * 
+     * @return AABB the box of the root node, or an empty box if there are no objects
+     */
+    AABB getBounds() const {
+        if(nodes.empty()) return AABB();
+        return nodes[0].getBounds();
+    }
+
+    /**
+     * @brief Get the number of objects in the TLAS
+     * 
+     * @return int
+     */
+    int getObjectCount() const {
+        return objects.size();
+    }
+
+    /**
+     * @brief Get the number of primitives in the leaves of the TLAS
+     * 
+     * @return int
+     */
+    int getPrimitiveCount() const {
+        return primitives.size();
+    }
+
+    /**
+     * @brief Get the nodes vector
+     * 
+     * @return const std::vector<Node>&
+     */
+    const std::vector<Node>& getNodes() const {
+        return nodes;
+    }
+
+    /**
+     * @brief Get the quality and size statistics of the tree
+     * 
+     * @return BVHStats 
+     */
+    BVHStats getStats() const {
+        BVHStats stats = BVHStats::Compute(nodes, settings);
+        stats.primitiveCount = primitives.size();
+        stats.nodeMemory = nodes.size() * sizeof(Node) + primitiveIdx.size() * sizeof(int);
+        stats.primitiveMemory = primitives.size() * sizeof(Primitive);
+        return stats;
+    }
+
+private:
+    std::vector<std::shared_ptr<Object>> objects;
+    std::vector<Primitive> primitives;
+    std::vector<int> primitiveIdx;
+    std::vector<Node> nodes;
+    BVHSettings settings;
+    float builtSAHCost = 0;
+
+    /**
+     * @brief Build the tree over the current primitives of the objects
+     * 
+     */
+    void Build() {
+        CollectPrimitives();
+        int n = primitives.size();
+        std::vector<AABB> boxes(n);
+        std::vector<Vector> centroids(n);
+        for(int i = 0; i < n; i++) {
+            boxes[i] = PrimitiveBounds(primitives[i]);
+            centroids[i] = (boxes[i].min + boxes[i].max) / 2;
+        }
+
+        BVHBuilder builder(boxes, centroids, settings);
+        builder.Build(nodes, primitiveIdx);
+        builtSAHCost = BVHBuilder::SAHCost(nodes, settings);
+    }
+
+    /**
+     * @brief Create the primitives of the objects in their current positions. Objects that are
+     * not made of balls and quads become a single object primitive.
+     * 
+     */
+    void CollectPrimitives() {
+        primitives.clear();
+        for(size_t i = 0; i < objects.size(); i++) {
+            size_t first = primitives.size();
+            if(!objects[i]->getPrimitives(primitives)) {
+                primitives.push_back(Primitive());
+            }
+            for(size_t j = first; j < primitives.size(); j++) {
+                primitives[j].object = i;
+            }
+        }
+    }
+
+    /**
+     * @brief Get the bounding box of a primitive
+     * 
+     * @param primitive the primitive
+     * @return AABB 
+     */
+    AABB PrimitiveBounds(const Primitive& primitive) const {
+        if(primitive.type == PrimitiveType::Object) return objects[primitive.object]->getBounds();
+        return primitive.getBounds();
+    }
+};
@@ -20,6 +20,19 @@ public:
      * @param m Material of the triangle
      */
     Triangle(Vector v0, Vector v1, Vector v2, std::shared_ptr<Material> m) : Object(v0, m) {
+        setVertices(v0, v1, v2);
+    }
+
+    /**
+     * @brief Move the vertices of the triangle
+     * 
+     * @param v0 Vertex 1
+     * @param v1 Vertex 2
+     * @param v2 Vertex 3
+     */
+    void setVertices(Vector v0, Vector v1, Vector v2) {
+        Object::setPosition(v0);
+
         //Vectors pointing at the vertices
         a = v0;
         b = v1;
@@ -36,6 +49,17 @@ public:
         centroid = Vector(v0.mean(), v1.mean(), v2.mean());
     }
 
+    /**
+     * @brief Move the triangle so that its first vertex is at the given position, translating
+     * the other vertices with it
+     * 
+     * @param position the new position of the first vertex
+     */
+    void setPosition(Vector position) {
+        Vector shift = position - a;
+        setVertices(a + shift, b + shift, c + shift);
+    }
+
     /**
      * @brief Calculate whether a given ray collides with the triangle using the Möller-Trumbore algorithm
      * 
@@ -47,34 +71,10 @@ public:
      * @param smallestDistance current smallest distance
      */
     void collision(Ray& ray, Hit &rayHit, float& smallestDistance) {
-        //Compute determinant
-        Vector p = ray.direction.cross(e2);
-        float det = e1.dot(p);
-
-        //Check if the ray is on the same plane as the triangle
-        if(det == 0) return;
+        float t = intersect(ray);
 
-        float invDet = 1 / det;
-
-        //Compute beta
-        Vector s = ray.origin - a;
-        float beta = s.dot(p)*invDet;
-
-        //If beta < 0 or beta > 1 the ray does not intersect the triangle
-        if(beta < 0 || beta > 1) return;
-
-        //Compute gamma
-        Vector q = s.cross(e1);
-        float gamma = ray.direction.dot(q)*invDet;
-
-        //If gamma < 0 or beta + gamma > 1 the ray does not intersect the triangle
-        if(gamma < 0 || beta + gamma > 1) return;
-
-        //Compute t
-        float t = e2.dot(q)*invDet;
-
-        //If t < smallestDistance the ray intersects the triangle
-        if(t < smallestDistance) {
+        //If 0 < t < smallestDistance the ray intersects the triangle in front of its origin
+        if(t > 0 && t < smallestDistance) {
             smallestDistance = t;
             rayHit.distance = t;
             rayHit.material = this->getMaterial();
@@ -86,6 +86,31 @@ public:
         return;
     }
 
+    /**
+     * @brief Calculate whether a given ray hits the triangle before the given distance
+     * 
+     * @param ray ray whose collision will be checked
+     * @param maxDistance distance along the ray up to which hits are counted
+     * @return true if the ray hits the triangle between its origin and the given distance
+     */
+    bool occluded(const Ray& ray, float maxDistance) const {
+        float t = intersect(ray);
+        return t > 0 && t < maxDistance;
+    }
+
+    /**
+     * @brief Get the axis aligned bounding box of the triangle.
+     * 
+     * @return AABB 
+     */
+    AABB getBounds() const {
+        AABB box;
+        box.grow(a);
+        box.grow(b);
+        box.grow(c);
+        return box;
+    }
+
     /**
      * @brief Print triangle info to the desired output stream.
      * 
@@ -146,6 +171,40 @@ private:
     Vector e1, e2;
     Vector n;
     Vector centroid;
+
+    /**
+     * @brief Distance at which the ray crosses the triangle using the Möller-Trumbore algorithm
+     * 
+     * @param ray ray whose collision will be checked
+     * @return float the distance along the ray, zero if the ray misses the triangle
+     */
+    float intersect(const Ray& ray) const {
+        //Compute determinant
+        Vector p = ray.direction.cross(e2);
+        float det = e1.dot(p);
+
+        //Check if the ray is on the same plane as the triangle
+        if(det == 0) return 0;
+
+        float invDet = 1 / det;
+
+        //Compute beta
+        Vector s = ray.origin - a;
+        float beta = s.dot(p)*invDet;
+
+        //If beta < 0 or beta > 1 the ray does not intersect the triangle
+        if(beta < 0 || beta > 1) return 0;
+
+        //Compute gamma
+        Vector q = s.cross(e1);
+        float gamma = ray.direction.dot(q)*invDet;
+
+        //If gamma < 0 or beta + gamma > 1 the ray does not intersect the triangle
+        if(gamma < 0 || beta + gamma > 1) return 0;
+
+        //Compute t
+        return e2.dot(q)*invDet;
+    }
 };
 
 
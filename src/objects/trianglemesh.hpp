@@ -1,16 +1,39 @@
 #pragma once
 
-#include "triangle.hpp"
+#include "object.hpp"
+#include "meshtriangles.hpp"
 #include "bvh.hpp"
+#include "bvh4.hpp"
+#include "compressedbvh4.hpp"
+#include "bvhcache.hpp"
 #include "../libs/tiny_obj_loader/tiny_obj_loader.cc"
 
 #include <iostream>
 #include <vector>
 #include <string>
+#include <map>
+#include <sstream>
+#include <chrono>
+
+/**
+ * @brief Geometry of a mesh in object space together with its BVH, shared by every
+ * TriangleMesh instance that loads the same file with the same BVH settings.
+ * 
+ */
+struct MeshGeometry
+{
+    std::string name;
+    std::shared_ptr<BVH> bvh;
+    std::shared_ptr<BVH4> bvh4;
+    std::shared_ptr<CompressedBVH4> compressedBVH4;
+};
 
 /**
  * @brief Trianglemesh object consiting of Triangles, loaded from .obj file
  * 
+ * The triangles and the BVH of each file are loaded only once in object space and shared by
+ * all the meshes using it. Each mesh stores only its rotation, scale and position, and rays
+ * are transformed into object space for the traversal.
  */
 class TriangleMesh : public Object {
 public:
@@ -22,96 +45,158 @@ public:
      * @param m material of the object
      * @param scale scaling of the object size
      * @param angle counterclockwise rotation of the object in radians
+     * @param bvhSettings settings used to build the BVH of the mesh
      */
-    TriangleMesh(std::string obj_filepath, Vector scenePos, std::shared_ptr<Material> m, Vector rotation, double scale) : Object(scenePos, m) {
-        unsigned long pos = obj_filepath.find_last_of("/");
-        std::string basepath = obj_filepath.substr(0, pos+1);
-        std::string obj_name = obj_filepath.substr(pos+1, obj_filepath.length());
-        
-        //Name of the object wihthout .obj
-        name = obj_name.substr(0, obj_name.length()-4);
+    TriangleMesh(std::string obj_filepath, Vector scenePos, std::shared_ptr<Material> m, Vector rotation, double scale,
+                 BVHSettings bvhSettings = BVHSettings()) : Object(scenePos, m) {
+        geometry = LoadGeometry(obj_filepath, bvhSettings);
+        name = geometry->name;
 
-        tinyobj::attrib_t attributes;
-        std::vector<Triangle> triangles;
-        std::vector<tinyobj::shape_t> objects;
-        std::vector<tinyobj::material_t> materials;
-        std::string warnings;
-        std::string errors;
-        std::vector<Vector> vertices;
+        //Orientating the object according to the rotation vector
+        Eigen::AngleAxisd xRotation(rotation[0], Vector::UnitX());
+        Eigen::AngleAxisd yRotation(rotation[1], Vector::UnitY());
+        Eigen::AngleAxisd zRotation(rotation[2], Vector::UnitZ());
+        Matrix rotationMatrix = (zRotation * yRotation * xRotation).toRotationMatrix();
 
-        //Load data from object file
-        bool r = tinyobj::LoadObj(&attributes, &objects, &materials, &warnings, &errors, obj_filepath.c_str(), basepath.c_str());
+        toWorld = rotationMatrix * scale;
+        toObject = toWorld.inverse();
+        normalToWorld = toObject.transpose();
+    }
 
-        //Check for errors in loading the data
-        if(!errors.empty()) {
-            std::cout << "Error: " << errors << std::endl;
-        }
-        if(!r) {
-            std::cout << "Failed to load object file." << std::endl;
-            exit(1);
+    /**
+     * @brief Calclute whether a given ray collides with the TriangleMesh
+     * 
+     * The ray is transformed into object space without normalizing its direction, so the
+     * distances along it are the same in both spaces.
+     * 
+     * @param ray ray whose collision will be checked
+     * @param rayHit address of a Hit data structure
+     * @param smallestDistance current smallest distance
+     */
+    void collision(Ray& ray, Hit& rayHit, float& smallestDistance) {
+        Ray objectRay = ray;
+        objectRay.origin = toObject * (ray.origin - this->getPosition());
+        objectRay.direction = toObject * ray.direction;
+        float previousDistance = smallestDistance;
+
+        if(geometry->bvh4) {
+            geometry->bvh4->BVH4Collision(objectRay, rayHit, smallestDistance);
+        }else if(geometry->compressedBVH4) {
+            geometry->compressedBVH4->CompressedBVH4Collision(objectRay, rayHit, smallestDistance);
+        }else {
+            geometry->bvh->BVHCollision(objectRay, rayHit, smallestDistance, geometry->bvh->getRootNodeIdx());
         }
 
-        //Loop over objects (shapes)
-        for(size_t o = 0; o < objects.size(); o++) {
-            size_t o_offset = 0;
-            //Loop over triangles (faces)
-            for(size_t t = 0; t < objects[o].mesh.num_face_vertices.size(); t++) {
-                int fv = objects[o].mesh.num_face_vertices[t];
+        //Move a new hit back into world space
+        if(smallestDistance < previousDistance) {
+            rayHit.material = this->getMaterial();
+            rayHit.point = ray.origin + ray.direction*rayHit.distance;
+            rayHit.normal = (normalToWorld * rayHit.normal).normalized();
+        }
+        
+        return;
+    }
 
-                //Looping over vertices in this face
-                for(size_t v = 0; v < fv; v++) {
-                    tinyobj::index_t idx = objects[o].mesh.indices[o_offset + v];
-                    tinyobj::real_t vx = attributes.vertices[3*idx.vertex_index+0];
-                    tinyobj::real_t vz = attributes.vertices[3*idx.vertex_index+1];
-                    tinyobj::real_t vy = attributes.vertices[3*idx.vertex_index+2];
-
-                    //Orientating the object according to the rotation vector
-                    Eigen::AngleAxisd xRotation(rotation[0], Vector::UnitX());
-                    Eigen::AngleAxisd yRotation(rotation[1], Vector::UnitY());
-                    Eigen::AngleAxisd zRotation(rotation[2], Vector::UnitZ());
-
-                    Vector relVertex = Vector(vx, vy, vz);
-                    
-                    relVertex = xRotation * relVertex;
-                    relVertex = yRotation * relVertex;
-                    relVertex = zRotation * relVertex;
-
-                    //Creating one vertex
-                    Vector vertex = relVertex*scale+scenePos;
-                    vertices.push_back(vertex);
-                }
-                o_offset += fv;
-            }
+    /**
+     * @brief Calculate whether the rays of a packet collide with the TriangleMesh, traversing the
+     * binary BVH once for the whole packet. The rays are transformed into object space like in
+     * collision, so the hits are the same as if the rays were tested one by one.
+     * 
+     * @param packet rays whose collisions will be checked
+     * @param first first ray of the packet that can hit the mesh, the rays before it are skipped
+     */
+    void packetCollision(RayPacket& packet, int first) {
+        PacketRays objectRays(packet, toObject, this->getPosition());
+        for(int i = 0; i < first; i++) {
+            objectRays.distance[i] = -INFINITY;
         }
+        geometry->bvh->PacketCollision(objectRays);
 
-        //Loops over vertices and creates triangles
-        for(int i = 0; i < vertices.size()/3; ++i) {
-            triangles.push_back(Triangle(vertices[i*3], vertices[i*3+1], vertices[i*3+2], m));
+        for(int i = first; i < packet.size; i++) {
+            if(objectRays.triangle[i] < 0) continue;
+            Ray& ray = packet.rays[i];
+            Hit& rayHit = packet.hits[i];
+            packet.distances[i] = objectRays.distance[i];
+            rayHit.did_hit = true;
+            rayHit.distance = objectRays.distance[i];
+            rayHit.material = this->getMaterial();
+            rayHit.point = ray.origin + ray.direction*rayHit.distance;
+            rayHit.normal = (normalToWorld * geometry->bvh->getTriangles().getNormal(objectRays.triangle[i])).normalized();
         }
+    }
 
-        bvh = BVH(triangles);
+    /**
+     * @brief Calculate whether a given ray hits the TriangleMesh before the given distance
+     * 
+     * @param ray ray whose collision will be checked
+     * @param maxDistance distance along the ray up to which hits are counted
+     * @return true if the ray hits a triangle of the mesh between its origin and the given distance
+     */
+    bool occluded(const Ray& ray, float maxDistance) const {
+        Ray objectRay = ray;
+        objectRay.origin = toObject * (ray.origin - this->getPosition());
+        objectRay.direction = toObject * ray.direction;
 
-        std::cout << "Object file: " << obj_name << ", succesfully opened!" << std::endl;
+        if(geometry->bvh4) {
+            return geometry->bvh4->BVH4Occluded(objectRay, maxDistance);
+        }else if(geometry->compressedBVH4) {
+            return geometry->compressedBVH4->CompressedBVH4Occluded(objectRay, maxDistance);
+        }
+        return geometry->bvh->BVHOccluded(objectRay, maxDistance);
+    }
 
-        triangles.clear();
-        objects.clear();
-        materials.clear();
+    /**
+     * @brief Move the vertices of the mesh and refit its BVH, see BVH::Refit. The first refit
+     * gives the mesh its own copy of the geometry and BVH, so the other instances of the file and
+     * the meshes loaded from it later keep the geometry of the file.
+     * 
+     * @param vertices new object space vertex positions, one per vertex in the order of the file
+     * @return true if the refitted BVH was degraded too far and was rebuilt
+     */
+    bool Refit(const std::vector<Vector>& vertices) {
+        if(!ownsGeometry) {
+            geometry = std::make_shared<MeshGeometry>(*geometry);
+            geometry->bvh = std::make_shared<BVH>(*geometry->bvh);
+            ownsGeometry = true;
+        }
+        bool rebuilt = geometry->bvh->Refit(vertices);
+        if(geometry->bvh4) {
+            geometry->bvh4 = std::make_shared<BVH4>(geometry->bvh);
+        }
+        if(geometry->compressedBVH4) {
+            geometry->compressedBVH4 = std::make_shared<CompressedBVH4>(geometry->bvh);
+        }
+        return rebuilt;
     }
 
     /**
-     * @brief Calclute whether a given ray collides with the TriangleMesh
+     * @brief Transform a point from the object space of the mesh into world space
      * 
-     * @param ray ray whose collision will be checked
-     * @param rayHit address of a Hit data structure
-     * @param smallestDistance current smallest distance
+     * @param point point in object space
+     * @return Vector the point in world space
      */
-    void collision(Ray& ray, Hit& rayHit, float& smallestDistance) {
-        
-        bvh.BVHCollision(ray, rayHit, smallestDistance, bvh.getRootNodeIdx());
-        
-        return;
+    Vector objectToWorld(const Vector& point) const {
+        return toWorld * point + this->getPosition();
     }
     
+    /**
+     * @brief Get the axis aligned bounding box of the TriangleMesh, i.e., the box of its BVH in world space
+     * 
+     * @return AABB 
+     */
+    AABB getBounds() const {
+        AABB objectBox = geometry->bvh->getBounds();
+        AABB box;
+        if(objectBox.min(0) > objectBox.max(0)) return box;
+        for(int corner = 0; corner < 8; corner++) {
+            Vector point((corner & 1) ? objectBox.max(0) : objectBox.min(0),
+                         (corner & 2) ? objectBox.max(1) : objectBox.min(1),
+                         (corner & 4) ? objectBox.max(2) : objectBox.min(2));
+            box.grow(objectToWorld(point));
+        }
+        return box;
+    }
+
     /**
      * @brief Print TriangleMesh info to the desired output stream
      * 
@@ -122,12 +207,30 @@ public:
     }
 
     /**
-     * @brief Get the BVH of the trianglemesh object
+     * @brief Get the BVH of the trianglemesh object, built in object space
      * 
-     * @return BVH 
+     * @return const BVH& 
      */
-    BVH getBVH() const {
-        return bvh;
+    const BVH& getBVH() const {
+        return *geometry->bvh;
+    }
+
+    /**
+     * @brief Get the 4-wide BVH of the trianglemesh object
+     * 
+     * @return std::shared_ptr<BVH4> the 4-wide BVH, or nullptr if the mesh uses the binary BVH
+     */
+    std::shared_ptr<BVH4> getBVH4() const {
+        return geometry->bvh4;
+    }
+
+    /**
+     * @brief Get the compressed 4-wide BVH of the trianglemesh object
+     * 
+     * @return std::shared_ptr<CompressedBVH4> the compressed BVH, or nullptr if the mesh uses another layout
+     */
+    std::shared_ptr<CompressedBVH4> getCompressedBVH4() const {
+        return geometry->compressedBVH4;
     }
 
     /**
@@ -140,6 +243,149 @@ public:
     }
 
 private:
-    BVH bvh;
+    std::shared_ptr<MeshGeometry> geometry;
+    Matrix toWorld;         /* Rotation and scale from object space into world space */
+    Matrix toObject;        /* Inverse of toWorld */
+    Matrix normalToWorld;   /* Inverse transpose of toWorld, used for the normals */
+    bool ownsGeometry = false;  /* True once Refit has copied the shared geometry for this mesh */
     std::string name;
-};
\ No newline at end of file
+
+    /**
+     * @brief Get the object space geometry of an .obj file, loading the file and building its BVH
+     * only if no mesh alive uses the same file with the same BVH settings
+     * 
+     * @param obj_filepath filepath string
+     * @param bvhSettings settings used to build the BVH of the mesh
+     * @return std::shared_ptr<MeshGeometry> the shared geometry
+     */
+    static std::shared_ptr<MeshGeometry> LoadGeometry(std::string obj_filepath, BVHSettings bvhSettings) {
+        static std::map<std::string, std::weak_ptr<MeshGeometry>> loaded;
+
+        std::ostringstream key;
+        key << obj_filepath << "|" << (int)bvhSettings.mode << "|" << (int)bvhSettings.layout << "|" << bvhSettings.traversalCost
+            << "|" << bvhSettings.intersectionCost << "|" << bvhSettings.bins << "|" << bvhSettings.maxLeafSize
+            << "|" << bvhSettings.splitBudget;
+        std::shared_ptr<MeshGeometry> geometry = loaded[key.str()].lock();
+        if(geometry) {
+            std::cout << "Object file: " << obj_filepath << ", instanced from the already loaded mesh." << std::endl;
+            return geometry;
+        }
+
+        unsigned long pos = obj_filepath.find_last_of("/");
+        std::string obj_name = obj_filepath.substr(pos+1, obj_filepath.length());
+        
+        geometry = std::make_shared<MeshGeometry>();
+        //Name of the object wihthout .obj
+        geometry->name = obj_name.substr(0, obj_name.length()-4);
+
+        auto startTime = std::chrono::high_resolution_clock::now();
+        if(bvhSettings.cache) {
+            geometry->bvh = BVHCache::Load(obj_filepath, bvhSettings);
+        }
+        if(geometry->bvh) {
+            std::chrono::duration<float> loadTime = std::chrono::high_resolution_clock::now() - startTime;
+            std::cout << "Object file: " << obj_name << ", BVH with " << geometry->bvh->getNodeCount()
+                      << " nodes loaded from cache in " << loadTime.count() << " seconds." << std::endl;
+        }else {
+            geometry->bvh = std::make_shared<BVH>(LoadTriangles(obj_filepath), bvhSettings);
+
+            std::cout << "Object file: " << obj_name << ", succesfully opened!" << std::endl;
+            std::cout << "BVH with " << geometry->bvh->getNodeCount() << " nodes built in " << geometry->bvh->getBuildTime()
+                      << " seconds using " << omp_get_max_threads() << " threads." << std::endl;
+            if(bvhSettings.mode == BVHBuildMode::Spatial) {
+                std::cout << "Spatial splits: SAH cost " << geometry->bvh->SAHCost()
+                          << ", " << geometry->bvh->getReferenceCount() << " references to "
+                          << geometry->bvh->getTriangleCount() << " triangles." << std::endl;
+            }
+
+            if(bvhSettings.cache && !BVHCache::Store(obj_filepath, *geometry->bvh)) {
+                std::cout << "Could not write the BVH cache file of " << obj_name << "." << std::endl;
+            }
+        }
+        if(bvhSettings.layout == BVHLayout::BVH4) {
+            geometry->bvh4 = std::make_shared<BVH4>(geometry->bvh);
+        }else if(bvhSettings.layout == BVHLayout::CompressedBVH4) {
+            geometry->compressedBVH4 = std::make_shared<CompressedBVH4>(geometry->bvh);
+        }
+        PrintMemoryUsage(*geometry);
+        geometry->bvh->getStats().Print(std::cout);
+
+        loaded[key.str()] = geometry;
+        return geometry;
+    }
+
+    /**
+     * @brief Print the memory taken by the triangles and by the BVH of the traversed layout,
+     * in bytes per triangle
+     * 
+     * @param geometry the loaded geometry
+     */
+    static void PrintMemoryUsage(const MeshGeometry& geometry) {
+        double triangleCount = std::max(geometry.bvh->getTriangleCount(), 1);
+        std::cout << "Memory per triangle: " << geometry.bvh->getTriangles().getMemoryUsage() / triangleCount
+                  << " bytes in triangles, " << geometry.bvh->getTransformMemoryUsage() / triangleCount
+                  << " bytes in intersection transforms, " << geometry.bvh->getMemoryUsage() / triangleCount << " bytes in BVH2";
+        if(geometry.bvh4) {
+            std::cout << ", " << geometry.bvh4->getMemoryUsage() / triangleCount << " bytes in BVH4";
+        }
+        if(geometry.compressedBVH4) {
+            std::cout << ", " << geometry.compressedBVH4->getMemoryUsage() / triangleCount << " bytes in CompressedBVH4";
+        }
+        std::cout << "." << std::endl;
+    }
+
+    /**
+     * @brief Parse the triangles of an .obj file in object space
+     * 
+     * @param obj_filepath filepath string
+     * @return MeshTriangles the vertices of the file and the triangles in the order of the file
+     */
+    static MeshTriangles LoadTriangles(std::string obj_filepath) {
+        unsigned long pos = obj_filepath.find_last_of("/");
+        std::string basepath = obj_filepath.substr(0, pos+1);
+        tinyobj::attrib_t attributes;
+        std::vector<tinyobj::shape_t> objects;
+        std::vector<tinyobj::material_t> materials;
+        std::string warnings;
+        std::string errors;
+        std::vector<Vector> vertices;
+        std::vector<int> indices;
+
+        //Load data from object file
+        bool r = tinyobj::LoadObj(&attributes, &objects, &materials, &warnings, &errors, obj_filepath.c_str(), basepath.c_str());
+
+        //Check for errors in loading the data
+        if(!errors.empty()) {
+            std::cout << "Error: " << errors << std::endl;
+        }
+        if(!r) {
+            std::cout << "Failed to load object file." << std::endl;
+            exit(1);
+        }
+
+        //Creating the vertices in object space
+        for(size_t v = 0; v < attributes.vertices.size()/3; v++) {
+            tinyobj::real_t vx = attributes.vertices[3*v+0];
+            tinyobj::real_t vz = attributes.vertices[3*v+1];
+            tinyobj::real_t vy = attributes.vertices[3*v+2];
+            vertices.push_back(Vector(vx, vy, vz));
+        }
+
+        //Loop over objects (shapes)
+        for(size_t o = 0; o < objects.size(); o++) {
+            size_t o_offset = 0;
+            //Loop over triangles (faces)
+            for(size_t t = 0; t < objects[o].mesh.num_face_vertices.size(); t++) {
+                int fv = objects[o].mesh.num_face_vertices[t];
+
+                //Looping over vertices in this face
+                for(int v = 0; v < fv; v++) {
+                    indices.push_back(objects[o].mesh.indices[o_offset + v].vertex_index);
+                }
+                o_offset += fv;
+            }
+        }
+
+        return MeshTriangles(vertices, indices);
+    }
+};
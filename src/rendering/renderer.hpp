@@ -3,10 +3,48 @@
 #include "types.hpp"
 #include <vector>
 #include "randomgenerator.hpp"
+#include "tlas.hpp"
+#include "morton.hpp"
+#include "framebuffer.hpp"
 #include <iostream>
 #include <omp.h>
 #include <chrono>
 #include <memory>
+#include <algorithm>
+#include <atomic>
+#include <climits>
+
+/**
+ * @brief Work counters that can be shown by the heatmap render mode
+ * 
+ */
+enum class HeatmapCounter
+{
+    NodeVisits,     /* Interior nodes of the hierarchies whose children were tested */
+    PrimitiveTests  /* Objects and triangles in the leaves the ray entered */
+};
+
+/**
+ * @brief Orders in which the tiles of the image are handed to the render threads
+ * 
+ */
+enum class TileOrder
+{
+    Rows,       /* Row by row from the top left tile */
+    Morton,     /* Along a Z-order curve, so that the tiles rendered at the same time are close to each other */
+    CenterOut   /* From the center of the image outwards */
+};
+
+/**
+ * @brief Running mean and sum of squared differences from the mean of the luminance of the
+ * samples of a pixel, updated with Welford's algorithm
+ * 
+ */
+struct LuminanceMoments
+{
+    double mean = 0;
+    double m2 = 0;
+};
 
 /**
  * @brief Implements the ray tracing algorithm.
@@ -17,12 +55,15 @@ class Renderer
 private:
 
     std::shared_ptr<Scene> scene_;
+    TLAS tlas_;
     Camera camera_;
-    RandomGenerator rnd_;
+    uint32_t seed = 0; // Seed of the random numbers, the same seed gives the same image
 
     int resolution_x;
     int resolution_y;
-    std::vector<std::vector<Color>> result;
+    Framebuffer result;
+    std::vector<LuminanceMoments> luminance_moments; // Running mean and variance of the luminance of the samples of each pixel, for estimating the noise
+    std::vector<int> sample_targets; // Sample count each pixel is rendered up to in a round of adaptive sampling, empty to render every pixel
 
     float anti_alias_radius = 1;
 
@@ -37,17 +78,205 @@ private:
 
     int progressBarWidth = 100;
 
+    bool packet_tracing = true;
+    static constexpr int packetSize = 8; // Width and height of the pixel blocks traced as packets
+
+    bool ray_sorting = false;
+    AABB scene_bounds;
+
+    int tile_size = 32; // Width and height of the pixel tiles handed to the render threads, a multiple of packetSize
+    TileOrder tile_order = TileOrder::Morton;
+
+    /**
+     * @brief Render all the samples of a tile of pixels.
+     * 
+     * @param x0 x-coordinate of the top left pixel of the tile
+     * @param y0 y-coordinate of the top left pixel of the tile
+     * @param samples number of samples per pixel
+     */
+    void renderTile(int x0, int y0, int samples) {
+        int x1 = std::min(x0 + tile_size, resolution_x);
+        int y1 = std::min(y0 + tile_size, resolution_y);
+        for (int sample = 0; sample < samples; ++sample)
+        {
+            if (ray_sorting)
+            {
+                traceSortedTile(x0, y0);
+            }
+            else if (packet_tracing)
+            {
+                for (int x = x0; x < x1; x += packetSize)
+                {
+                    for (int y = y0; y < y1; y += packetSize)
+                    {
+                        tracePacket(x, y);
+                    }
+                }
+            }
+            else
+            {
+                for (int x = x0; x < x1; ++x)
+                {
+                    for (int y = y0; y < y1; ++y)
+                    {
+                        if (!isActive(x, y)) continue;
+                        Ray ray = createRay(x, y);
+                        addSample(x, y, trace(ray, y * resolution_x + x));
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Render the given tiles with all threads, each tile with the given number of samples
+     * 
+     * @param tiles the tile numbers, see tileSequence
+     * @param samples number of samples per pixel
+     */
+    void renderTiles(const std::vector<int>& tiles, int samples) {
+        int tilesX = (resolution_x + tile_size - 1) / tile_size;
+        std::atomic<int> nextTile(0);
+        int tilesDone = 0;
+
+        // Each thread takes the next tile from the shared counter and renders all of its samples,
+        // so threads that got cheap tiles keep taking new ones instead of waiting for the others
+        #pragma omp parallel num_threads(omp_get_max_threads())
+        {
+            int index;
+            while ((index = nextTile.fetch_add(1)) < (int)tiles.size())
+            {
+                int tile = tiles[index];
+                renderTile((tile % tilesX) * tile_size, (tile / tilesX) * tile_size, samples);
+
+                #pragma omp critical(progress)
+                progressBar(tilesDone++, tiles.size());
+            }
+        }
+        std::cout << std::endl;
+    }
+
+    /**
+     * @brief Set every pixel of the result to black with no samples
+     * 
+     */
+    void clearResult() {
+        result.clear();
+        std::fill(luminance_moments.begin(), luminance_moments.end(), LuminanceMoments());
+    }
+
+    /**
+     * @brief Check whether a pixel takes samples in the current round of adaptive sampling.
+     * Every pixel does outside adaptive sampling.
+     * 
+     * @param x x-coordinate of the pixel
+     * @param y y-coordinate of the pixel
+     * @return true if the pixel is below its target sample count
+     */
+    bool isActive(int x, int y) const {
+        return sample_targets.empty() || result.getSampleCount(x, y) < sample_targets[y * resolution_x + x];
+    }
+
+    /**
+     * @brief Estimate the noise of a pixel as the standard error of its mean luminance, carried
+     * through the square root of the default display transform, i.e. divided by 2 sqrt(mean).
+     * 
+     * @param x x-coordinate of the pixel
+     * @param y y-coordinate of the pixel
+     * @return float the error estimate, infinite for pixels with less than two samples
+     */
+    float pixelError(int x, int y) const {
+        int count = result.getSampleCount(x, y);
+        if (count < 2) return INFINITY;
+        const LuminanceMoments& moments = luminance_moments[y * resolution_x + x];
+        double variance = moments.m2 / (count - 1);
+        return std::sqrt(variance / count) / (2 * std::sqrt(std::max(moments.mean, 1e-4)));
+    }
+
+    /**
+     * @brief Get the luminance of a linear color
+     * 
+     * @param r red
+     * @param g green
+     * @param b blue
+     * @return double
+     */
+    static double luminance(double r, double g, double b) {
+        return 0.2126 * r + 0.7152 * g + 0.0722 * b;
+    }
+
     /**
-     * @brief Clamps the given color values, i.e., ensures that the maximum value for each R, G, B is 1.
+     * @brief Create the random generator of one bounce of the path of the next sample of a pixel.
+     * 
+     * The sample is numbered by the samples the pixel already has, so the random numbers of a
+     * path depend only on the seed, the pixel, the sample and the bounce, not on the thread or
+     * the order in which the paths are traced.
      * 
-     * @param input the color vector to be clamped
-     * @return Color with the values clamped
+     * @param pixel index of the pixel, row by row
+     * @param bounce index of the bounce, zero for the camera ray
+     * @return RandomGenerator
      */
-    Color clamp(Color input) {
-        float R = input(0) > 1 ? 1 : input(0);
-        float G = input(1) > 1 ? 1 : input(1);
-        float B = input(2) > 1 ? 1 : input(2);
-        return Color(R, G, B);
+    RandomGenerator pathRandom(int pixel, int bounce) const {
+        int sample = result.getSampleCount(pixel % resolution_x, pixel / resolution_x);
+        return RandomGenerator(seed, pixel, sample, bounce);
+    }
+
+    /**
+     * @brief Add the light of a new sample to the sum of a pixel in the result
+     * 
+     * @param x x-coordinate of the pixel
+     * @param y y-coordinate of the pixel
+     * @param light light collected by the sample
+     */
+    void addSample(int x, int y, const Light& light) {
+        float* rgb = result.pixel(x, y);
+        rgb[0] += light(0);
+        rgb[1] += light(1);
+        rgb[2] += light(2);
+        int count = result.getSampleCount(x, y) + 1;
+        result.setSampleCount(x, y, count);
+
+        // Welford's update, which stays accurate for thousands of samples unlike a sum of squares
+        LuminanceMoments& moments = luminance_moments[y * resolution_x + x];
+        double lum = luminance(light(0), light(1), light(2));
+        double delta = lum - moments.mean;
+        moments.mean += delta / count;
+        moments.m2 += delta * (lum - moments.mean);
+    }
+
+    /**
+     * @brief Get the tiles of the image in the order of the tile order setting. A tile is
+     * numbered row by row, i.e. tile (x, y) is y * tilesX + x.
+     * 
+     * @return std::vector<int> the tile numbers
+     */
+    std::vector<int> tileSequence() const {
+        int tilesX = (resolution_x + tile_size - 1) / tile_size;
+        int tilesY = (resolution_y + tile_size - 1) / tile_size;
+        std::vector<std::pair<double, int>> keys;
+        for (int tile = 0; tile < tilesX * tilesY; ++tile)
+        {
+            int x = tile % tilesX;
+            int y = tile / tilesX;
+            double key = tile;
+            if (tile_order == TileOrder::Morton)
+            {
+                key = Morton::ExpandBits(x) | Morton::ExpandBits(y) << 1;
+            }
+            else if (tile_order == TileOrder::CenterOut)
+            {
+                key = std::pow(x + 0.5 - tilesX / 2.0, 2) + std::pow(y + 0.5 - tilesY / 2.0, 2);
+            }
+            keys.push_back({ key, tile });
+        }
+        std::sort(keys.begin(), keys.end());
+
+        std::vector<int> tiles;
+        for (const auto& key : keys)
+        {
+            tiles.push_back(key.second);
+        }
+        return tiles;
     }
 
     /**
@@ -61,14 +290,15 @@ private:
      * @return Ray originating from the camera pointing to the pixel
      */
     Ray createRay(int x, int y) {
+        RandomGenerator rng = pathRandom(y * resolution_x + x, 0);
 
         // Depth of field effect randomizes the origin
-        Vector2 jiggle = rnd_.randomInCircle() * camera_.DoF;
+        Vector2 jiggle = rng.randomInCircle() * camera_.DoF;
         Vector randomShift = jiggle(0) * pixel_x + jiggle(1) * pixel_y;
         Point origin = camera_.position + randomShift;
 
         // Anti-aliasing randomizes the target
-        jiggle = rnd_.randomInCircle() * anti_alias_radius;
+        jiggle = rng.randomInCircle() * anti_alias_radius;
         randomShift = jiggle(0) * pixel_x + jiggle(1) * pixel_y;
         Vector target = topleft_pixel + pixel_y * y + pixel_x * x + randomShift;
 
@@ -81,6 +311,7 @@ private:
      * @brief Creates a Hit data structure representing a ray collision.
      * 
      * Checks whether the ray intersects any visible objects in the scene and picks the one closest to the camera.
+     * Only the objects whose bounding boxes the ray enters are tested, using the top-level BVH of the scene.
      * 
      * @param ray a ray to be checked for collisions
      * @return Hit representing a possible collision
@@ -90,35 +321,237 @@ private:
         float closestHit = INFINITY;
         Hit rayHit = { .did_hit = false };
 
-        for (auto object : (*scene_).getObjects()) {
-            object->collision(ray, rayHit, closestHit);
-        }
+        tlas_.TLASCollision(ray, rayHit, closestHit);
 
         return rayHit;
     }
 
+    /**
+     * @brief Check whether anything in the scene blocks a ray before the given distance.
+     * 
+     * Cheaper than rayCollision for shadow and visibility tests, since the search ends at
+     * the first hit found.
+     * 
+     * @param ray a ray to be checked for collisions
+     * @param maxDistance distance along the ray up to which hits are counted
+     * @return true if the ray is blocked
+     */
+    bool rayOccluded(const Ray& ray, float maxDistance) const {
+        return tlas_.TLASOccluded(ray, maxDistance);
+    }
+
     /**
      * @brief Get all the light collected by a ray along its path.
      * 
      * @param ray ray to be traced
+     * @param pixel index of the pixel the ray was created for, row by row
      * @return Light collected by the ray
      */
-    Light trace(Ray& ray) {
+    Light trace(Ray& ray, int pixel) {
+        return trace(ray, rayCollision(ray), pixel);
+    }
+
+    /**
+     * @brief Get all the light collected by a ray along its path, when its first hit is already known.
+     * 
+     * @param ray ray to be traced
+     * @param firstHit the first collision of the ray
+     * @param pixel index of the pixel the ray was created for, row by row
+     * @return Light collected by the ray
+     */
+    Light trace(Ray& ray, Hit firstHit, int pixel) {
         for (int bounce = 0; bounce < max_bounces; ++bounce)
         {
-            Hit hit = rayCollision(ray);
+            Hit hit = bounce == 0 ? firstHit : rayCollision(ray);
+            if (!shade(ray, hit, pathRandom(pixel, bounce + 1))) break;
+        }
+        return ray.light;
+    }
+
+    /**
+     * @brief Continue the path of a ray from its hit, or end it if the ray left the scene.
+     * 
+     * @param ray ray that was traced
+     * @param hit the collision of the ray
+     * @param rng random numbers of the bounce
+     * @return true if the ray bounced off a material and continues
+     */
+    bool shade(Ray& ray, Hit& hit, RandomGenerator rng) {
+        if (hit.did_hit && hit.distance > 0.0001) {
+            // Update ray according to material properties
+            (*hit.material).updateRay(ray, hit, rng);
+            return true;
+        }
+        ray.light += (*scene_).getEnvironment().getLight(ray).cwiseProduct(ray.color);
+        return false;
+    }
+
+    /**
+     * @brief Get all the light collected by a batch of rays along their paths, tracing the rays
+     * bounce by bounce.
+     * 
+     * After the first bounce the rays point in random directions. Before each bounce the rays
+     * still going are sorted by the octant of their direction and the Morton code of their
+     * origin, so that rays traced after each other start close to each other and go the same way,
+     * and mostly visit the same nodes of the hierarchies while those are still in the cache.
+     * 
+     * @param rays rays to be traced
+     * @param hits the first collision of each ray
+     * @param pixels index of the pixel each ray was created for, row by row
+     */
+    void traceSorted(std::vector<Ray>& rays, std::vector<Hit>& hits, const std::vector<int>& pixels) {
+        std::vector<std::pair<uint32_t, int>> order;
+        order.reserve(rays.size());
+        for (int i = 0; i < (int)rays.size(); ++i)
+        {
+            order.push_back({ 0, i });
+        }
 
-            if (hit.did_hit && hit.distance > 0.0001) {
-                // Update ray according to material properties
-                (*hit.material).updateRay(ray, hit);
+        for (int bounce = 0; bounce < max_bounces && !order.empty(); ++bounce)
+        {
+            if (bounce > 0)
+            {
+                for (auto& entry : order)
+                {
+                    entry.first = rayKey(rays[entry.second]);
+                }
+                std::sort(order.begin(), order.end());
+                for (auto& entry : order)
+                {
+                    hits[entry.second] = rayCollision(rays[entry.second]);
+                }
             }
-            else 
+
+            // Keep the rays that continue
+            int kept = 0;
+            for (auto& entry : order)
             {
-                ray.light += (*scene_).getEnvironment().getLight(ray).cwiseProduct(ray.color);
-                break;
+                int i = entry.second;
+                if (shade(rays[i], hits[i], pathRandom(pixels[i], bounce + 1))) order[kept++] = entry;
+            }
+            order.resize(kept);
+        }
+    }
+
+    /**
+     * @brief Sort key of a ray: the octant of its direction in the highest bits, followed by the
+     * Morton code of its origin in the bounds of the scene.
+     * 
+     * @param ray the ray
+     * @return uint32_t
+     */
+    uint32_t rayKey(const Ray& ray) const {
+        uint32_t octant = (ray.direction(0) < 0) | (ray.direction(1) < 0) << 1 | (ray.direction(2) < 0) << 2;
+        return octant << 29 | Morton::Code(ray.origin, scene_bounds) >> 1;
+    }
+
+    /**
+     * @brief Create the camera rays of the active pixels of a block, column by column, and find
+     * their first hits.
+     * 
+     * The camera rays of the block are coherent, so with packet tracing their first hits are found
+     * with one packet traversal of the scene.
+     * 
+     * @param x0 x-coordinate of the top left pixel of the block
+     * @param y0 y-coordinate of the top left pixel of the block
+     * @param packet set to the rays and their first hits
+     * @param pixels the index of the pixel of each ray is appended to it, row by row
+     */
+    void cameraPacket(int x0, int y0, RayPacket& packet, std::vector<int>& pixels) {
+        packet.size = 0;
+        int x1 = std::min(x0 + packetSize, resolution_x);
+        int y1 = std::min(y0 + packetSize, resolution_y);
+        for (int x = x0; x < x1; ++x)
+        {
+            for (int y = y0; y < y1; ++y)
+            {
+                if (!isActive(x, y)) continue;
+                pixels.push_back(y * resolution_x + x);
+                packet.rays[packet.size] = createRay(x, y);
+                packet.hits[packet.size] = { .did_hit = false };
+                packet.distances[packet.size] = INFINITY;
+                packet.size++;
+            }
+        }
+
+        if (packet.size == 0) return;
+        if (packet_tracing)
+        {
+            tlas_.TLASPacketCollision(packet);
+        }
+        else
+        {
+            for (int i = 0; i < packet.size; ++i)
+            {
+                packet.hits[i] = rayCollision(packet.rays[i]);
             }
         }
-        return ray.light;
+    }
+
+    /**
+     * @brief Trace the camera rays of a block of pixels and add their light to the result.
+     * 
+     * The first hits are found for the whole block by cameraPacket. After the first bounce the
+     * rays diverge, and are traced one by one.
+     * 
+     * @param x0 x-coordinate of the top left pixel of the block
+     * @param y0 y-coordinate of the top left pixel of the block
+     */
+    void tracePacket(int x0, int y0) {
+        RayPacket packet;
+        std::vector<int> pixels;
+        cameraPacket(x0, y0, packet, pixels);
+
+        for (int i = 0; i < packet.size; ++i)
+        {
+            addSample(pixels[i] % resolution_x, pixels[i] / resolution_x, trace(packet.rays[i], packet.hits[i], pixels[i]));
+        }
+    }
+
+    /**
+     * @brief Trace the camera rays of a tile of pixels with sorted bounces, see traceSorted,
+     * and add their light to the result.
+     * 
+     * @param x0 x-coordinate of the top left pixel of the tile
+     * @param y0 y-coordinate of the top left pixel of the tile
+     */
+    void traceSortedTile(int x0, int y0) {
+        std::vector<Ray> rays;
+        std::vector<Hit> hits;
+        std::vector<int> pixels;
+        RayPacket packet;
+        int x1 = std::min(x0 + tile_size, resolution_x);
+        int y1 = std::min(y0 + tile_size, resolution_y);
+        for (int bx = x0; bx < x1; bx += packetSize)
+        {
+            for (int by = y0; by < y1; by += packetSize)
+            {
+                cameraPacket(bx, by, packet, pixels);
+                rays.insert(rays.end(), packet.rays, packet.rays + packet.size);
+                hits.insert(hits.end(), packet.hits, packet.hits + packet.size);
+            }
+        }
+
+        traceSorted(rays, hits, pixels);
+
+        for (int i = 0; i < (int)rays.size(); ++i)
+        {
+            addSample(pixels[i] % resolution_x, pixels[i] / resolution_x, rays[i].light);
+        }
+    }
+
+    /**
+     * @brief Map a value to a false color going from blue through cyan, green and yellow to red
+     * 
+     * @param value value between 0 and 1
+     * @return Color 
+     */
+    static Color heatColor(float value) {
+        static const Color stops[5] = { Color(0, 0, 1), Color(0, 1, 1), Color(0, 1, 0), Color(1, 1, 0), Color(1, 0, 0) };
+        float position = std::clamp(value, 0.0f, 1.0f) * 4;
+        int stop = std::min((int)position, 3);
+        float fraction = position - stop;
+        return stops[stop] * (1 - fraction) + stops[stop + 1] * fraction;
     }
 
     /**
@@ -151,8 +584,11 @@ public:
     Renderer(int res_x, int res_y, std::shared_ptr<Scene> sceneToRender) {
         resolution_x = res_x;
         resolution_y = res_y;
-        result = std::vector<std::vector<Color>>(resolution_x, std::vector<Color> (resolution_y));
+        result = Framebuffer(resolution_x, resolution_y);
+        luminance_moments.resize(resolution_x * resolution_y);
         scene_ = sceneToRender;
+        tlas_ = TLAS((*scene_).getObjects());
+        scene_bounds = tlas_.getBounds();
         camera_ = (*scene_).getCamera();
         view_width = camera_.focus_distance * tan(camera_.fov / 2);
         view_height = view_width * (resolution_y - 1) / (resolution_x - 1);
@@ -174,40 +610,261 @@ public:
      * @brief Rendering function that uses all available CPU cores
      * 
      * @param samples Amount of samples that will be taken for each pixel
+     * @param accumulate true to add the new samples to the ones already in the result
+     * instead of starting a new image
+     * @return const Framebuffer& the sum of the linear light of the samples of each pixel with
+     * their counts, see Tonemap for making a displayable image of it. The result stays valid
+     * until the renderer is destroyed.
      */
-    auto parallelRender(int samples) {
+    const Framebuffer& parallelRender(int samples, bool accumulate = false) {
 
         auto startTime = std::chrono::high_resolution_clock::now();        
-        std::vector<std::vector<Color>> result(resolution_x, std::vector<Color> (resolution_y));
+        if (!accumulate) clearResult();
 
         std::cout << "Rendering started..." << std::endl;
 
-        for (int sample = 0; sample < samples; ++sample)
-        {
-            float weight = 1.0 / (sample + 1);
+        renderTiles(tileSequence(), samples);
 
-            #pragma omp parallel for num_threads(omp_get_max_threads())
-            for (int x = 0; x < resolution_x; ++x)
+        auto endTime = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<float> duration = endTime - startTime; 
+        std::cout << "Used " << omp_get_max_threads() << " threads.\n" << std::endl;
+        std::cout << "Rendering completed in " << duration.count() << " seconds.\n" << std::endl;
+        
+        return result;
+    }
+
+    /**
+     * @brief Rendering function that takes more samples only for the pixels that are still noisy.
+     * 
+     * Every pixel first gets the minimum number of samples. Then, round by round, each pixel whose
+     * error estimate, see pixelError, is above the threshold gets half as many samples as it
+     * already has, until no pixel is above the threshold, the pixels above it have the maximum
+     * number of samples or the budget is spent. When the budget runs out the noisiest pixels are
+     * sampled first.
+     * 
+     * @param minSamples number of samples every pixel gets
+     * @param maxSamples largest number of samples a pixel gets
+     * @param threshold error estimate below which a pixel gets no more samples
+     * @param budget average number of samples per pixel to spend at most, 0 for no limit
+     * @return const Framebuffer& the sum of the linear light of the samples of each pixel with
+     * their counts, like parallelRender
+     */
+    const Framebuffer& adaptiveRender(int minSamples, int maxSamples, float threshold, float budget = 0) {
+
+        auto startTime = std::chrono::high_resolution_clock::now();
+        clearResult();
+        minSamples = std::max(1, std::min(minSamples, maxSamples));
+        long long pixelCount = (long long)resolution_x * resolution_y;
+        long long remaining = budget > 0 ? (long long)(budget * pixelCount) : LLONG_MAX;
+
+        std::cout << "Adaptive rendering started..." << std::endl;
+
+        std::vector<int> tiles = tileSequence();
+        renderTiles(tiles, minSamples);
+        remaining -= minSamples * pixelCount;
+
+        int tilesX = (resolution_x + tile_size - 1) / tile_size;
+        sample_targets.assign(pixelCount, 0);
+        for (int round = 1; remaining > 0; ++round)
+        {
+            std::vector<std::pair<float, int>> noisy;
+            for (int y = 0; y < resolution_y; ++y)
             {
-                for (int y = 0; y < resolution_y; ++y)
+                for (int x = 0; x < resolution_x; ++x)
                 {
-                    Ray ray = createRay(x, y);
-                    Light totalLight = trace(ray);
-                    result[x][y] = clamp(result[x][y] * (1 - weight) + weight * totalLight.cwiseSqrt());
+                    if (result.getSampleCount(x, y) >= maxSamples) continue;
+                    float error = pixelError(x, y);
+                    if (error > threshold) noisy.push_back({ -error, y * resolution_x + x });
                 }
             }
-            progressBar(sample, samples);
+            if (noisy.empty()) break;
+            std::sort(noisy.begin(), noisy.end());
+
+            // Set the sample counts of the round, and render only the tiles with noisy pixels
+            std::vector<bool> tileNoisy(tiles.size(), false);
+            int roundSamples = 0;
+            for (const auto& pixel : noisy)
+            {
+                if (remaining <= 0) break;
+                int x = pixel.second % resolution_x;
+                int y = pixel.second / resolution_x;
+                int count = result.getSampleCount(x, y);
+                int samples = std::min({ (long long)std::max(1, count / 2), (long long)(maxSamples - count), remaining });
+                sample_targets[pixel.second] = count + samples;
+                remaining -= samples;
+                roundSamples = std::max(roundSamples, samples);
+                tileNoisy[(y / tile_size) * tilesX + x / tile_size] = true;
+            }
+            std::vector<int> roundTiles;
+            for (int tile : tiles)
+            {
+                if (tileNoisy[tile]) roundTiles.push_back(tile);
+            }
+
+            std::cout << "Round " << round << ": " << noisy.size() << " pixels above the threshold" << std::endl;
+            renderTiles(roundTiles, roundSamples);
+        }
+        sample_targets.clear();
+
+        long long totalSamples = 0;
+        for (int y = 0; y < resolution_y; ++y)
+        {
+            for (int x = 0; x < resolution_x; ++x)
+            {
+                totalSamples += result.getSampleCount(x, y);
+            }
         }
 
-        std::cout << std::endl;
         auto endTime = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<float> duration = endTime - startTime; 
+        std::chrono::duration<float> duration = endTime - startTime;
         std::cout << "Used " << omp_get_max_threads() << " threads.\n" << std::endl;
-        std::cout << "Rendering completed in " << duration.count() << " seconds.\n" << std::endl;
-        
+        std::cout << "Rendering completed in " << duration.count() << " seconds with "
+                  << (double)totalSamples / pixelCount << " samples per pixel on average.\n" << std::endl;
+
         return result;
     }
 
+    /**
+     * @brief Show the number of samples taken for each pixel of the result as a false-color
+     * image, from blue for no samples to red for the most samples taken for any pixel.
+     * 
+     * @return Framebuffer the heatmap
+     */
+    Framebuffer sampleHeatmap() const {
+        int maxCount = 0;
+        for (int y = 0; y < resolution_y; ++y)
+        {
+            for (int x = 0; x < resolution_x; ++x)
+            {
+                maxCount = std::max(maxCount, result.getSampleCount(x, y));
+            }
+        }
+
+        Framebuffer heatmap(resolution_x, resolution_y);
+        for (int y = 0; y < resolution_y; ++y)
+        {
+            for (int x = 0; x < resolution_x; ++x)
+            {
+                heatmap.set(x, y, heatColor(maxCount > 0 ? (float)result.getSampleCount(x, y) / maxCount : 0));
+                heatmap.setSampleCount(x, y, 1);
+            }
+        }
+        return heatmap;
+    }
+
+    /**
+     * @brief Render the work of tracing the primary rays as a false-color image, for finding
+     * geometry that is slow to trace. Each pixel shows the counter of the ray through its center,
+     * scaled from blue for no work to red for the most work done for any pixel.
+     * 
+     * @param counter the counter to show
+     * @return Framebuffer the heatmap
+     */
+    Framebuffer heatmapRender(HeatmapCounter counter) {
+        std::vector<long> counts((std::size_t)resolution_x * resolution_y);
+        long maxCount = 0;
+        long totalCount = 0;
+
+        #pragma omp parallel for num_threads(omp_get_max_threads()) reduction(max:maxCount) reduction(+:totalCount)
+        for (int y = 0; y < resolution_y; ++y)
+        {
+            for (int x = 0; x < resolution_x; ++x)
+            {
+                TraversalCounters counters;
+                Vector target = topleft_pixel + pixel_y * y + pixel_x * x;
+                Ray ray = { .origin = camera_.position, .direction = (target - camera_.position).normalized(), .counters = &counters };
+                rayCollision(ray);
+                long count = counter == HeatmapCounter::NodeVisits ? counters.nodeVisits : counters.primitiveTests;
+                counts[(std::size_t)y * resolution_x + x] = count;
+                maxCount = std::max(maxCount, count);
+                totalCount += count;
+            }
+        }
+
+        std::cout << "Heatmap of " << (counter == HeatmapCounter::NodeVisits ? "node visits" : "primitive tests") << ": "
+                  << (double)totalCount / (resolution_x * resolution_y) << " per pixel on average, " << maxCount << " at most.\n" << std::endl;
+
+        Framebuffer heatmap(resolution_x, resolution_y);
+        for (int y = 0; y < resolution_y; ++y)
+        {
+            for (int x = 0; x < resolution_x; ++x)
+            {
+                heatmap.set(x, y, heatColor(maxCount > 0 ? (float)counts[(std::size_t)y * resolution_x + x] / maxCount : 0));
+                heatmap.setSampleCount(x, y, 1);
+            }
+        }
+        return heatmap;
+    }
+
+    /**
+     * @brief Set the seed of the random numbers. Renders with the same seed and settings give the
+     * same image whatever the number of threads.
+     * 
+     * @param newSeed the seed
+     */
+    void setSeed(uint32_t newSeed) {
+        seed = newSeed;
+    }
+
+    /**
+     * @brief Choose whether the camera rays are traced in packets of 8x8 pixels or one by one
+     * 
+     * @param packets true to trace the camera rays in packets
+     */
+    void setPacketTracing(bool packets) {
+        packet_tracing = packets;
+    }
+
+    /**
+     * @brief Choose whether the bounces of the rays of each tile are traced in sorted batches,
+     * see traceSorted, or each ray to the end of its path before the next one
+     * 
+     * @param sorting true to sort the bounces
+     */
+    void setRaySorting(bool sorting) {
+        ray_sorting = sorting;
+    }
+
+    /**
+     * @brief Set the size of the tiles the render threads take one at a time. The size is
+     * rounded up to a multiple of the packet size.
+     * 
+     * @param size width and height of the tiles in pixels
+     */
+    void setTileSize(int size) {
+        tile_size = std::max(1, (size + packetSize - 1) / packetSize) * packetSize;
+    }
+
+    /**
+     * @brief Set the order in which the tiles are handed to the render threads
+     * 
+     * @param order the tile order
+     */
+    void setTileOrder(TileOrder order) {
+        tile_order = order;
+    }
+
+    /**
+     * @brief Update the top-level BVH after objects of the scene were moved or meshes were
+     * refitted, see TLAS::Refit. Call it before rendering the next frame.
+     * 
+     * @return true if the top-level BVH was rebuilt
+     */
+    bool refitScene() {
+        bool rebuilt = tlas_.Refit();
+        scene_bounds = tlas_.getBounds();
+        return rebuilt;
+    }
+
+    /**
+     * @brief Get the top-level BVH over the objects of the scene
+     * 
+     * @return const TLAS& 
+     */
+    const TLAS& getTLAS() const {
+        return tlas_;
+    }
+
     /**
      * @brief Set the depth of field for the camera in the renderer.
      * 
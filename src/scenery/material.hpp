@@ -15,8 +15,6 @@ class Material {
         std::string name_;
 
     public:
-        RandomGenerator rnd_;
-
         /**
         * @brief Gets the color vector for the material
         * 
@@ -55,11 +53,12 @@ class Material {
         * randomDirection() and ray.normal are both normalized so this gives a random vector whose probability distribution
         * is weighted towards the ray.normal.
         * 
-        * @param ray Ray that did hit the material
+        * @param hit Information about the hit point
+        * @param rng random numbers of the bounce
         * @return vector towards the direction of the diffused ray
         */
-        Vector diffuseDir(Hit& hit) {
-            return (rnd_.randomDirection() + hit.normal).normalized();
+        Vector diffuseDir(Hit& hit, RandomGenerator& rng) {
+            return (rng.randomDirection() + hit.normal).normalized();
         }
 
         /**
@@ -78,8 +77,10 @@ class Material {
         * @brief Pure virtual function that updates the ray according to the properties of the material
         * 
         * @param ray Ray that did hit the material
+        * @param hit Information about the hit point
+        * @param rng random numbers of the bounce
         */
-        virtual void updateRay(Ray& ray, Hit& hit) = 0;
+        virtual void updateRay(Ray& ray, Hit& hit, RandomGenerator& rng) = 0;
 };
 
 /**
@@ -120,7 +121,7 @@ class Diffuse : public Material {
         * @param emission_color Emission color of the material
         */
         Diffuse(Color color, std::string name, float emission_strength, Color emission_color) :
-        Material(color, name), emission_strength_(emission_strength), emission_color_(emission_color) {
+        Material(color, name), emission_color_(emission_color), emission_strength_(emission_strength) {
             // Boolean value, to determine if material is emitting
             (emission_strength > 0) ? (emitting_ = true) : (emitting_ = false);
         }
@@ -150,10 +151,12 @@ class Diffuse : public Material {
         * @brief Updates the ray according to properties of diffuse material
         * 
         * @param ray Ray that did hit the material
+        * @param hit Information about the hit point
+        * @param rng random numbers of the bounce
         */
-        void updateRay(Ray& ray, Hit& hit) {
+        void updateRay(Ray& ray, Hit& hit, RandomGenerator& rng) {
             ray.origin = hit.point;
-            Vector diffused_dir = diffuseDir(hit);
+            Vector diffused_dir = diffuseDir(hit, rng);
             ray.direction = diffused_dir;
             updateColor(ray);
             diffuseEmission(ray);
@@ -193,12 +196,14 @@ class Reflective : public Material {
         * @brief Updates the ray according to properties of reflective material
         * 
         * @param ray Ray that did hit the material
+        * @param hit Information about the hit point
+        * @param rng random numbers of the bounce
         */
-        void updateRay(Ray& ray, Hit& hit) {
+        void updateRay(Ray& ray, Hit& hit, RandomGenerator& rng) {
             ray.origin = hit.point;
             updateColor(ray);
             Vector reflectedRay = reflectionDir(ray, hit);
-            Vector diffusedRay = diffuseDir(hit);
+            Vector diffusedRay = diffuseDir(hit, rng);
             // Weight direction of the reflection based on specularity
             ray.direction = diffusedRay + getSpecularity() * (reflectedRay - diffusedRay);
             return;
@@ -219,9 +224,10 @@ class ClearCoat : public Reflective {
         /**
         * @brief Computes if the ray performs the clear cout bounce
         * 
+        * @param rng random numbers of the bounce
         * @return bool true if clear cout bounce is performed and false otherwise
         */
-        bool clearCoatBounce() { return (clearcoat_ >= rnd_.randomZeroToOne()); }
+        bool clearCoatBounce(RandomGenerator& rng) { return (clearcoat_ >= rng.randomZeroToOne()); }
 
         /**
         * @brief Overload of the default updateColor method for clear coat material
@@ -268,12 +274,14 @@ class ClearCoat : public Reflective {
         * @brief Updates the ray according to properties of mirror material
         * 
         * @param ray Ray that did hit the material
+        * @param hit Information about the hit point
+        * @param rng random numbers of the bounce
         */
-        void updateRay(Ray& ray, Hit& hit) {
-            bool bounce = clearCoatBounce();
+        void updateRay(Ray& ray, Hit& hit, RandomGenerator& rng) {
+            bool bounce = clearCoatBounce(rng);
             ray.origin = hit.point;
             updateColor(ray, bounce);
-            Vector diffused_dir = diffuseDir(hit);
+            Vector diffused_dir = diffuseDir(hit, rng);
             if (bounce) {
                 ray.direction = diffused_dir + getSpecularity() * (reflectionDir(ray, hit) - diffused_dir);
             }
@@ -356,8 +364,9 @@ class Refractive : public Material {
         * 
         * @param ray Ray that did hit the material
         * @param hit Information about the hit point
+        * @param rng random numbers of the bounce
         */
-        void updateRay(Ray& ray, Hit& hit) {
+        void updateRay(Ray& ray, Hit& hit, RandomGenerator& rng) {
             ray.origin = hit.point;
             updateColor(ray);
 
@@ -370,7 +379,7 @@ class Refractive : public Material {
             bool must_reflect = ref_ratio * sin_theta > 1;
             float reflectanceProb = reflectance(cos_theta, ref_ratio);
 
-            if (must_reflect || reflectanceProb > rnd_.randomZeroToOne()) {
+            if (must_reflect || reflectanceProb > rng.randomZeroToOne()) {
                 // Reflects
                 Vector reflectedDir = reflectionDir(ray, hit);
                 ray.direction = reflectedDir;
@@ -31,7 +31,7 @@ public:
      * @param camera 
      * @param objects 
      */
-    Scene(Camera camera, std::list<std::shared_ptr<Object>> objects) : camera_(camera), objects_(objects) {}
+    Scene(Camera camera, std::list<std::shared_ptr<Object>> objects) : objects_(objects), camera_(camera) {}
     
 
     /**
@@ -0,0 +1,184 @@
+#pragma once
+
+#include "types.hpp"
+#include <vector>
+#include <new>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+/**
+ * @brief Allocator for standard containers that aligns their storage to the given number of bytes
+ * 
+ */
+template <typename T, std::size_t Alignment>
+struct AlignedAllocator
+{
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+    AlignedAllocator() = default;
+
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) { }
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+
+    void deallocate(T* p, std::size_t) {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+
+    bool operator==(const AlignedAllocator&) const { return true; }
+    bool operator!=(const AlignedAllocator&) const { return false; }
+};
+
+/**
+ * @brief Image being rendered, with the number of samples taken for each pixel.
+ * 
+ * The colors are single precision RGB triplets stored row by row in one allocation. Every row
+ * starts on a 64-byte cache line, so threads rendering different rows never share a line.
+ */
+class Framebuffer
+{
+public:
+    static constexpr int alignment = 64;    /* Bytes each row is aligned to */
+
+    /**
+     * @brief Default constructor for Framebuffer, creates an empty image
+     * 
+     */
+    Framebuffer() { }
+
+    /**
+     * @brief Construct a new black Framebuffer with no samples
+     * 
+     * @param width width in pixels
+     * @param height height in pixels
+     */
+    Framebuffer(int width, int height) : width_(width), height_(height), stride_(RowStride(width)),
+                pixels_((std::size_t)RowStride(width) * height), samples_((std::size_t)width * height) { }
+
+    int getWidth() const { return width_; }
+    int getHeight() const { return height_; }
+
+    /**
+     * @brief Get the number of floats from the start of a row to the start of the next row
+     * 
+     * @return int
+     */
+    int getStride() const { return stride_; }
+
+    /**
+     * @brief Get the color of a pixel
+     * 
+     * @param x x-coordinate of the pixel
+     * @param y y-coordinate of the pixel
+     * @return Color
+     */
+    Color get(int x, int y) const {
+        const float* rgb = pixel(x, y);
+        return Color(rgb[0], rgb[1], rgb[2]);
+    }
+
+    /**
+     * @brief Set the color of a pixel
+     * 
+     * @param x x-coordinate of the pixel
+     * @param y y-coordinate of the pixel
+     * @param color the new color
+     */
+    void set(int x, int y, const Color& color) {
+        float* rgb = pixel(x, y);
+        rgb[0] = color(0);
+        rgb[1] = color(1);
+        rgb[2] = color(2);
+    }
+
+    /**
+     * @brief Get the number of samples averaged into a pixel
+     * 
+     * @param x x-coordinate of the pixel
+     * @param y y-coordinate of the pixel
+     * @return int
+     */
+    int getSampleCount(int x, int y) const {
+        return samples_[(std::size_t)y * width_ + x];
+    }
+
+    /**
+     * @brief Set the number of samples averaged into a pixel
+     * 
+     * @param x x-coordinate of the pixel
+     * @param y y-coordinate of the pixel
+     * @param count number of samples
+     */
+    void setSampleCount(int x, int y, int count) {
+        samples_[(std::size_t)y * width_ + x] = count;
+    }
+
+    /**
+     * @brief Get the RGB values of a pixel
+     * 
+     * @param x x-coordinate of the pixel
+     * @param y y-coordinate of the pixel
+     * @return float* the red value, followed by the green and blue values
+     */
+    float* pixel(int x, int y) {
+        return &pixels_[(std::size_t)y * stride_ + 3 * x];
+    }
+
+    const float* pixel(int x, int y) const {
+        return &pixels_[(std::size_t)y * stride_ + 3 * x];
+    }
+
+    /**
+     * @brief Add the colors and sample counts of an image of the same size to this one, e.g. to
+     * merge two renders of the same view whose pixels hold sums of samples
+     * 
+     * @param other the image to add
+     */
+    void add(const Framebuffer& other) {
+        for (std::size_t i = 0; i < pixels_.size(); ++i) pixels_[i] += other.pixels_[i];
+        for (std::size_t i = 0; i < samples_.size(); ++i) samples_[i] += other.samples_[i];
+    }
+
+    /**
+     * @brief Set every pixel to black with no samples
+     * 
+     */
+    void clear() {
+        std::fill(pixels_.begin(), pixels_.end(), 0.0f);
+        std::fill(samples_.begin(), samples_.end(), 0);
+    }
+
+    /**
+     * @brief Get the memory taken by the colors and sample counts
+     * 
+     * @return std::size_t bytes
+     */
+    std::size_t getMemoryUsage() const {
+        return pixels_.size() * sizeof(float) + samples_.size() * sizeof(uint32_t);
+    }
+
+private:
+    int width_ = 0;
+    int height_ = 0;
+    int stride_ = 0;
+    std::vector<float, AlignedAllocator<float, alignment>> pixels_;
+    std::vector<uint32_t> samples_;
+
+    /**
+     * @brief Number of floats in a row of RGB triplets, rounded up to whole cache lines
+     * 
+     * @param width width in pixels
+     * @return int
+     */
+    static int RowStride(int width) {
+        const int lineFloats = alignment / sizeof(float);
+        return (3 * width + lineFloats - 1) / lineFloats * lineFloats;
+    }
+};
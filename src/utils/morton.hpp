@@ -0,0 +1,48 @@
+#pragma once
+
+#include "types.hpp"
+#include <cstdint>
+#include <algorithm>
+
+/**
+ * @brief Morton codes, which interleave the bits of the three coordinates of a point so that
+ * points close to each other in space are mostly close to each other in the order of their codes.
+ * 
+ */
+class Morton
+{
+public:
+    /**
+     * @brief Spread the lowest 10 bits of a number so that there are two zero bits between each of them
+     * 
+     * @param bits number whose lowest 10 bits are spread
+     * @return uint32_t
+     */
+    static uint32_t ExpandBits(uint32_t bits) {
+        bits &= 0x3ff;
+        bits = (bits | (bits << 16)) & 0x030000ff;
+        bits = (bits | (bits << 8)) & 0x0300f00f;
+        bits = (bits | (bits << 4)) & 0x030c30c3;
+        bits = (bits | (bits << 2)) & 0x09249249;
+        return bits;
+    }
+
+    /**
+     * @brief Compute the 30-bit Morton code of a point on a grid of 1024 cells per axis over a box.
+     * Points outside the box get the code of the nearest cell.
+     * 
+     * @param point the point
+     * @param box the box covered by the grid
+     * @return uint32_t
+     */
+    static uint32_t Code(const Vector& point, const AABB& box) {
+        uint32_t code = 0;
+        for(int axis = 0; axis < 3; axis++) {
+            double extent = box.max(axis) - box.min(axis);
+            double relative = extent > 0 ? (point(axis) - box.min(axis)) / extent : 0;
+            uint32_t cell = (uint32_t)std::clamp(relative * 1024, 0.0, 1023.0);
+            code |= ExpandBits(cell) << (2 - axis);
+        }
+        return code;
+    }
+};
@@ -1,24 +1,73 @@
 #pragma once
 
-#include <random>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
 #include "types.hpp"
 
 /**
- * @brief An object for creating random numbers and directions
+ * @brief A counter-based generator for creating random numbers and directions
  * 
+ * The numbers are the Philox4x32-10 hash of a counter made of the pixel, the sample and the
+ * bounce of a path, and of the number of values drawn so far, keyed by the seed. A generator
+ * is created wherever a path needs random numbers and holds no shared state, so threads never
+ * contend for it, and an image comes out the same for a given seed whichever thread renders
+ * which pixel.
  */
 class RandomGenerator
 {
 private:
 
-    std::random_device randomDevice; /* Random numbers provided by the OS */
-    std::mt19937 randomInt; /* Uniformly distributed random integers */
-    std::uniform_real_distribution<float> randZeroToOne; /* Uniformly distributed reals between 0 and 1 */
-    std::normal_distribution<float> normal;  /* Random numbers satisfying the standard normal distribution */
+    uint32_t seed_;
+    uint32_t pixel_;
+    uint32_t sample_;
+    uint32_t bounce_;
+    uint32_t block_ = 0;     /* Number of blocks of four values generated so far */
+    uint32_t values_[4];
+    int next_ = 4;           /* Index of the next unused value of the current block */
+
+    /**
+     * @brief Generate the next block of four random 32-bit values with Philox4x32-10
+     * 
+     */
+    void nextBlock() {
+        uint32_t counter[4] = { pixel_, sample_, bounce_, block_++ };
+        uint32_t key[2] = { seed_, 0x5bd1e995 };
+        for (int round = 0; round < 10; ++round) {
+            uint64_t product0 = (uint64_t)0xD2511F53 * counter[0];
+            uint64_t product1 = (uint64_t)0xCD9E8D57 * counter[2];
+            counter[0] = (uint32_t)(product1 >> 32) ^ counter[1] ^ key[0];
+            counter[1] = (uint32_t)product1;
+            counter[2] = (uint32_t)(product0 >> 32) ^ counter[3] ^ key[1];
+            counter[3] = (uint32_t)product0;
+            key[0] += 0x9E3779B9;
+            key[1] += 0xBB67AE85;
+        }
+        std::copy(counter, counter + 4, values_);
+        next_ = 0;
+    }
 
 public:
-    RandomGenerator() : randomInt(randomDevice()), randZeroToOne(0, 1), normal(0, 1) {}
-    ~RandomGenerator() = default;
+    /**
+     * @brief Construct a new RandomGenerator for one bounce of one path
+     * 
+     * @param seed seed of the image
+     * @param pixel index of the pixel the path starts from
+     * @param sample index of the sample of the pixel
+     * @param bounce index of the bounce, zero for the camera
+     */
+    RandomGenerator(uint32_t seed, uint32_t pixel, uint32_t sample, uint32_t bounce)
+        : seed_(seed), pixel_(pixel), sample_(sample), bounce_(bounce) {}
+
+    /**
+     * @brief Returns a random 32-bit integer
+     * 
+     * @return uint32_t
+     */
+    uint32_t randomInt() {
+        if (next_ == 4) nextBlock();
+        return values_[next_++];
+    }
 
     /**
      * @brief Creates a random direction, i.e., a random point on the unit sphere.
@@ -26,7 +75,10 @@ public:
      * @return 3-dimensional vector pointing to a random direction
      */
     Vector randomDirection() {
-        return Vector(normal(randomInt), normal(randomInt), normal(randomInt)).normalized();
+        float z = 1 - 2 * randomZeroToOne();
+        float angle = randomZeroToOne() * 2 * M_PI;
+        float radius = sqrt(std::max(0.0f, 1 - z * z));
+        return Vector(radius * cos(angle), radius * sin(angle), z);
     }
 
     /**
@@ -34,7 +86,7 @@ public:
      * 
      * @return float
      */
-    float randomZeroToOne() { return randZeroToOne(randomInt); }
+    float randomZeroToOne() { return (randomInt() >> 8) * (1.0f / 16777216.0f); }
 
     /**
      * @brief Creates a random point inside the unit disk.
@@ -42,9 +94,9 @@ public:
      * @return 2-dimensional vector inside of the unit disk.
      */
     Vector2 randomInCircle() {
-        float angle = randZeroToOne(randomInt) * 2 * M_PI;
-        float distance = randZeroToOne(randomInt);
+        float angle = randomZeroToOne() * 2 * M_PI;
+        float distance = randomZeroToOne();
 
         return Vector2(cos(angle), sin(angle)) * sqrt(distance);
     }
-};
\ No newline at end of file
+};
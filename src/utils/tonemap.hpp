@@ -0,0 +1,128 @@
+#pragma once
+
+#include "framebuffer.hpp"
+#include <string>
+#include <fstream>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <vector>
+
+/**
+ * @brief Operators for mapping linear radiance to display values between 0 and 1
+ * 
+ */
+enum class TonemapOperator
+{
+    Clamp,      /* Cut every channel at 1 */
+    Reinhard    /* Compress every channel with x / (1 + x), keeping detail in bright areas */
+};
+
+/**
+ * @brief Display transform applied to a rendered image after rendering.
+ * 
+ * The renderer accumulates the sum of the linear radiance of the samples of each pixel, so the
+ * same render can be shown or saved with any exposure, operator and gamma, and renders of the
+ * same view can be merged by adding their sums.
+ */
+struct Tonemap
+{
+    float exposure = 0;     /* Exposure in stops, each stop doubles the brightness */
+    TonemapOperator op = TonemapOperator::Clamp;
+    float gamma = 2;        /* Display values are raised to 1 / gamma */
+
+    /**
+     * @brief Get the mean radiance of every pixel, scaled by the exposure.
+     * 
+     * @param sums accumulated sums of the samples with their counts
+     * @return Framebuffer linear image, with one sample for every pixel that has any
+     */
+    Framebuffer linear(const Framebuffer& sums) const {
+        float scale = std::exp2(exposure);
+        return transform(sums, [scale](float value, float weight) { return value * weight * scale; });
+    }
+
+    /**
+     * @brief Get the display image of the accumulated sums
+     * 
+     * @param sums accumulated sums of the samples with their counts
+     * @return Framebuffer display image with RGB values between 0 and 1
+     */
+    Framebuffer apply(const Framebuffer& sums) const {
+        float scale = std::exp2(exposure);
+        float power = 1 / gamma;
+        bool reinhard = op == TonemapOperator::Reinhard;
+        return transform(sums, [scale, power, reinhard](float value, float weight) {
+            float radiance = std::max(value * weight * scale, 0.0f);
+            float mapped = reinhard ? radiance / (1 + radiance) : std::min(radiance, 1.0f);
+            return std::pow(mapped, power);
+        });
+    }
+
+    /**
+     * @brief Save an image as a Portable Float Map, which keeps the linear values unclamped
+     * 
+     * @param image the image, e.g. from linear
+     * @param filename name of the file
+     * @return true if the file was written
+     */
+    static bool SavePFM(const Framebuffer& image, const std::string& filename) {
+        std::ofstream file(filename, std::ios::binary);
+        if (!file) return false;
+
+        // A negative scale marks little-endian values, and the rows go from the bottom up
+        uint16_t endianTest = 1;
+        bool littleEndian = *(uint8_t*)&endianTest == 1;
+        file << "PF\n" << image.getWidth() << " " << image.getHeight() << "\n" << (littleEndian ? "-1.0" : "1.0") << "\n";
+        for (int y = image.getHeight() - 1; y >= 0; --y)
+        {
+            file.write((const char*)image.pixel(0, y), 3 * image.getWidth() * sizeof(float));
+        }
+        return (bool)file;
+    }
+
+private:
+    /**
+     * @brief Map every channel of every pixel with the given function, row by row. One over the
+     * sample count of each pixel of a row is computed first for all its channels, so the loop
+     * over the channels of the row has no divisions, gathers or branches and is vectorized.
+     * Pixels without samples get a weight of zero, so their empty sums map to zero.
+     * 
+     * @param sums accumulated sums of the samples with their counts
+     * @param map function of a channel sum and one over the sample count of the pixel
+     * @return Framebuffer the mapped image
+     */
+    template <typename Map>
+    static Framebuffer transform(const Framebuffer& sums, Map map) {
+        int width = sums.getWidth();
+        int height = sums.getHeight();
+        Framebuffer image(width, height);
+
+        #pragma omp parallel
+        {
+            std::vector<float> weights(3 * width);
+
+            #pragma omp for
+            for (int y = 0; y < height; ++y)
+            {
+                for (int x = 0; x < width; ++x)
+                {
+                    int count = sums.getSampleCount(x, y);
+                    float weight = count > 0 ? 1.0f / count : 0.0f;
+                    weights[3 * x] = weights[3 * x + 1] = weights[3 * x + 2] = weight;
+                    image.setSampleCount(x, y, count > 0);
+                }
+
+                const float* in = sums.pixel(0, y);
+                const float* weight = weights.data();
+                float* out = image.pixel(0, y);
+                #pragma omp simd
+                for (int i = 0; i < 3 * width; ++i)
+                {
+                    out[i] = map(in[i], weight[i]);
+                }
+            }
+        }
+        return image;
+    }
+};
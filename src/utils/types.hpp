@@ -30,6 +30,18 @@ struct Camera
     float DoF;
 };
 
+/**
+ * @brief Work done by the hierarchies while tracing a ray, for finding geometry that is slow to trace.
+ * 
+ * A node visit is an interior node whose children are tested, and the primitive tests count the
+ * objects of the top-level leaves and the triangles of the mesh leaves the ray enters.
+ */
+struct TraversalCounters
+{
+    long nodeVisits = 0;
+    long primitiveTests = 0;
+};
+
 /**
  * @brief Struct representing a ray
  * 
@@ -41,6 +53,7 @@ struct Ray
     bool inside_material = false;
     Color color = Color(1.0, 1.0, 1.0);
     Light light = Color(0.0, 0.0, 0.0);
+    TraversalCounters* counters = nullptr;  /* Counts the work of tracing the ray when set */
 };
 
 /**
@@ -55,3 +68,58 @@ struct Hit
     Point point;
     float distance;
 };
+
+/**
+ * @brief A group of coherent rays traced together, e.g. the camera rays of a block of pixels.
+ * 
+ * Each ray has its own hit and closest distance so far, as if it was traced alone.
+ */
+struct RayPacket
+{
+    static constexpr int maxSize = 64;
+    int size = 0;
+    Ray rays[maxSize];
+    Hit hits[maxSize];
+    float distances[maxSize];
+};
+
+/**
+ * @brief Struct representing an Axis Aligned Bounding Box
+ * 
+ */
+struct AABB
+{
+    Vector min = Vector(1e30f, 1e30f, 1e30f);
+    Vector max = Vector(-1e30f, -1e30f, -1e30f);
+
+    /**
+     * @brief Grow the box so that it contains the given point
+     * 
+     * @param p point to be included
+     */
+    void grow(const Vector& p) {
+        min = min.cwiseMin(p);
+        max = max.cwiseMax(p);
+    }
+
+    /**
+     * @brief Grow the box so that it contains the given box
+     * 
+     * @param b box to be included
+     */
+    void grow(const AABB& b) {
+        min = min.cwiseMin(b.min);
+        max = max.cwiseMax(b.max);
+    }
+
+    /**
+     * @brief Surface area of the box. An empty box has zero area.
+     * 
+     * @return double 
+     */
+    double area() const {
+        Vector e = max - min;
+        if(e(0) < 0) return 0;
+        return 2*(e(0)*e(1) + e(1)*e(2) + e(2)*e(0));
+    }
+};
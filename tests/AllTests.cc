@@ -8,6 +8,9 @@
 #include "interface_test.hpp"
 #include "triangle_test.hpp"
 #include "bvh_test.hpp"
+#include "tlas_test.hpp"
+#include "renderer_test.hpp"
 #include "fileloader_test.hpp"
+#include "random_test.hpp"
 
 #endif
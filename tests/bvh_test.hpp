@@ -3,12 +3,472 @@
 #include "types.hpp"
 #include "trianglemesh.hpp"
 #include "bvh.hpp"
+#include "bvhcache.hpp"
 #include "material.hpp"
 #include <memory>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
 
 TEST(BVH, structure) {
     std::string knight_file = "../objects/knight.obj";
     TriangleMesh knight(knight_file, Vector(5,0,-1.5), RED_DIFFUSE, Vector(0,0,M_PI/4), 1);
     //Expect equality
-    EXPECT_GE(knight.getBVH().getTriangles().size()*2-1, knight.getBVH().getNodes().size());
-}
\ No newline at end of file
+    EXPECT_GE(knight.getBVH().getTriangleCount()*2-1, knight.getBVH().getNodes().size());
+}
+
+TEST(BVH, SAHBuild) {
+    std::string knight_file = "../objects/knight.obj";
+    BVHSettings fast;
+    fast.mode = BVHBuildMode::Fast;
+    BVHSettings quality;
+    quality.mode = BVHBuildMode::Quality;
+    TriangleMesh fastKnight(knight_file, Vector(5,0,-1.5), RED_DIFFUSE, Vector(0,0,M_PI/4), 1, fast);
+    TriangleMesh sahKnight(knight_file, Vector(5,0,-1.5), RED_DIFFUSE, Vector(0,0,M_PI/4), 1, quality);
+    //Expect a cheaper tree from the SAH builder
+    EXPECT_LE(sahKnight.getBVH().SAHCost(), fastKnight.getBVH().SAHCost());
+    //Expect every triangle to be referenced by exactly one leaf
+    int leafTris = 0;
+    for(Node node : sahKnight.getBVH().getNodes()) {
+        if(node.isLeaf()) leafTris += node.triCount;
+    }
+    EXPECT_EQ(leafTris, sahKnight.getBVH().getTriangleCount());
+}
+
+TEST(BVH, CompactNodes) {
+    std::string knight_file = "../objects/knight.obj";
+    TriangleMesh knight(knight_file, Vector(5,0,-1.5), RED_DIFFUSE, Vector(0,0,M_PI/4), 1);
+    std::vector<Node> nodes = knight.getBVH().getNodes();
+    //Expect nodes to fill exactly half a cache line
+    EXPECT_EQ(32, sizeof(Node));
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(nodes.data()) % 32);
+    //Expect children to be stored after their parent and to fit inside its box
+    for(int i = 0; i < (int)nodes.size(); i++) {
+        if(nodes[i].isLeaf()) continue;
+        int children[2] = { i + 1, nodes[i].leftFirst };
+        EXPECT_GT(children[1], children[0]);
+        for(int child : children) {
+            for(int axis = 0; axis < 3; axis++) {
+                EXPECT_LE(nodes[i].min[axis], nodes[child].min[axis]);
+                EXPECT_GE(nodes[i].max[axis], nodes[child].max[axis]);
+            }
+        }
+    }
+}
+
+TEST(BVH, Stats) {
+    std::string knight_file = "../objects/knight.obj";
+    TriangleMesh knight(knight_file, Vector(5,0,-1.5), RED_DIFFUSE, Vector(0,0,M_PI/4), 1);
+    const BVH& bvh = knight.getBVH();
+    BVHStats stats = bvh.getStats();
+    EXPECT_EQ(bvh.getNodeCount(), stats.nodeCount);
+    EXPECT_EQ(stats.nodeCount, 2*stats.leafCount - 1);
+    EXPECT_EQ(bvh.getTriangleCount(), stats.primitiveCount);
+    EXPECT_EQ(bvh.getReferenceCount(), stats.referenceCount);
+    EXPECT_EQ(bvh.SAHCost(), stats.sahCost);
+    EXPECT_EQ(stats.maxDepth + 1, stats.depthHistogram.size());
+    //Expect both histograms to count every leaf
+    int depthLeaves = 0, sizeLeaves = 0, references = 0;
+    for(size_t depth = 0; depth < stats.depthHistogram.size(); depth++) {
+        depthLeaves += stats.depthHistogram[depth];
+    }
+    for(size_t size = 0; size < stats.leafSizeHistogram.size(); size++) {
+        sizeLeaves += stats.leafSizeHistogram[size];
+        references += size * stats.leafSizeHistogram[size];
+    }
+    EXPECT_EQ(stats.leafCount, depthLeaves);
+    EXPECT_EQ(stats.leafCount, sizeLeaves);
+    EXPECT_EQ(stats.referenceCount, references);
+
+    std::ostringstream json;
+    stats.WriteJSON(json, "knight");
+    EXPECT_NE(std::string::npos, json.str().find("\"leaves\": " + std::to_string(stats.leafCount) + ","));
+}
+
+TEST(BVH, WideLayout) {
+    std::string knight_file = "../objects/knight.obj";
+    BVHSettings wide;
+    wide.layout = BVHLayout::BVH4;
+    TriangleMesh knight2(knight_file, Vector(5,0,-1.5), RED_DIFFUSE, Vector(0,0,M_PI/4), 1);
+    TriangleMesh knight4(knight_file, Vector(5,0,-1.5), RED_DIFFUSE, Vector(0,0,M_PI/4), 1, wide);
+    ASSERT_NE(nullptr, knight4.getBVH4());
+    //Expect both layouts to find the same closest hits
+    for(int i = 0; i < 100; i++) {
+        float angle = i * 2 * M_PI / 100;
+        Ray ray = { .origin = Vector(0, 0, 0), .direction = Vector(5, 2*cos(angle), 2*sin(angle)).normalized() };
+        Hit hit2, hit4;
+        float distance2 = INFINITY, distance4 = INFINITY;
+        knight2.collision(ray, hit2, distance2);
+        knight4.collision(ray, hit4, distance4);
+        EXPECT_EQ(hit2.did_hit, hit4.did_hit);
+        EXPECT_EQ(distance2, distance4);
+    }
+}
+
+TEST(BVH, CompressedLayout) {
+    std::string knight_file = "../objects/knight.obj";
+    BVHSettings wide, compressed;
+    wide.layout = BVHLayout::BVH4;
+    compressed.layout = BVHLayout::CompressedBVH4;
+    TriangleMesh knight4(knight_file, Vector(5,0,-1.5), RED_DIFFUSE, Vector(0,0,M_PI/4), 1, wide);
+    TriangleMesh knightQ(knight_file, Vector(5,0,-1.5), RED_DIFFUSE, Vector(0,0,M_PI/4), 1, compressed);
+    ASSERT_NE(nullptr, knightQ.getCompressedBVH4());
+    //Expect the compressed nodes to take half the memory of the 4-wide ones
+    EXPECT_EQ(64, sizeof(CompressedNode4));
+    EXPECT_EQ(knight4.getBVH4()->getNodes().size(), knightQ.getCompressedBVH4()->getNodes().size());
+    EXPECT_EQ(knight4.getBVH4()->getMemoryUsage(), 2 * knightQ.getCompressedBVH4()->getMemoryUsage());
+
+    //Expect the dequantized boxes to contain the exact ones
+    const std::vector<Node4>& exact = knight4.getBVH4()->getNodes();
+    const std::vector<CompressedNode4>& quantized = knightQ.getCompressedBVH4()->getNodes();
+    for(size_t i = 0; i < exact.size(); i++) {
+        for(int slot = 0; slot < quantized[i].childCount; slot++) {
+            const float* exactMin[3] = { exact[i].minX, exact[i].minY, exact[i].minZ };
+            const float* exactMax[3] = { exact[i].maxX, exact[i].maxY, exact[i].maxZ };
+            for(int axis = 0; axis < 3; axis++) {
+                float scale = std::ldexp(1.0f, quantized[i].exponent[axis]);
+                EXPECT_LE(CompressedNode4::Dequantize(quantized[i].origin[axis], quantized[i].qmin[axis][slot], scale), exactMin[axis][slot]);
+                EXPECT_GE(CompressedNode4::Dequantize(quantized[i].origin[axis], quantized[i].qmax[axis][slot], scale), exactMax[axis][slot]);
+            }
+        }
+    }
+
+    //Expect both layouts to find the same closest hits
+    for(int i = 0; i < 100; i++) {
+        float angle = i * 2 * M_PI / 100;
+        Ray ray = { .origin = Vector(0, 0, 0), .direction = Vector(5, 2*cos(angle), 2*sin(angle)).normalized() };
+        Hit hit4, hitQ;
+        float distance4 = INFINITY, distanceQ = INFINITY;
+        knight4.collision(ray, hit4, distance4);
+        knightQ.collision(ray, hitQ, distanceQ);
+        EXPECT_EQ(hit4.did_hit, hitQ.did_hit);
+        EXPECT_EQ(distance4, distanceQ);
+    }
+}
+
+TEST(BVH, Occlusion) {
+    std::string knight_file = "../objects/knight.obj";
+    std::vector<TriangleMesh> knights;
+    for(BVHLayout layout : { BVHLayout::BVH2, BVHLayout::BVH4, BVHLayout::CompressedBVH4 }) {
+        BVHSettings settings;
+        settings.layout = layout;
+        knights.push_back(TriangleMesh(knight_file, Vector(5,0,-1.5), RED_DIFFUSE, Vector(0,0,M_PI/4), 1, settings));
+    }
+    //Expect every layout to report occlusion exactly when the closest hit is before the given distance
+    for(int i = 0; i < 100; i++) {
+        float angle = i * 2 * M_PI / 100;
+        Ray ray = { .origin = Vector(0, 0, 0), .direction = Vector(5, 2*cos(angle), 2*sin(angle)).normalized() };
+        Hit hit;
+        float distance = INFINITY;
+        knights[0].collision(ray, hit, distance);
+        for(const TriangleMesh& knight : knights) {
+            EXPECT_EQ(hit.did_hit, knight.occluded(ray, INFINITY));
+            if(hit.did_hit) {
+                EXPECT_TRUE(knight.occluded(ray, distance * 1.001f));
+                EXPECT_FALSE(knight.occluded(ray, distance * 0.999f));
+            }
+        }
+    }
+}
+
+TEST(BVH, TransformKernel) {
+    std::string knight_file = "../objects/knight.obj";
+    TriangleMesh knight(knight_file, Vector(5,0,-1.5), RED_DIFFUSE, Vector(0,0,M_PI/4), 1);
+    const MeshTriangles& tris = knight.getBVH().getTriangles();
+    //Expect the transform test to agree with Möller-Trumbore for rays through a point of every triangle
+    for(int tri = 0; tri < tris.getTriangleCount(); tri++) {
+        //Degenerate triangles are never hit
+        if(!std::isfinite(tris.getTransform(tri).row[2][3])) continue;
+        Vector target = 0.2*tris.getVertex(tri, 0) + 0.3*tris.getVertex(tri, 1) + 0.5*tris.getVertex(tri, 2);
+        Vector origin = target + 3*tris.getNormal(tri) + Vector(0.5, -0.3, 0.2);
+        Ray ray = { .origin = origin, .direction = (target - origin).normalized() };
+        InvRay invRay(ray);
+        float t, u, v;
+        ASSERT_TRUE(tris.getTransform(tri).Intersect(invRay.origin, invRay.direction, INFINITY, t, u, v));
+        EXPECT_NEAR(tris.Intersect(tri, ray), t, 1e-4);
+        EXPECT_NEAR(0.3, u, 1e-3);
+        EXPECT_NEAR(0.5, v, 1e-3);
+        //Expect no hit beyond the maximum distance or from behind the origin
+        EXPECT_FALSE(tris.getTransform(tri).Intersect(invRay.origin, invRay.direction, t * 0.999f, t, u, v));
+        ray.direction = -ray.direction;
+        InvRay backwards(ray);
+        EXPECT_FALSE(tris.getTransform(tri).Intersect(backwards.origin, backwards.direction, INFINITY, t, u, v));
+    }
+}
+
+TEST(BVH, TriangleGroups) {
+    std::string knight_file = "../objects/knight.obj";
+    TriangleMesh knight(knight_file, Vector(5,0,-1.5), RED_DIFFUSE, Vector(0,0,M_PI/4), 1);
+    const BVH& bvh = knight.getBVH();
+    const MeshTriangles& tris = bvh.getTriangles();
+    const int width = TriangleGroup::width;
+
+    //Expect every leaf to start a new group
+    for(const Node& node : bvh.getNodes()) {
+        if(node.isLeaf()) {
+            EXPECT_EQ(0, node.leftFirst % width);
+        }
+    }
+
+    //Expect a group to find the same closest triangle as testing its triangles one by one
+    int hits = 0;
+    for(int k = 0; k < 200; k++) {
+        TriangleGroup group;
+        TriangleTransform transforms[width];
+        for(int lane = 0; lane < width; lane++) {
+            transforms[lane] = tris.getTransform((k*width + lane*37) % tris.getTriangleCount());
+            group.set(lane, transforms[lane]);
+        }
+        Vector target = tris.getCentroid((k*width) % tris.getTriangleCount());
+        Ray ray = { .origin = target + Vector(3, 0.1*(k % 7), -0.2*(k % 5)), .direction = Vector(0, 0, 0) };
+        ray.direction = (target - ray.origin).normalized();
+        InvRay invRay(ray);
+        int lanes = k % 5 == 0 ? (1 << width) - 1 - (1 << (k % width)) : (1 << width) - 1;
+
+        float expectedT = INFINITY, expectedU = 0, expectedV = 0;
+        int expectedLane = -1;
+        for(int lane = 0; lane < width; lane++) {
+            if(!(lanes >> lane & 1)) continue;
+            if(transforms[lane].Intersect(invRay.origin, invRay.direction, expectedT, expectedT, expectedU, expectedV)) expectedLane = lane;
+        }
+        float t = INFINITY, u, v;
+        int lane = group.Intersect(invRay.origin, invRay.direction, INFINITY, lanes, t, u, v);
+        EXPECT_EQ(expectedLane, lane);
+        EXPECT_EQ(expectedLane >= 0, group.Occluded(invRay.origin, invRay.direction, INFINITY, lanes));
+        if(lane >= 0) {
+            hits++;
+            EXPECT_EQ(expectedT, t);
+            EXPECT_EQ(expectedU, u);
+            EXPECT_EQ(expectedV, v);
+        }
+    }
+    EXPECT_GT(hits, 0);
+}
+
+TEST(BVH, Instancing) {
+    std::string tree_file = "../objects/tree.obj";
+    TriangleMesh tree1(tree_file, Vector(5,0,-1.5), RED_DIFFUSE, Vector(0,0,M_PI/4), 1);
+    TriangleMesh tree2(tree_file, Vector(8,2,-1.5), RED_DIFFUSE, Vector(0,0,M_PI/2), 2);
+    //Expect both instances to share the same BVH
+    EXPECT_EQ(&tree1.getBVH(), &tree2.getBVH());
+
+    //Expect the instance to be hit where its triangles are in world space
+    std::vector<Triangle> worldTris;
+    const MeshTriangles& tris = tree2.getBVH().getTriangles();
+    for(int tri = 0; tri < tris.getTriangleCount(); tri++) {
+        worldTris.push_back(Triangle(tree2.objectToWorld(tris.getVertex(tri, 0)), tree2.objectToWorld(tris.getVertex(tri, 1)),
+                                     tree2.objectToWorld(tris.getVertex(tri, 2)), RED_DIFFUSE));
+    }
+    AABB bounds = tree2.getBounds();
+    for(int i = 0; i < 50; i++) {
+        Vector target = bounds.min + (bounds.max - bounds.min).cwiseProduct(Vector(0.5, 0.02*i, 0.3 + 0.01*i));
+        Ray ray = { .origin = target - Vector(100, 0, 0), .direction = Vector(1, 0, 0) };
+        float instanceDistance = INFINITY;
+        Hit instanceHit = { .did_hit = false };
+        tree2.collision(ray, instanceHit, instanceDistance);
+        float bruteDistance = INFINITY;
+        Hit bruteHit = { .did_hit = false };
+        for(Triangle& tri : worldTris) {
+            tri.collision(ray, bruteHit, bruteDistance);
+        }
+        EXPECT_EQ(bruteHit.did_hit, instanceHit.did_hit);
+        if(bruteHit.did_hit) {
+            EXPECT_NEAR(bruteDistance, instanceDistance, 1e-3);
+            EXPECT_NEAR(0, (bruteHit.point - instanceHit.point).norm(), 1e-3);
+        }
+    }
+}
+
+TEST(BVH, Refit) {
+    std::string knight_file = "../objects/knight.obj";
+    TriangleMesh knight(knight_file, Vector(5,0,-1.5), RED_DIFFUSE, Vector(0,0,M_PI/4), 1);
+    BVH bvh(knight.getBVH().getTriangles());
+    std::vector<Vector> vertices;
+    const MeshTriangles& tris = bvh.getTriangles();
+    for(int v = 0; v < tris.getVertexCount(); v++) {
+        vertices.push_back(Vector(tris.getCoordinates(0)[v], tris.getCoordinates(1)[v], tris.getCoordinates(2)[v]));
+    }
+    AABB before = bvh.getBounds();
+
+    //Expect a small translation to be refitted without a rebuild
+    std::vector<Vector> moved;
+    for(const Vector& v : vertices) moved.push_back(v + Vector(0.5, 0, 0));
+    EXPECT_FALSE(bvh.Refit(moved));
+    EXPECT_NEAR(before.min(0) + 0.5, bvh.getBounds().min(0), 1e-5);
+    EXPECT_NEAR(before.max(0) + 0.5, bvh.getBounds().max(0), 1e-5);
+    EXPECT_NEAR(1, bvh.getRefitDegradation(), 1e-3);
+
+    //Expect every node to contain its children after the refit
+    const std::vector<Node>& nodes = bvh.getNodes();
+    for(int i = 0; i < (int)nodes.size(); i++) {
+        if(nodes[i].isLeaf()) continue;
+        for(int child : { i + 1, nodes[i].leftFirst }) {
+            for(int axis = 0; axis < 3; axis++) {
+                EXPECT_LE(nodes[i].min[axis], nodes[child].min[axis]);
+                EXPECT_GE(nodes[i].max[axis], nodes[child].max[axis]);
+            }
+        }
+    }
+
+    //Expect scrambling the vertices to degrade the tree enough for a rebuild
+    std::vector<Vector> scrambled;
+    int vertexCount = vertices.size();
+    for(int v = 0; v < vertexCount; v++) {
+        scrambled.push_back(vertices[(v * 7919) % vertexCount]);
+    }
+    EXPECT_TRUE(bvh.Refit(scrambled));
+    EXPECT_NEAR(1, bvh.getRefitDegradation(), 1e-3);
+}
+
+TEST(BVH, RefitDetachesGeometry) {
+    std::string knight_file = "../objects/knight.obj";
+    TriangleMesh moving(knight_file, Vector(5,0,-1.5), RED_DIFFUSE, Vector(0,0,0), 1);
+    TriangleMesh still(knight_file, Vector(5,0,1.5), RED_DIFFUSE, Vector(0,0,0), 1);
+    EXPECT_EQ(&moving.getBVH(), &still.getBVH());
+    AABB before = still.getBVH().getBounds();
+
+    const MeshTriangles& tris = moving.getBVH().getTriangles();
+    std::vector<Vector> moved;
+    for(int v = 0; v < tris.getVertexCount(); v++) {
+        moved.push_back(Vector(tris.getCoordinates(0)[v] + 2, tris.getCoordinates(1)[v], tris.getCoordinates(2)[v]));
+    }
+    moving.Refit(moved);
+
+    //Expect only the refitted mesh to move, also compared with a mesh loaded after the refit
+    TriangleMesh later(knight_file, Vector(5,0,0), RED_DIFFUSE, Vector(0,0,0), 1);
+    EXPECT_NE(&moving.getBVH(), &still.getBVH());
+    EXPECT_EQ(&later.getBVH(), &still.getBVH());
+    EXPECT_NEAR(before.min(0) + 2, moving.getBVH().getBounds().min(0), 1e-5);
+    EXPECT_NEAR(before.min(0), still.getBVH().getBounds().min(0), 1e-5);
+    EXPECT_NEAR(before.min(0), later.getBVH().getBounds().min(0), 1e-5);
+}
+
+TEST(BVH, Cache) {
+    std::string path = testing::TempDir() + "bvh_cache_test.obj";
+    {
+        std::ifstream in("../objects/tree.obj", std::ios::binary);
+        std::ofstream out(path, std::ios::binary);
+        out << in.rdbuf();
+    }
+    BVHSettings settings;
+    settings.cache = true;
+    std::remove(BVHCache::CachePath(path, settings).c_str());
+
+    //Expect the first load to build the tree and write the cache file
+    TriangleMesh built(path, Vector(5,0,-1.5), RED_DIFFUSE, Vector(0,0,M_PI/4), 1, settings);
+    std::shared_ptr<BVH> cached = BVHCache::Load(path, settings);
+    ASSERT_NE(nullptr, cached);
+
+    //Expect the cached tree to be identical to the built one
+    const BVH& bvh = built.getBVH();
+    ASSERT_EQ(bvh.getNodeCount(), cached->getNodeCount());
+    EXPECT_EQ(0, std::memcmp(bvh.getNodes().data(), cached->getNodes().data(), bvh.getNodeCount()*sizeof(Node)));
+    EXPECT_EQ(bvh.getTriangleIndices(), cached->getTriangleIndices());
+    EXPECT_EQ(bvh.getTriangles().getIndices(), cached->getTriangles().getIndices());
+    for(int axis = 0; axis < 3; axis++) {
+        EXPECT_EQ(bvh.getTriangles().getCoordinates(axis), cached->getTriangles().getCoordinates(axis));
+    }
+
+    //Expect writers storing the same cache at once to each use their own temporary file
+    int stored = 0;
+    #pragma omp parallel for num_threads(4) reduction(+:stored)
+    for(int writer = 0; writer < 4; writer++) {
+        stored += BVHCache::Store(path, bvh);
+    }
+    EXPECT_EQ(4, stored);
+    cached = BVHCache::Load(path, settings);
+    ASSERT_NE(nullptr, cached);
+    EXPECT_EQ(0, std::memcmp(bvh.getNodes().data(), cached->getNodes().data(), bvh.getNodeCount()*sizeof(Node)));
+
+    //Expect a cache whose nodes point outside the arrays to be rejected
+    {
+        std::string cachePath = BVHCache::CachePath(path, settings);
+        std::fstream cache(cachePath, std::ios::in | std::ios::out | std::ios::binary);
+        cache.seekg(0, std::ios::end);
+        std::streamoff nodeStart = (std::streamoff)cache.tellg() - bvh.getNodeCount()*sizeof(Node);
+        int outside = bvh.getNodeCount() + 100;
+        cache.seekp(nodeStart + offsetof(Node, leftFirst));
+        cache.write(reinterpret_cast<const char*>(&outside), sizeof(outside));
+    }
+    EXPECT_EQ(nullptr, BVHCache::Load(path, settings));
+    ASSERT_TRUE(BVHCache::Store(path, bvh));
+    ASSERT_NE(nullptr, BVHCache::Load(path, settings));
+
+    //Expect a cache made with other settings or from an older file to be rejected
+    BVHSettings fast = settings;
+    fast.mode = BVHBuildMode::Fast;
+    EXPECT_EQ(nullptr, BVHCache::Load(path, fast));
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::app);
+        out << "\n# changed\n";
+    }
+    EXPECT_EQ(nullptr, BVHCache::Load(path, settings));
+
+    std::remove(BVHCache::CachePath(path, settings).c_str());
+    std::remove(path.c_str());
+}
+
+TEST(BVH, SpatialSplits) {
+    std::string tree_file = "../objects/tree.obj";
+    BVHSettings spatial;
+    spatial.mode = BVHBuildMode::Spatial;
+    TriangleMesh tree(tree_file, Vector(5,0,-1.5), RED_DIFFUSE, Vector(0,0,M_PI/4), 1, spatial);
+    const BVH& bvh = tree.getBVH();
+    int triCount = bvh.getTriangleCount();
+    //Expect spatial splits to lower the SAH cost within the reference budget
+    EXPECT_LT(bvh.SAHCost(), bvh.ObjectSplitSAHCost());
+    EXPECT_GT(bvh.getReferenceCount(), triCount);
+    EXPECT_LE(bvh.getReferenceCount(), triCount + (int)(triCount * spatial.splitBudget));
+
+    //Expect every triangle to be referenced by at least one leaf
+    std::vector<bool> referenced(triCount);
+    for(int idx : bvh.getTriangleIndices()) referenced[idx] = true;
+    EXPECT_EQ(std::count(referenced.begin(), referenced.end(), true), triCount);
+
+    //Expect the same hits as the object split tree
+    BVHSettings quality;
+    TriangleMesh objectTree(tree_file, Vector(5,0,-1.5), RED_DIFFUSE, Vector(0,0,M_PI/4), 1, quality);
+    for(int i = 0; i < 100; i++) {
+        Vector direction = Vector(1, 0.02*(i % 10) - 0.1, 0.03*(i / 10) - 0.1).normalized();
+        Ray ray = { .origin = Vector(-5, 0, 0), .direction = direction };
+        float spatialDistance = INFINITY, objectDistance = INFINITY;
+        Hit spatialHit = { .did_hit = false }, objectHit = { .did_hit = false };
+        tree.collision(ray, spatialHit, spatialDistance);
+        objectTree.collision(ray, objectHit, objectDistance);
+        EXPECT_EQ(objectHit.did_hit, spatialHit.did_hit);
+        EXPECT_EQ(objectDistance, spatialDistance);
+    }
+}
+
+TEST(BVH, LinearBuild) {
+    std::string tree_file = "../objects/tree.obj";
+    BVHSettings linear;
+    linear.mode = BVHBuildMode::Linear;
+    TriangleMesh tree(tree_file, Vector(5,0,-1.5), RED_DIFFUSE, Vector(0,0,M_PI/4), 1, linear);
+    const BVH& bvh = tree.getBVH();
+    int triCount = bvh.getTriangleCount();
+
+    //Expect every triangle to be referenced by exactly one leaf
+    EXPECT_EQ(bvh.getReferenceCount(), triCount);
+    std::vector<int> references(triCount);
+    for(const Node& node : bvh.getNodes()) {
+        if(!node.isLeaf()) continue;
+        for(int i = 0; i < node.triCount; i++) references[bvh.getTriangleIndices()[node.leftFirst + i]]++;
+    }
+    EXPECT_EQ(std::count(references.begin(), references.end(), 1), triCount);
+
+    //Expect the same hits as the SAH tree
+    BVHSettings quality;
+    TriangleMesh sahTree(tree_file, Vector(5,0,-1.5), RED_DIFFUSE, Vector(0,0,M_PI/4), 1, quality);
+    for(int i = 0; i < 100; i++) {
+        Vector direction = Vector(1, 0.02*(i % 10) - 0.1, 0.03*(i / 10) - 0.1).normalized();
+        Ray ray = { .origin = Vector(-5, 0, 0), .direction = direction };
+        float linearDistance = INFINITY, sahDistance = INFINITY;
+        Hit linearHit = { .did_hit = false }, sahHit = { .did_hit = false };
+        tree.collision(ray, linearHit, linearDistance);
+        sahTree.collision(ray, sahHit, sahDistance);
+        EXPECT_EQ(sahHit.did_hit, linearHit.did_hit);
+        EXPECT_EQ(sahDistance, linearDistance);
+    }
+}
@@ -15,7 +15,9 @@
 // Path to test files folder
 std::string PATH = "../tests/yaml_testfiles/";
 // Pi
+#ifndef M_PI
 #define M_PI 3.14159265358979323846264338327950288
+#endif
 
 // Define new macro that checks the given value is in range
 #define EXPECT_IN_RANGE(VAL, MIN, MAX) \
@@ -289,5 +291,28 @@ TEST(FILELOADER, InvalidMaterialType) {
         
     }, InvalidMaterialTypeException);
 }
+TEST(FILELOADER, InvalidBVHType) {
+    // Initialize filepaths and file loaders
+    std::string fpath1 = PATH + "invalid_bvh_type.yaml";
+    FileLoader fileloader1(fpath1);
+
+    // Desired error message
+    std::string msg1 = "FileLoader exception caught:\nInvalid BVH type in file: " +
+                        fpath1 + ", on line: 33.";
+
+    // Should throw invalid BVH type exception
+    EXPECT_THROW({
+        try
+        {
+            std::shared_ptr<Scene> scene = fileloader1.loadSceneFile();
+        }
+        catch(const InvalidBVHTypeException& e)
+        {
+            EXPECT_STREQ(msg1.c_str(), e.what());
+            throw;
+        }
+        
+    }, InvalidBVHTypeException);
+}
 
 #endif
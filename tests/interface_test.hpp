@@ -5,14 +5,17 @@
 #include <stdlib.h>
 #include <SFML/Graphics.hpp>
 #include "interface.hpp"
+#include "tonemap.hpp"
 #include "types.hpp"
 
 // Test createImg method
 TEST(INTERFACE, CreateImg) {
   Interface interface;
-  std::vector<Color> row1{ Color(0.1, 0.2, 0.3), Color(1.0, 0.9, 0.8) };
-  std::vector<Color> row2{ Color(0.4, 0.5, 0.6), Color(0.7, 0.6, 0.5) };
-  std::vector<std::vector<Color>> pixels{ row1, row2 };
+  Framebuffer pixels(2, 2);
+  pixels.set(0, 0, Color(0.1, 0.2, 0.3));
+  pixels.set(0, 1, Color(1.0, 0.9, 0.8));
+  pixels.set(1, 0, Color(0.4, 0.5, 0.6));
+  pixels.set(1, 1, Color(0.7, 0.6, 0.5));
   interface.createImg(pixels);
   sf::Image img = interface.getImage();
   sf::Color color1(25, 51, 76, 255);
@@ -25,4 +28,66 @@ TEST(INTERFACE, CreateImg) {
   EXPECT_EQ(img.getPixel(1, 1), color4);
 }
 
+// Test the layout of the framebuffer
+TEST(INTERFACE, Framebuffer) {
+  Framebuffer pixels(5, 3);
+  EXPECT_EQ(pixels.getWidth(), 5);
+  EXPECT_EQ(pixels.getHeight(), 3);
+
+  // Expect every row to start on a cache line and to fit the RGB values of the row
+  EXPECT_EQ(pixels.getStride() % (Framebuffer::alignment / sizeof(float)), 0);
+  EXPECT_GE(pixels.getStride(), 3 * 5);
+  for (int y = 0; y < 3; ++y) {
+    EXPECT_EQ((uintptr_t)pixels.pixel(0, y) % Framebuffer::alignment, 0);
+  }
+
+  // Expect pixels and sample counts to be stored separately and cleared together
+  pixels.set(4, 2, Color(0.25, 0.5, 0.75));
+  pixels.setSampleCount(4, 2, 7);
+  EXPECT_EQ(pixels.get(4, 2), Color(0.25, 0.5, 0.75));
+  EXPECT_EQ(pixels.getSampleCount(4, 2), 7);
+  EXPECT_EQ(pixels.get(3, 2), Color(0, 0, 0));
+  EXPECT_EQ(pixels.getSampleCount(3, 2), 0);
+  pixels.clear();
+  EXPECT_EQ(pixels.get(4, 2), Color(0, 0, 0));
+  EXPECT_EQ(pixels.getSampleCount(4, 2), 0);
+}
+
+// Test the display transform of accumulated sums
+TEST(INTERFACE, Tonemap) {
+  Framebuffer sums(3, 1);
+  sums.set(0, 0, Color(1.0, 4.0, 0.5));
+  sums.setSampleCount(0, 0, 4);
+  sums.set(1, 0, Color(8.0, 0.0, 2.0));
+  sums.setSampleCount(1, 0, 2);
+
+  // Expect the mean radiance scaled by the exposure, and black for pixels without samples
+  Tonemap tonemap;
+  tonemap.exposure = 1;
+  Framebuffer linear = tonemap.linear(sums);
+  EXPECT_FLOAT_EQ(linear.get(0, 0)(0), 0.5);
+  EXPECT_FLOAT_EQ(linear.get(0, 0)(1), 2.0);
+  EXPECT_FLOAT_EQ(linear.get(1, 0)(0), 8.0);
+  EXPECT_EQ(linear.get(2, 0), Color(0, 0, 0));
+  EXPECT_EQ(linear.getSampleCount(0, 0), 1);
+  EXPECT_EQ(linear.getSampleCount(2, 0), 0);
+
+  // Expect the clamp operator to cut at white before the gamma, and Reinhard to compress
+  tonemap.exposure = 0;
+  Framebuffer display = tonemap.apply(sums);
+  EXPECT_FLOAT_EQ(display.get(0, 0)(0), 0.5);
+  EXPECT_FLOAT_EQ(display.get(0, 0)(1), 1.0);
+  EXPECT_FLOAT_EQ(display.get(1, 0)(2), 1.0);
+  tonemap.op = TonemapOperator::Reinhard;
+  tonemap.gamma = 1;
+  display = tonemap.apply(sums);
+  EXPECT_FLOAT_EQ(display.get(0, 0)(1), 0.5);
+  EXPECT_FLOAT_EQ(display.get(1, 0)(0), 0.8);
+
+  // Expect merging two renders to add their sums and counts
+  sums.add(sums);
+  EXPECT_EQ(sums.get(1, 0), Color(16.0, 0.0, 4.0));
+  EXPECT_EQ(sums.getSampleCount(1, 0), 4);
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,39 @@
+#include <gtest/gtest.h>
+#include "randomgenerator.hpp"
+#include "types.hpp"
+
+// Test that the numbers depend only on the seed, pixel, sample and bounce
+TEST(RANDOM, Reproducible) {
+  RandomGenerator rng1(7, 100, 3, 2);
+  RandomGenerator rng2(7, 100, 3, 2);
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(rng1.randomInt(), rng2.randomInt());
+  }
+
+  RandomGenerator otherSeed(8, 100, 3, 2);
+  RandomGenerator otherPixel(7, 101, 3, 2);
+  RandomGenerator otherSample(7, 100, 4, 2);
+  RandomGenerator otherBounce(7, 100, 3, 3);
+  uint32_t value = RandomGenerator(7, 100, 3, 2).randomInt();
+  EXPECT_NE(value, otherSeed.randomInt());
+  EXPECT_NE(value, otherPixel.randomInt());
+  EXPECT_NE(value, otherSample.randomInt());
+  EXPECT_NE(value, otherBounce.randomInt());
+}
+
+// Test the ranges and the mean of the generated values
+TEST(RANDOM, Ranges) {
+  RandomGenerator rng(0, 0, 0, 0);
+  double sum = 0;
+  int count = 10000;
+  for (int i = 0; i < count; ++i) {
+    float value = rng.randomZeroToOne();
+    EXPECT_GE(value, 0);
+    EXPECT_LT(value, 1);
+    sum += value;
+
+    EXPECT_NEAR(1, rng.randomDirection().norm(), 1e-5);
+    EXPECT_LE(rng.randomInCircle().norm(), 1 + 1e-5);
+  }
+  EXPECT_NEAR(0.5, sum / count, 0.01);
+}
@@ -0,0 +1,155 @@
+#include <gtest/gtest.h>
+#include "renderer.hpp"
+#include "ball.hpp"
+#include "box.hpp"
+#include "types.hpp"
+#include "material.hpp"
+#include "scene.hpp"
+#include <memory>
+#include <list>
+
+//A ball and a box in front of a camera looking along the x-axis, lit by the default sky
+std::shared_ptr<Scene> SmallScene() {
+    std::list<std::shared_ptr<Object>> objects;
+    objects.push_back(std::make_shared<Ball>(Vector(6, 0.5, 0), 1, RED_DIFFUSE));
+    objects.push_back(std::make_shared<Box>(Vector(7, -1.5, -0.5), 1, 1, 1, RED_DIFFUSE));
+    Camera camera = { .position = Vector(0, 0, 0), .lookingAt = Vector(1, 0, 0), .direction = Vector(1, 0, 0),
+                      .up = Vector(0, 0, 1), .left = Vector(0, 1, 0), .fov = 1, .focus_distance = 1, .DoF = 0 };
+    auto scene = std::make_shared<Scene>(camera, objects);
+    scene->getEnvironment().setSky();
+    return scene;
+}
+
+TEST(RENDERER, TileOrders) {
+    //A resolution that is not a multiple of the tile size leaves partial tiles on the right and at the bottom
+    Renderer renderer(37, 19, SmallScene());
+    renderer.setTileSize(16);
+    for(TileOrder order : { TileOrder::Rows, TileOrder::Morton, TileOrder::CenterOut }) {
+        renderer.setTileOrder(order);
+        const int samples = 3;
+        const Framebuffer& result = renderer.parallelRender(samples);
+
+        //Expect every pixel to be rendered by exactly one tile
+        for(int y = 0; y < 19; y++) {
+            for(int x = 0; x < 37; x++) {
+                EXPECT_EQ(samples, result.getSampleCount(x, y)) << "pixel " << x << ", " << y;
+            }
+        }
+    }
+}
+
+//Expect two renders to have exactly the same sums and sample counts
+void ExpectSameImage(const Framebuffer& a, const Framebuffer& b) {
+    ASSERT_EQ(a.getWidth(), b.getWidth());
+    ASSERT_EQ(a.getHeight(), b.getHeight());
+    for(int y = 0; y < a.getHeight(); y++) {
+        for(int x = 0; x < a.getWidth(); x++) {
+            EXPECT_EQ(a.getSampleCount(x, y), b.getSampleCount(x, y)) << "pixel " << x << ", " << y;
+            for(int c = 0; c < 3; c++) {
+                EXPECT_EQ(a.pixel(x, y)[c], b.pixel(x, y)[c]) << "pixel " << x << ", " << y;
+            }
+        }
+    }
+}
+
+TEST(RENDERER, ThreadCountIndependent) {
+    int threads = omp_get_max_threads();
+    for(bool sorting : { false, true }) {
+        Renderer renderer(37, 19, SmallScene());
+        renderer.setTileSize(8);
+        renderer.setSeed(7);
+        renderer.setRaySorting(sorting);
+
+        //The random numbers of a path depend only on the pixel, the sample and the bounce,
+        //so the image must not change with the number of threads
+        omp_set_num_threads(1);
+        Framebuffer single = renderer.parallelRender(4);
+        omp_set_num_threads(4);
+        Framebuffer multi = renderer.parallelRender(4);
+        ExpectSameImage(single, multi);
+    }
+    omp_set_num_threads(threads);
+}
+
+//Camera rays traced one by one, in packets or in sorted batches
+void SetTracingMode(Renderer& renderer, int mode) {
+    renderer.setPacketTracing(mode == 1);
+    renderer.setRaySorting(mode == 2);
+}
+
+TEST(RENDERER, AdaptiveSampling) {
+    const int width = 37, height = 19;
+    for(int mode = 0; mode < 3; mode++) {
+        Renderer renderer(width, height, SmallScene());
+        renderer.setTileSize(16);
+        SetTracingMode(renderer, mode);
+
+        //Expect every pixel to get between the minimum and the maximum number of samples within the budget
+        const Framebuffer& result = renderer.adaptiveRender(4, 32, 0.002, 8);
+        long long total = 0;
+        int maxCount = 0;
+        for(int y = 0; y < height; y++) {
+            for(int x = 0; x < width; x++) {
+                int count = result.getSampleCount(x, y);
+                EXPECT_GE(count, 4) << "mode " << mode << ", pixel " << x << ", " << y;
+                EXPECT_LE(count, 32) << "mode " << mode << ", pixel " << x << ", " << y;
+                total += count;
+                maxCount = std::max(maxCount, count);
+            }
+        }
+        EXPECT_LE(total, 8 * width * height) << "mode " << mode;
+        EXPECT_GT(maxCount, 4) << "mode " << mode;
+
+        //Expect a later render to sample every pixel again
+        const Framebuffer& uniform = renderer.parallelRender(3);
+        for(int y = 0; y < height; y++) {
+            for(int x = 0; x < width; x++) {
+                EXPECT_EQ(3, uniform.getSampleCount(x, y)) << "mode " << mode << ", pixel " << x << ", " << y;
+            }
+        }
+    }
+}
+
+TEST(RENDERER, AdaptiveSkyOnly) {
+    //Every sample of a uniform sky has the same light, so no pixel is noisy after the first round
+    Camera camera = { .position = Vector(0, 0, 0), .lookingAt = Vector(1, 0, 0), .direction = Vector(1, 0, 0),
+                      .up = Vector(0, 0, 1), .left = Vector(0, 1, 0), .fov = 1, .focus_distance = 1, .DoF = 0 };
+    auto scene = std::make_shared<Scene>(camera, std::list<std::shared_ptr<Object>>());
+    scene->getEnvironment().setSky(Color(0.5, 0.5, 0.5), Color(0.5, 0.5, 0.5), Color(0.5, 0.5, 0.5));
+    Renderer renderer(37, 19, scene);
+    const Framebuffer& result = renderer.adaptiveRender(4, 64, 1e-4);
+    for(int y = 0; y < 19; y++) {
+        for(int x = 0; x < 37; x++) {
+            EXPECT_EQ(4, result.getSampleCount(x, y)) << "pixel " << x << ", " << y;
+        }
+    }
+}
+
+TEST(RENDERER, AdaptiveTargets) {
+    //Under a uniform sky only the pixels on the edges of the objects are noisy
+    const float sky = 0.5;
+    for(int mode = 0; mode < 3; mode++) {
+        std::shared_ptr<Scene> scene = SmallScene();
+        scene->getEnvironment().setSky(Color(sky, sky, sky), Color(sky, sky, sky), Color(sky, sky, sky));
+        Renderer renderer(37, 19, scene);
+        renderer.setTileSize(16);
+        SetTracingMode(renderer, mode);
+        const Framebuffer& result = renderer.adaptiveRender(4, 64, 1e-4);
+
+        //Expect the pixels that saw only the sky to keep the minimum samples, even in tiles that got more rounds
+        int skyPixels = 0, maxCount = 0;
+        for(int y = 0; y < 19; y++) {
+            for(int x = 0; x < 37; x++) {
+                int count = result.getSampleCount(x, y);
+                maxCount = std::max(maxCount, count);
+                const float* sum = result.pixel(x, y);
+                if(sum[0] == sky * count && sum[1] == sky * count && sum[2] == sky * count) {
+                    EXPECT_EQ(4, count) << "mode " << mode << ", pixel " << x << ", " << y;
+                    skyPixels++;
+                }
+            }
+        }
+        EXPECT_GT(skyPixels, 0) << "mode " << mode;
+        EXPECT_GT(maxCount, 4) << "mode " << mode;
+    }
+}
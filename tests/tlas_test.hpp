@@ -0,0 +1,250 @@
+#include <gtest/gtest.h>
+#include "tlas.hpp"
+#include "ball.hpp"
+#include "box.hpp"
+#include "rectangle.hpp"
+#include "triangle.hpp"
+#include "trianglemesh.hpp"
+#include "types.hpp"
+#include "material.hpp"
+#include "scene.hpp"
+#include "renderer.hpp"
+#include <memory>
+#include <list>
+
+TEST(TLAS, MatchesBruteForce) {
+    //A grid of balls and boxes
+    std::list<std::shared_ptr<Object>> objects;
+    for(int i = 0; i < 10; i++) {
+        for(int j = 0; j < 10; j++) {
+            if((i + j) % 2 == 0) {
+                objects.push_back(std::make_shared<Ball>(Vector(10 + i, j*1.5, (i*j) % 3), 0.6, RED_DIFFUSE));
+            }else {
+                objects.push_back(std::make_shared<Box>(Vector(10 + i, j*1.5, (i*j) % 3), 0.8, 0.8, 0.8, RED_DIFFUSE));
+            }
+        }
+    }
+    TLAS tlas(objects);
+    EXPECT_EQ(100, tlas.getObjectCount());
+
+    //Expect the same closest hit as testing every object
+    for(int k = 0; k < 100; k++) {
+        Vector direction = Vector(1, 0.13*(k % 10) - 0.3, 0.07*(k / 10) - 0.2).normalized();
+        Ray ray = { .origin = Vector(0, 5, 1), .direction = direction };
+
+        float tlasDistance = INFINITY;
+        Hit tlasHit = { .did_hit = false };
+        tlas.TLASCollision(ray, tlasHit, tlasDistance);
+
+        float bruteDistance = INFINITY;
+        Hit bruteHit = { .did_hit = false };
+        for(auto object : objects) {
+            object->collision(ray, bruteHit, bruteDistance);
+        }
+
+        EXPECT_EQ(bruteHit.did_hit, tlasHit.did_hit);
+        EXPECT_EQ(bruteDistance, tlasDistance);
+    }
+}
+
+TEST(TLAS, Primitives) {
+    std::list<std::shared_ptr<Object>> objects;
+    objects.push_back(std::make_shared<TriangleMesh>("../objects/knight.obj", Vector(9, 1.5, -1), RED_DIFFUSE, Vector(0, 0, M_PI/4), 1));
+    objects.push_back(std::make_shared<Ball>(Vector(12, -1, 0), 1, RED_DIFFUSE));
+    auto box = std::make_shared<Box>(Vector(10, 0, -1.5), 7, 1, 7, RED_DIFFUSE);
+    box->rotate(0.3, Vector(0, 0, 1));
+    objects.push_back(box);
+    auto rectangle = std::make_shared<Rectangle>(Vector(14, 0, 1), 6, 4, RED_DIFFUSE);
+    rectangle->rotate(0.5, Vector(0, 1, 0).normalized());
+    objects.push_back(rectangle);
+    TLAS tlas(objects);
+
+    //Expect the mesh to stay one primitive, and the box to be split into its six sides
+    EXPECT_EQ(4, tlas.getObjectCount());
+    EXPECT_EQ(9, tlas.getPrimitiveCount());
+
+    //Expect the same closest hits, normals and materials as testing every object
+    for(int k = 0; k < 200; k++) {
+        Vector direction = Vector(1, 0.04*(k % 20) - 0.4, 0.06*(k / 20) - 0.3).normalized();
+        Ray ray = { .origin = Vector(2, 0, 0.5), .direction = direction };
+
+        float tlasDistance = INFINITY;
+        Hit tlasHit = { .did_hit = false };
+        tlas.TLASCollision(ray, tlasHit, tlasDistance);
+
+        float bruteDistance = INFINITY;
+        Hit bruteHit = { .did_hit = false };
+        for(auto object : objects) {
+            object->collision(ray, bruteHit, bruteDistance);
+        }
+
+        EXPECT_EQ(bruteHit.did_hit, tlasHit.did_hit);
+        EXPECT_EQ(bruteDistance, tlasDistance);
+        if(bruteHit.did_hit) {
+            EXPECT_EQ(bruteHit.normal, tlasHit.normal);
+            EXPECT_EQ(bruteHit.material, tlasHit.material);
+        }
+    }
+}
+
+TEST(TLAS, RendererRefit) {
+    std::list<std::shared_ptr<Object>> objects;
+    auto knight = std::make_shared<TriangleMesh>("../objects/knight.obj", Vector(9, 1.5, -1), RED_DIFFUSE, Vector(0, 0, M_PI/4), 1);
+    auto ball = std::make_shared<Ball>(Vector(12, -1, 0), 1, RED_DIFFUSE);
+    auto box = std::make_shared<Box>(Vector(14, -3, 0), 1, 1, 1, RED_DIFFUSE);
+    auto rectangle = std::make_shared<Rectangle>(Vector(15, 2, 0), 2, 1, RED_DIFFUSE);
+    auto triangle = std::make_shared<Triangle>(Vector(16, 0, 0), Vector(16, 1, 0), Vector(16, 0, 1), RED_DIFFUSE);
+    objects.push_back(knight);
+    objects.push_back(ball);
+    objects.push_back(box);
+    objects.push_back(rectangle);
+    objects.push_back(triangle);
+    Camera camera = { .position = Vector(0, 0, 0), .lookingAt = Vector(1, 0, 0), .direction = Vector(1, 0, 0),
+                      .up = Vector(0, 0, 1), .left = Vector(0, 1, 0), .fov = 1, .focus_distance = 1, .DoF = 0 };
+    Renderer renderer(8, 8, std::make_shared<Scene>(camera, objects));
+
+    //Move the objects, deform the mesh and refit the top-level BVH of the renderer
+    ball->setPosition(Vector(10, 4, 2));
+    box->setPosition(Vector(10, -3, 1));
+    box->rotate(0.4, Vector(0, 0, 1));
+    rectangle->setPosition(Vector(11, 2.5, -0.5));
+    triangle->setPosition(Vector(9, -1, 0.5));
+
+    //Expect the corners to move with the position, so that rotations still pivot about the center
+    AABB boxBounds = box->getBounds();
+    EXPECT_NEAR(0, ((boxBounds.min + boxBounds.max) / 2 - Vector(10, -3, 1)).norm(), 1e-5);
+    AABB rectangleBounds = rectangle->getBounds();
+    EXPECT_NEAR(0, ((rectangleBounds.min + rectangleBounds.max) / 2 - Vector(11, 2.5, -0.5)).norm(), 1e-5);
+    AABB triangleBounds = triangle->getBounds();
+    EXPECT_NEAR(0, (triangleBounds.min - Vector(9, -1, 0.5)).norm(), 1e-5);
+    EXPECT_NEAR(0, (triangleBounds.max - Vector(9, 0, 1.5)).norm(), 1e-5);
+    const MeshTriangles& tris = knight->getBVH().getTriangles();
+    std::vector<Vector> moved;
+    for(int v = 0; v < tris.getVertexCount(); v++) {
+        moved.push_back(Vector(tris.getCoordinates(0)[v], tris.getCoordinates(1)[v] - 3, tris.getCoordinates(2)[v] * 1.5));
+    }
+    knight->Refit(moved);
+    renderer.refitScene();
+
+    //Expect the same closest hits as testing every object, also outside the old bounds
+    for(int k = 0; k < 1600; k++) {
+        Vector direction = Vector(1, 0.015*(k % 80) - 0.6, 0.02*(k / 80) - 0.2).normalized();
+        Ray ray = { .origin = Vector(2, 0, 0.5), .direction = direction };
+
+        float tlasDistance = INFINITY;
+        Hit tlasHit = { .did_hit = false };
+        renderer.getTLAS().TLASCollision(ray, tlasHit, tlasDistance);
+
+        float bruteDistance = INFINITY;
+        Hit bruteHit = { .did_hit = false };
+        for(auto object : objects) {
+            object->collision(ray, bruteHit, bruteDistance);
+        }
+
+        EXPECT_EQ(bruteHit.did_hit, tlasHit.did_hit);
+        EXPECT_EQ(bruteDistance, tlasDistance);
+    }
+
+    //Expect rays aimed at the new places of the moved objects to hit them
+    for(Vector target : { Vector(10, 4, 2), Vector(10, -3, 1), Vector(11, 2.5, -0.5), Vector(9, -0.7, 0.8) }) {
+        Ray ray = { .origin = Vector(2, 0, 0.5), .direction = (target - Vector(2, 0, 0.5)).normalized() };
+        float tlasDistance = INFINITY;
+        Hit tlasHit = { .did_hit = false };
+        renderer.getTLAS().TLASCollision(ray, tlasHit, tlasDistance);
+        EXPECT_TRUE(tlasHit.did_hit);
+        EXPECT_LE(tlasDistance, (target - ray.origin).norm() + 1e-3);
+    }
+}
+
+TEST(TLAS, Occlusion) {
+    std::list<std::shared_ptr<Object>> objects;
+    for(int i = 0; i < 10; i++) {
+        objects.push_back(std::make_shared<Ball>(Vector(10 + i, i*1.5, 0), 0.6, RED_DIFFUSE));
+        objects.push_back(std::make_shared<Box>(Vector(10 + i, i*1.5, 2), 0.8, 0.8, 0.8, RED_DIFFUSE));
+    }
+    TLAS tlas(objects);
+
+    //Expect a ray to be occluded exactly when its closest hit is before the given distance
+    for(int k = 0; k < 100; k++) {
+        Vector direction = Vector(1, 0.13*(k % 10) - 0.3, 0.07*(k / 10) - 0.2).normalized();
+        Ray ray = { .origin = Vector(0, 5, 1), .direction = direction };
+
+        float distance = INFINITY;
+        Hit hit = { .did_hit = false };
+        tlas.TLASCollision(ray, hit, distance);
+
+        EXPECT_EQ(hit.did_hit, tlas.TLASOccluded(ray, INFINITY));
+        if(hit.did_hit) {
+            EXPECT_TRUE(tlas.TLASOccluded(ray, distance * 1.01f));
+            EXPECT_FALSE(tlas.TLASOccluded(ray, distance * 0.99f));
+        }
+    }
+}
+
+TEST(TLAS, Packets) {
+    std::list<std::shared_ptr<Object>> objects;
+    objects.push_back(std::make_shared<TriangleMesh>("../objects/knight.obj", Vector(9, 1.5, -1), RED_DIFFUSE, Vector(0, 0, M_PI/4), 1));
+    objects.push_back(std::make_shared<Ball>(Vector(12, -1, 0), 1, RED_DIFFUSE));
+    objects.push_back(std::make_shared<Box>(Vector(10, 0, -1.5), 7, 1, 7, RED_DIFFUSE));
+    TLAS tlas(objects);
+
+    //Expect the rays of a packet to find the same closest hits as when traced one by one
+    for(int k = 0; k < 20; k++) {
+        RayPacket packet;
+        packet.size = 1 + k * 3;
+        for(int i = 0; i < packet.size; i++) {
+            Vector direction = Vector(1, 0.04*(i % 8) - 0.3 + 0.02*k, 0.04*(i / 8) - 0.25).normalized();
+            packet.rays[i] = { .origin = Vector(2, 0, 0.5), .direction = direction };
+            packet.hits[i] = { .did_hit = false };
+            packet.distances[i] = INFINITY;
+        }
+        tlas.TLASPacketCollision(packet);
+
+        for(int i = 0; i < packet.size; i++) {
+            Ray ray = packet.rays[i];
+            float distance = INFINITY;
+            Hit hit = { .did_hit = false };
+            tlas.TLASCollision(ray, hit, distance);
+            EXPECT_EQ(hit.did_hit, packet.hits[i].did_hit);
+            EXPECT_EQ(distance, packet.distances[i]);
+            if(hit.did_hit) {
+                EXPECT_EQ(hit.material, packet.hits[i].material);
+                EXPECT_NEAR(0, (hit.normal - packet.hits[i].normal).norm(), 1e-6);
+            }
+        }
+    }
+}
+
+TEST(TLAS, Counters) {
+    std::list<std::shared_ptr<Object>> objects;
+    for(int i = 0; i < 10; i++) {
+        objects.push_back(std::make_shared<Ball>(Vector(10 + i, i*1.5, 0), 0.6, RED_DIFFUSE));
+    }
+    TLAS tlas(objects);
+
+    //Expect a ray missing every box to visit only the root, and a ray through a ball to test it
+    TraversalCounters missCounters;
+    Ray miss = { .origin = Vector(0, 0, 0), .direction = Vector(-1, 0, 0), .counters = &missCounters };
+    float distance = INFINITY;
+    Hit hit = { .did_hit = false };
+    tlas.TLASCollision(miss, hit, distance);
+    EXPECT_EQ(0, missCounters.nodeVisits);
+    EXPECT_EQ(0, missCounters.primitiveTests);
+
+    TraversalCounters hitCounters;
+    Ray ray = { .origin = Vector(12, 3, 5), .direction = Vector(0, 0, -1), .counters = &hitCounters };
+    tlas.TLASCollision(ray, hit, distance);
+    EXPECT_TRUE(hit.did_hit);
+    EXPECT_GT(hitCounters.nodeVisits, 0);
+    EXPECT_GE(hitCounters.primitiveTests, 1);
+    EXPECT_LT(hitCounters.primitiveTests, 10);
+}
+
+TEST(TLAS, Empty) {
+    TLAS tlas(std::list<std::shared_ptr<Object>>{});
+    Ray ray = { .origin = Vector(0, 0, 0), .direction = Vector(1, 0, 0) };
+    float distance = INFINITY;
+    Hit hit = { .did_hit = false };
+    tlas.TLASCollision(ray, hit, distance);
+    EXPECT_FALSE(hit.did_hit);
+}